@@ -0,0 +1,241 @@
+/*
+ * bench_hashtable.c
+ *
+ * join, lookup hit and lookup miss of fast_hashtable_t against
+ * fast_swisstable_t on the same keys. both hash with fast_hash64.
+ *
+ * usage: bench_hashtable [keys] [rounds]
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "fast_hashtable.h"
+#include "fast_swisstable.h"
+#include "fast_memory.h"
+
+#define BENCH_KEYS      200000
+#define BENCH_ROUNDS    5
+#define BENCH_KEY_LEN   16
+#define BENCH_MAX_KEYS  100000000
+
+#define bench_min(a, b) ((a) < (b) ? (a) : (b))
+
+typedef struct bench_item_s {
+    fast_hashtable_link_t   link;
+    char                    key[BENCH_KEY_LEN];
+} bench_item_t;
+
+typedef struct bench_ops_s {
+    const char             *name;
+    void                 *(*create)(FAST_HASHTABLE_CMP *cmp, size_t n);
+    int                   (*join)(void *t, fast_hashtable_link_t *link);
+    void                 *(*lookup)(void *t, const void *key, size_t len);
+    void                  (*free)(void *t);
+    FAST_HASHTABLE_CMP     *cmp;
+} bench_ops_t;
+
+static int bench_cmp(const void *a, const void *b, size_t len);
+static void *bench_ht_create(FAST_HASHTABLE_CMP *cmp, size_t n);
+static int   bench_ht_join(void *t, fast_hashtable_link_t *link);
+static void *bench_ht_lookup(void *t, const void *key, size_t len);
+static void  bench_ht_free(void *t);
+static void *bench_st_create(FAST_HASHTABLE_CMP *cmp, size_t n);
+static int   bench_st_join(void *t, fast_hashtable_link_t *link);
+static void *bench_st_lookup(void *t, const void *key, size_t len);
+static void  bench_st_free(void *t);
+static double bench_now(void);
+static void bench_shuffle(size_t *order, size_t n);
+
+static bench_ops_t bench_ops[] = {
+    { "hashtable", bench_ht_create, bench_ht_join, bench_ht_lookup,
+      bench_ht_free, bench_cmp },
+    //cmp NULL keeps short keys in the slots
+    { "swisstable", bench_st_create, bench_st_join, bench_st_lookup,
+      bench_st_free, NULL },
+    { "swisstable+cmp", bench_st_create, bench_st_join, bench_st_lookup,
+      bench_st_free, bench_cmp },
+};
+
+int
+main(int argc, char **argv)
+{
+    bench_item_t   *items;
+    char           *misses;
+    size_t         *order, n = BENCH_KEYS, rounds = BENCH_ROUNDS, i, r, t;
+    size_t          found;
+    double          start, join, hit, miss;
+    void           *table;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        rounds = strtoul(argv[2], NULL, 10);
+    }
+    if (!n || n > BENCH_MAX_KEYS || !rounds) {
+        fprintf(stderr, "usage: %s [keys] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    items = memory_calloc(n * sizeof(bench_item_t));
+    misses = memory_calloc(n * BENCH_KEY_LEN);
+    order = memory_calloc(n * sizeof(size_t));
+    if (!items || !misses || !order) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        snprintf(items[i].key, BENCH_KEY_LEN, "key:%u", (unsigned int)i);
+        snprintf(misses + i * BENCH_KEY_LEN, BENCH_KEY_LEN, "miss:%u",
+            (unsigned int)i);
+        order[i] = i;
+    }
+
+    printf("%zu keys, best of %zu rounds, ns per operation\n", n, rounds);
+    printf("%-16s %10s %10s %10s\n", "table", "join", "hit", "miss");
+
+    for (t = 0; t < sizeof(bench_ops) / sizeof(bench_ops[0]); t++) {
+        join = hit = miss = 1e30;
+
+        for (r = 0; r < rounds; r++) {
+            //the table starts small, joins pay for its growth
+            table = bench_ops[t].create(bench_ops[t].cmp, 16);
+            if (!table) {
+                fprintf(stderr, "%s: create failed\n", bench_ops[t].name);
+                return 1;
+            }
+            for (i = 0; i < n; i++) {
+                items[i].link.key = items[i].key;
+                items[i].link.len = strlen(items[i].key);
+                items[i].link.next = NULL;
+            }
+
+            bench_shuffle(order, n);
+            start = bench_now();
+            for (i = 0; i < n; i++) {
+                bench_ops[t].join(table, &items[order[i]].link);
+            }
+            join = bench_min(join, bench_now() - start);
+
+            bench_shuffle(order, n);
+            found = 0;
+            start = bench_now();
+            for (i = 0; i < n; i++) {
+                found += bench_ops[t].lookup(table, items[order[i]].key,
+                    items[order[i]].link.len) != NULL;
+            }
+            hit = bench_min(hit, bench_now() - start);
+            if (found != n) {
+                fprintf(stderr, "%s: %zu of %zu keys found\n",
+                    bench_ops[t].name, found, n);
+                return 1;
+            }
+
+            found = 0;
+            start = bench_now();
+            for (i = 0; i < n; i++) {
+                found += bench_ops[t].lookup(table,
+                    misses + order[i] * BENCH_KEY_LEN,
+                    strlen(misses + order[i] * BENCH_KEY_LEN)) != NULL;
+            }
+            miss = bench_min(miss, bench_now() - start);
+            if (found) {
+                fprintf(stderr, "%s: %zu missing keys found\n",
+                    bench_ops[t].name, found);
+                return 1;
+            }
+
+            bench_ops[t].free(table);
+        }
+
+        printf("%-16s %10.1f %10.1f %10.1f\n", bench_ops[t].name,
+            join * 1e9 / n, hit * 1e9 / n, miss * 1e9 / n);
+    }
+
+    memory_free(order, n * sizeof(size_t));
+    memory_free(misses, n * BENCH_KEY_LEN);
+    memory_free(items, n * sizeof(bench_item_t));
+
+    return 0;
+}
+
+static int
+bench_cmp(const void *a, const void *b, size_t len)
+{
+    return memcmp(a, b, len);
+}
+
+static void *
+bench_ht_create(FAST_HASHTABLE_CMP *cmp, size_t n)
+{
+    return fast_hashtable_create(cmp, n, NULL, NULL);
+}
+
+static int
+bench_ht_join(void *t, fast_hashtable_link_t *link)
+{
+    return fast_hashtable_join(t, link);
+}
+
+static void *
+bench_ht_lookup(void *t, const void *key, size_t len)
+{
+    return fast_hashtable_lookup(t, key, len);
+}
+
+static void
+bench_ht_free(void *t)
+{
+    fast_hashtable_free_memory(t);
+}
+
+static void *
+bench_st_create(FAST_HASHTABLE_CMP *cmp, size_t n)
+{
+    return fast_swisstable_create(cmp, n, NULL, NULL);
+}
+
+static int
+bench_st_join(void *t, fast_hashtable_link_t *link)
+{
+    return fast_swisstable_join(t, link);
+}
+
+static void *
+bench_st_lookup(void *t, const void *key, size_t len)
+{
+    return fast_swisstable_lookup(t, key, len);
+}
+
+static void
+bench_st_free(void *t)
+{
+    fast_swisstable_free_memory(t);
+}
+
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//repeatable from run to run, lookups do not follow the join order
+static void
+bench_shuffle(size_t *order, size_t n)
+{
+    static uint64_t seed = 0x2545f4914f6cdd1dULL;
+    size_t          i, j, tmp;
+
+    for (i = n - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        j = seed % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
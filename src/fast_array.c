@@ -6,6 +6,12 @@
 #include "fast_array.h"
 #include "fast_memory.h"
 
+#define array_elt(a, i)  ((uchar_t *)(a)->elts + (a)->size * (i))
+
+static int  array_grow(array_t *a, uint32_t n);
+static int  array_index_build(array_t *a);
+static void array_index_free(array_t *a);
+
 void *
 array_create(pool_t *p, uint32_t n, size_t size)
 {
@@ -31,6 +37,7 @@ array_create(pool_t *p, uint32_t n, size_t size)
     a->size = size;
     a->nalloc = n;
     a->pool = p;
+    a->index = NULL;
 
     return a;
 }
@@ -45,6 +52,7 @@ array_init(array_t *array, pool_t *pool, uint32_t n, size_t size)
     array->size = size;
     array->nalloc = n;
     array->pool = pool;
+    array->index = NULL;
     if (pool) {
         array->elts = pool_alloc(pool, n * size);
     } else {
@@ -62,6 +70,10 @@ array_reset(array_t *a)
 {
     memset(a->elts, 0, a->size * a->nelts);
     a->nelts = 0;
+    if (a->index) {
+        memset(a->index->slots, 0, (a->index->mask + 1) * sizeof(uint64_t));
+        a->index->indexed = 0;
+    }
 }
 
 void
@@ -74,7 +86,8 @@ array_destroy(array_t *a)
     }
     
     p = a->pool;
-    
+    array_index_free(a);
+
     if (!p) {
         memory_free(a->elts,a->size * a->nalloc);
         return;
@@ -94,46 +107,14 @@ void *
 array_push(array_t *a)
 {
     void   *elt = NULL;
-    void   *na = NULL;
-    size_t  size = 0;
-    pool_t *p = NULL;
 
     if (!a) {
         return NULL;
     }
     
-    p = a->pool;
     //the array is full, note: array need continuous space
-    if (a->nelts == a->nalloc) {
-        size = a->size * a->nalloc;
-        if (!p) {
-            return NULL;
-        }
-        //the array allocation is the last in the pool
-        //and there is continuous space for it
-        if ((uchar_t *) a->elts + size == p->data.last
-            && p->data.last + a->size <= p->data.end) {
-            p->data.last += a->size;
-            a->nalloc++;
-        } else {
-            //allocate a new array
-            if (p) {
-                na = pool_alloc(p, 2 * size);
-                if (!na) {
-                    return NULL;
-                }
-                memory_memcpy(na, a->elts, size);
-                a->elts = na;
-                a->nalloc *= 2;
-            } else {
-                na = memory_realloc(a->elts, 2 * size);
-                if (!na) {
-                    return NULL;
-                }
-                a->elts = na;
-                a->nalloc *= 2;
-            }
-        }
+    if (a->nelts == a->nalloc && array_grow(a, a->nelts + 1) != FAST_OK) {
+        return NULL;
     }
     elt = (uchar_t *) a->elts + a->size * a->nelts;
     a->nelts++;
@@ -141,6 +122,222 @@ array_push(array_t *a)
     return elt;
 }
 
+int
+array_reserve(array_t *a, uint32_t n)
+{
+    if (!a) {
+        return FAST_ERROR;
+    }
+    if (n <= a->nalloc) {
+        return FAST_OK;
+    }
+    return array_grow(a, n);
+}
+
+void *
+array_push_n(array_t *a, uint32_t n)
+{
+    void   *elt = NULL;
+
+    if (!a || !n || n > UINT32_MAX - a->nelts) {
+        return NULL;
+    }
+    if (a->nelts + n > a->nalloc && array_grow(a, a->nelts + n) != FAST_OK) {
+        return NULL;
+    }
+    elt = array_elt(a, a->nelts);
+    a->nelts += n;
+
+    return elt;
+}
+
+void
+array_sort(array_t *a, array_sort_func cmp)
+{
+    if (!a || a->nelts < 2) {
+        return;
+    }
+    qsort(a->elts, a->nelts, a->size, cmp);
+    if (a->index) {
+        array_index_build(a);
+    }
+}
+
+void *
+array_bsearch(array_t *a, const void *key, array_sort_func cmp)
+{
+    if (!a || !a->nelts) {
+        return NULL;
+    }
+    return bsearch(key, a->elts, a->nelts, a->size, cmp);
+}
+
+int
+array_index(array_t *a, array_hash_func hash, array_cmp_func cmp)
+{
+    if (!a || !hash || !cmp) {
+        return FAST_ERROR;
+    }
+    if (!a->index) {
+        a->index = a->pool ? pool_calloc(a->pool, sizeof(array_index_t))
+                           : memory_calloc(sizeof(array_index_t));
+        if (!a->index) {
+            return FAST_ERROR;
+        }
+    }
+    a->index->hash = hash;
+    a->index->cmp = cmp;
+
+    return array_index_build(a);
+}
+
+void *
+array_index_find(array_t *a, uint64_t hash, void *key)
+{
+    array_index_t  *index;
+    uint64_t        slot, tag;
+    uint32_t        i, n;
+    void           *v;
+
+    if (!a || !a->index) {
+        return NULL;
+    }
+    index = a->index;
+
+    //a tail over an eighth of the index costs more than building it again
+    n = a->nelts - index->indexed;
+    if (n > ARRAY_INDEX_MIN && n > index->indexed / 8) {
+        array_index_build(a);
+    }
+
+    tag = hash & 0xffffffff00000000ULL;
+    for (i = (uint32_t)hash & index->mask; ; i = (i + 1) & index->mask) {
+        slot = index->slots[i];
+        if (!slot) {
+            break;
+        }
+        if ((slot & 0xffffffff00000000ULL) == tag) {
+            v = array_elt(a, (uint32_t)slot - 1);
+            if (index->cmp(v, key)) {
+                return v;
+            }
+        }
+    }
+
+    for (i = index->indexed; i < a->nelts; i++) {
+        v = array_elt(a, i);
+        if (index->cmp(v, key)) {
+            return v;
+        }
+    }
+    return NULL;
+}
+
+//a grows to n elements at least, twice what it had at least
+static int
+array_grow(array_t *a, uint32_t n)
+{
+    void   *na = NULL;
+    size_t  size, nalloc;
+
+    nalloc = (size_t)a->nalloc * 2;
+    if (nalloc < n) {
+        nalloc = n;
+    }
+    if (nalloc > UINT32_MAX) {
+        nalloc = UINT32_MAX;
+    }
+    size = a->size * a->nalloc;
+    if (a->pool) {
+        //grows in place if the array is the last allocation of its block
+        na = pool_realloc(a->pool, a->elts, size, a->size * nalloc);
+    } else {
+        na = memory_realloc(a->elts, a->size * nalloc);
+    }
+    if (!na) {
+        return FAST_ERROR;
+    }
+    a->elts = na;
+    a->nalloc = (uint32_t)nalloc;
+
+    return FAST_OK;
+}
+
+//slots for twice the elements, the first found of equal keys wins
+static int
+array_index_build(array_t *a)
+{
+    array_index_t  *index = a->index;
+    uint64_t       *slots, hash;
+    uint32_t        i, j, size = ARRAY_INDEX_MIN;
+
+    while (size < 2 * (size_t)a->nelts && size < (1U << 31)) {
+        size <<= 1;
+    }
+
+    if (size != index->mask + 1 || !index->slots) {
+        slots = a->pool ? pool_calloc(a->pool, size * sizeof(uint64_t))
+                        : memory_calloc(size * sizeof(uint64_t));
+        if (!slots) {
+            //the old slots may be out of place, everything is scanned
+            if (index->slots) {
+                memset(index->slots, 0,
+                    (index->mask + 1) * sizeof(uint64_t));
+            }
+            index->indexed = 0;
+            return FAST_ERROR;
+        }
+        if (index->slots) {
+            if (a->pool) {
+                pool_free(a->pool, index->slots,
+                    (index->mask + 1) * sizeof(uint64_t));
+            } else {
+                memory_free(index->slots,
+                    (index->mask + 1) * sizeof(uint64_t));
+            }
+        }
+        index->slots = slots;
+        index->mask = size - 1;
+    } else {
+        memset(index->slots, 0, size * sizeof(uint64_t));
+    }
+
+    for (i = 0; i < a->nelts; i++) {
+        hash = index->hash(array_elt(a, i));
+        for (j = (uint32_t)hash & index->mask; index->slots[j];
+             j = (j + 1) & index->mask) {
+            /* void */
+        }
+        index->slots[j] = (hash & 0xffffffff00000000ULL) | (i + 1);
+    }
+    index->indexed = a->nelts;
+
+    return FAST_OK;
+}
+
+static void
+array_index_free(array_t *a)
+{
+    array_index_t  *index = a->index;
+
+    if (!index) {
+        return;
+    }
+    a->index = NULL;
+    if (a->pool) {
+        if (index->slots) {
+            pool_free(a->pool, index->slots,
+                (index->mask + 1) * sizeof(uint64_t));
+        }
+        pool_free(a->pool, index, sizeof(array_index_t));
+        return;
+    }
+    if (index->slots) {
+        memory_free(index->slots, (index->mask + 1) * sizeof(uint64_t));
+    }
+    memory_free(index, sizeof(array_index_t));
+}
+
 void
 array_inherit(void *pool, array_t *a1, array_t *a2, func_cmp func, func_inherit func2)
 {
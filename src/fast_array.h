@@ -4,17 +4,39 @@
 #include "fast_types.h"
 #include "fast_string.h"
 
+typedef struct array_index_s array_index_t;
+
 struct array_s {
-    void        *elts;
-    uint32_t     nelts;
-    size_t       size;
-    uint32_t     nalloc;
-    pool_t      *pool;
+    void          *elts;
+    uint32_t       nelts;
+    size_t         size;
+    uint32_t       nalloc;
+    pool_t        *pool;
+    array_index_t *index;   //NULL until array_index
 };
 
 typedef int (*array_cmp_func)(void *, void *);
 typedef void (*func_inherit)(void *, void *,void *);
 typedef int (*func_cmp)(void *,void *);
+//qsort order: below 0, 0 or above 0
+typedef int (*array_sort_func)(const void *, const void *);
+typedef uint64_t (*array_hash_func)(void *);
+
+/*
+ * open addressing side index over the elements, a slot is the high half
+ * of the hash and the element number + 1. elements pushed after the
+ * index was built are looked for one by one until they are many enough
+ * to build it again
+ */
+struct array_index_s {
+    uint64_t        *slots;
+    uint32_t         mask;
+    uint32_t         indexed;   //elements in the slots
+    array_hash_func  hash;
+    array_cmp_func   cmp;
+};
+
+#define ARRAY_INDEX_MIN     16
 
 void *array_create(pool_t *p, uint32_t n, size_t size);
 int   array_init(array_t *array, pool_t *pool, uint32_t n, size_t size);
@@ -23,5 +45,21 @@ void  array_destroy(array_t *a);
 void *array_push(array_t *a);
 void *array_find(array_t *array, void* dst, array_cmp_func);
 
+//room for n elements in all, the elements stay where they are if it fits
+int   array_reserve(array_t *a, uint32_t n);
+//n elements in a row at the end, not cleared
+void *array_push_n(array_t *a, uint32_t n);
+//sorts in place, the index is built again
+void  array_sort(array_t *a, array_sort_func cmp);
+//a sorted by cmp, which gets the key first and an element second
+void *array_bsearch(array_t *a, const void *key, array_sort_func cmp);
+
+/*
+ * hash gives the hash of an element, array_index_find takes the hash of
+ * the key and cmp(elt, key) as array_find does
+ */
+int   array_index(array_t *a, array_hash_func hash, array_cmp_func cmp);
+void *array_index_find(array_t *a, uint64_t hash, void *key);
+
 #endif
 
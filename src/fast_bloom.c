@@ -0,0 +1,173 @@
+#include <math.h>
+#include "fast_bloom.h"
+#include "fast_memory.h"
+#include "fast_memory_pool.h"
+
+#define FAST_BLOOM_K_MAX        16
+#define FAST_BLOOM_WORDS        (FAST_BLOOM_BLOCK_SIZE / sizeof(uint64_t))
+
+/*
+ * the block came from the high half, the bits come from the hash mixed
+ * again: double hashing inside the 512 bits of the block
+ */
+#define fast_bloom_bits(hash, a, b) do { \
+    uint64_t m__ = (hash) * 0x9e3779b97f4a7c15ULL; \
+    (a) = (uint32_t)(m__ >> 32); \
+    (b) = (uint32_t)m__ | 1; \
+} while (0)
+
+fast_bloom_t *
+fast_bloom_create(size_t keys, size_t bits_per_key,
+    fast_mem_allocator_t *allocator)
+{
+    fast_bloom_t   *bloom;
+    unsigned int    err_no;
+    size_t          bits;
+
+    if (!bits_per_key) {
+        bits_per_key = FAST_BLOOM_BITS_PER_KEY;
+    }
+    if (!keys) {
+        keys = 1;
+    }
+    bits = keys * bits_per_key;
+
+    if (allocator) {
+        bloom = allocator->calloc(allocator, sizeof(fast_bloom_t), &err_no);
+    } else {
+        bloom = memory_calloc(sizeof(fast_bloom_t));
+    }
+    if (!bloom) {
+        return NULL;
+    }
+    bloom->allocator = allocator;
+    bloom->nblocks = (bits + FAST_BLOOM_BLOCK_BITS - 1) / FAST_BLOOM_BLOCK_BITS;
+    if (bloom->nblocks > 0xffffffffULL) {
+        bloom->nblocks = 0xffffffffULL;
+    }
+    //k = ln 2 * bits per key is the best for a plain filter
+    bloom->k = (size_t)(bits_per_key * 0.69 + 0.5);
+    if (bloom->k < 1) {
+        bloom->k = 1;
+    }
+    if (bloom->k > FAST_BLOOM_K_MAX) {
+        bloom->k = FAST_BLOOM_K_MAX;
+    }
+    bloom->capacity = keys;
+    bloom->bits_per_key = bits_per_key;
+
+    //one spare line to align the blocks on
+    bloom->mem_size = (bloom->nblocks + 1) * FAST_BLOOM_BLOCK_SIZE;
+    if (allocator) {
+        bloom->mem = allocator->calloc(allocator, bloom->mem_size, &err_no);
+    } else {
+        bloom->mem = memory_calloc(bloom->mem_size);
+    }
+    if (!bloom->mem) {
+        if (allocator) {
+            fast_mem_allocator_free(allocator, bloom, &err_no);
+        } else {
+            memory_free(bloom, sizeof(fast_bloom_t));
+        }
+        return NULL;
+    }
+    bloom->blocks = (uint64_t *)fast_align_ptr(bloom->mem,
+        FAST_BLOOM_BLOCK_SIZE);
+
+    return bloom;
+}
+
+void
+fast_bloom_free(fast_bloom_t *bloom)
+{
+    unsigned int    err_no;
+
+    if (!bloom) {
+        return;
+    }
+    if (bloom->allocator) {
+        fast_mem_allocator_free(bloom->allocator, bloom->mem, &err_no);
+        fast_mem_allocator_free(bloom->allocator, bloom, &err_no);
+    } else {
+        memory_free(bloom->mem, bloom->mem_size);
+        memory_free(bloom, sizeof(fast_bloom_t));
+    }
+}
+
+void
+fast_bloom_clear(fast_bloom_t *bloom)
+{
+    memory_zero(bloom->blocks, bloom->nblocks * FAST_BLOOM_BLOCK_SIZE);
+    bloom->added = 0;
+    bloom->stale = 0;
+    bloom->false_pos = 0;
+}
+
+void
+fast_bloom_add(fast_bloom_t *bloom, uint64_t hash)
+{
+    uint64_t       *block, bit;
+    uint32_t        a, b;
+    size_t          i, pos;
+
+    fast_bloom_mix(hash);
+    block = fast_bloom_block(bloom, hash);
+    fast_bloom_bits(hash, a, b);
+    for (i = 0; i < bloom->k; i++, a += b) {
+        pos = a & (FAST_BLOOM_BLOCK_BITS - 1);
+        bit = (uint64_t)1 << (pos & 63);
+        //a bit already set costs no write to the line
+        if (!(block[pos >> 6] & bit)) {
+            __sync_fetch_and_or(&block[pos >> 6], bit);
+        }
+    }
+    __sync_fetch_and_add(&bloom->added, 1);
+}
+
+int
+fast_bloom_test(fast_bloom_t *bloom, uint64_t hash)
+{
+    uint64_t       *block;
+    uint32_t        a, b;
+    size_t          i, pos;
+
+    fast_bloom_mix(hash);
+    block = fast_bloom_block(bloom, hash);
+    fast_bloom_bits(hash, a, b);
+    for (i = 0; i < bloom->k; i++, a += b) {
+        pos = a & (FAST_BLOOM_BLOCK_BITS - 1);
+        if (!(block[pos >> 6] & ((uint64_t)1 << (pos & 63)))) {
+            return FAST_BLOOM_FALSE;
+        }
+    }
+    return FAST_BLOOM_TRUE;
+}
+
+int
+fast_bloom_get_stat(fast_bloom_t *bloom, fast_bloom_stat_t *stat)
+{
+    uint64_t       *block;
+    size_t          i, j, set;
+    double          fpr = 0;
+
+    if (!bloom || !stat) {
+        return FAST_BLOOM_ERROR;
+    }
+    //a blocked filter is as good as the mean of its blocks
+    for (i = 0; i < bloom->nblocks; i++) {
+        block = bloom->blocks + i * FAST_BLOOM_WORDS;
+        for (set = 0, j = 0; j < FAST_BLOOM_WORDS; j++) {
+            set += __builtin_popcountll(block[j]);
+        }
+        fpr += pow((double)set / FAST_BLOOM_BLOCK_BITS, (double)bloom->k);
+    }
+
+    stat->bits = bloom->nblocks * FAST_BLOOM_BLOCK_BITS;
+    stat->k = bloom->k;
+    stat->added = bloom->added;
+    stat->stale = bloom->stale;
+    stat->false_pos = bloom->false_pos;
+    stat->fpr = fpr / bloom->nblocks;
+
+    return FAST_BLOOM_OK;
+}
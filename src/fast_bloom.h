@@ -0,0 +1,90 @@
+#ifndef _FAST_BLOOM_H
+#define _FAST_BLOOM_H
+
+#include "fast_types.h"
+#include "fast_mem_allocator.h"
+
+/*
+ * blocked bloom filter over 64 bit hashes: the high half of the hash
+ * picks a cache line, k bits of that line are set from the rest, so a
+ * test reads one line whatever k is. hashes are mixed first, one that
+ * only fills the low bits (n * 31 + c on short keys, an identity hash on
+ * ints) would otherwise put every key in the first line.
+ *
+ * adds set the bits with atomic ors, readers and adders may run at once
+ * and a key added is never missed. nothing can be taken out: a removed
+ * key only counts as stale until the filter is cleared and built again,
+ * clear must not run beside readers.
+ */
+
+#define FAST_BLOOM_OK                  (0)
+#define FAST_BLOOM_ERROR               (-1)
+
+#define FAST_BLOOM_FALSE               0
+#define FAST_BLOOM_TRUE                1
+
+#define FAST_BLOOM_BLOCK_SIZE          64
+#define FAST_BLOOM_BLOCK_BITS          (FAST_BLOOM_BLOCK_SIZE * 8)
+//10 bits per key, 7 probes: about 1% false positives
+#define FAST_BLOOM_BITS_PER_KEY        10
+
+typedef struct fast_bloom_stat_s {
+    size_t                  bits;
+    size_t                  k;
+    size_t                  added;
+    size_t                  stale;        // added then removed
+    size_t                  false_pos;    // reported by the user
+    double                  fpr;          // estimated from the bits set
+} fast_bloom_stat_t;
+
+typedef struct fast_bloom_s {
+    uint64_t               *blocks;       // cache line aligned
+    void                   *mem;          // as allocated
+    size_t                  mem_size;
+    fast_mem_allocator_t   *allocator;    // NULL for memory_alloc
+    size_t                  nblocks;
+    size_t                  k;
+    size_t                  capacity;     // keys it was sized for
+    size_t                  bits_per_key;
+    volatile size_t         added;
+    volatile size_t         stale;
+    volatile size_t         false_pos;
+} fast_bloom_t;
+
+//bits_per_key 0 picks FAST_BLOOM_BITS_PER_KEY
+fast_bloom_t *fast_bloom_create(size_t keys, size_t bits_per_key,
+    fast_mem_allocator_t *allocator);
+void  fast_bloom_free(fast_bloom_t *bloom);
+void  fast_bloom_clear(fast_bloom_t *bloom);
+
+void  fast_bloom_add(fast_bloom_t *bloom, uint64_t hash);
+//FALSE if the hash was never added, TRUE if it may have been
+int   fast_bloom_test(fast_bloom_t *bloom, uint64_t hash);
+//a test said TRUE for a key that was not there
+#define fast_bloom_false_positive(bloom) \
+    __sync_fetch_and_add(&(bloom)->false_pos, 1)
+#define fast_bloom_stale(bloom) \
+    __sync_fetch_and_add(&(bloom)->stale, 1)
+#define fast_bloom_prefetch(bloom, hash) do { \
+    uint64_t h__ = (hash); \
+    fast_bloom_mix(h__); \
+    __builtin_prefetch(fast_bloom_block(bloom, h__)); \
+} while (0)
+
+//murmur3's 64 bit finalizer, every bit of h moves the high half
+#define fast_bloom_mix(h) do { \
+    (h) ^= (h) >> 33; \
+    (h) *= 0xff51afd7ed558ccdULL; \
+    (h) ^= (h) >> 33; \
+    (h) *= 0xc4ceb9fe1a85ec53ULL; \
+    (h) ^= (h) >> 33; \
+} while (0)
+//of a mixed hash
+#define fast_bloom_block(bloom, hash) \
+    ((bloom)->blocks + ((((hash) >> 32) * (bloom)->nblocks) >> 32) \
+        * (FAST_BLOOM_BLOCK_SIZE / sizeof(uint64_t)))
+
+//walks every block for the estimate
+int   fast_bloom_get_stat(fast_bloom_t *bloom, fast_bloom_stat_t *stat);
+
+#endif
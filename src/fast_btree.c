@@ -0,0 +1,696 @@
+#include "fast_btree.h"
+#include "fast_memory.h"
+#include "fast_memory_pool.h"
+#include "fast_sys.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#define FAST_BTREE_NODE_HEAD    offsetof(fast_btree_node_t, keys)
+
+//values of a leaf, children of an inner node, after the key slots
+#define fast_btree_ptrs(tree, node) \
+    ((void **)((node)->keys + (tree)->slots))
+#define fast_btree_child(tree, node, i) \
+    ((fast_btree_node_t *)fast_btree_ptrs(tree, node)[i])
+
+typedef struct fast_btree_path_s {
+    fast_btree_node_t      *node;
+    size_t                  pos;        // child taken
+} fast_btree_path_t;
+
+static fast_btree_node_t *fast_btree_node_new(fast_btree_t *tree,
+    uint16_t leaf);
+static void fast_btree_node_free(fast_btree_t *tree, fast_btree_node_t *node);
+static void fast_btree_free_node(fast_btree_t *tree, fast_btree_node_t *node);
+static size_t fast_btree_descend(fast_btree_t *tree, fast_btree_key_t key,
+    fast_btree_path_t *path);
+static void fast_btree_split(fast_btree_t *tree, fast_btree_path_t *path,
+    size_t depth, fast_btree_node_t **spare);
+static void fast_btree_unlink(fast_btree_t *tree, fast_btree_path_t *path,
+    size_t depth);
+
+/*
+ * keys of a node below key, or not above key when le is set: the slot a
+ * leaf holds key at, the child an inner node sends key to. the keys are
+ * compared all of them, no branch on the data, the node is a few lines
+ * read front to back
+ */
+static _xinline size_t
+fast_btree_rank(const fast_btree_key_t *keys, size_t n, fast_btree_key_t key,
+    int le)
+{
+    size_t          i = 0, below = 0;
+
+#if defined(__AVX2__)
+    __m256i         k, v, gt;
+
+    if (!le && key == INT64_MIN) {
+        return 0;
+    }
+    k = _mm256_set1_epi64x(le ? key : key - 1);
+    for (; i + 4 <= n; i += 4) {
+        v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        gt = _mm256_cmpgt_epi64(v, k);
+        below += 4 - __builtin_popcount(_mm256_movemask_pd(
+            _mm256_castsi256_pd(gt)));
+    }
+#elif defined(__SSE4_2__)
+    __m128i         k, v, gt;
+
+    if (!le && key == INT64_MIN) {
+        return 0;
+    }
+    k = _mm_set1_epi64x(le ? key : key - 1);
+    for (; i + 2 <= n; i += 2) {
+        v = _mm_loadu_si128((const __m128i *)(keys + i));
+        gt = _mm_cmpgt_epi64(v, k);
+        below += 2 - __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(gt)));
+    }
+#endif
+
+    if (le) {
+        for (; i < n; i++) {
+            below += keys[i] <= key;
+        }
+    } else {
+        for (; i < n; i++) {
+            below += keys[i] < key;
+        }
+    }
+    return below;
+}
+
+/*
+ * a miss on every line of the node one after the other is what the
+ * lookup waits on, ask for them all at once when the node is reached
+ */
+static _xinline void
+fast_btree_prefetch(fast_btree_t *tree, fast_btree_node_t *node)
+{
+    size_t  off;
+
+    for (off = DEFAULT_CACHELINE_SIZE; off < tree->node_size;
+         off += DEFAULT_CACHELINE_SIZE) {
+        __builtin_prefetch((uchar_t *)node + off);
+    }
+}
+
+fast_btree_t *
+fast_btree_create(size_t node_size, fast_mem_allocator_t *allocator)
+{
+    fast_btree_t   *tree;
+    sys_info_t      info;
+    unsigned int    err_no;
+    size_t          line = DEFAULT_CACHELINE_SIZE;
+
+    if (!node_size) {
+        memory_zero(&info, sizeof(sys_info_t));
+        if (sys_get_info(&info) == FAST_OK && info.lv1_dcacheline_size > 0) {
+            line = (size_t)info.lv1_dcacheline_size;
+        }
+        node_size = line * FAST_BTREE_NODE_LINES;
+    }
+    if (node_size < FAST_BTREE_NODE_MIN) {
+        node_size = FAST_BTREE_NODE_MIN;
+    }
+
+    if (allocator) {
+        tree = allocator->calloc(allocator, sizeof(fast_btree_t), &err_no);
+    } else {
+        tree = memory_calloc(sizeof(fast_btree_t));
+    }
+    if (!tree) {
+        return NULL;
+    }
+    tree->allocator = allocator;
+    tree->node_size = node_size;
+    //slots keys and slots + 1 pointers fit in the node
+    tree->slots = (node_size - FAST_BTREE_NODE_HEAD - sizeof(void *))
+        / (sizeof(fast_btree_key_t) + sizeof(void *));
+    //the spare slot takes the key that makes a node split
+    tree->cap = tree->slots - 1;
+
+    return tree;
+}
+
+void
+fast_btree_free_memory(fast_btree_t *tree)
+{
+    unsigned int    err_no;
+
+    if (!tree) {
+        return;
+    }
+    if (tree->root) {
+        fast_btree_free_node(tree, tree->root);
+    }
+    if (tree->allocator) {
+        fast_mem_allocator_free(tree->allocator, tree, &err_no);
+    } else {
+        memory_free(tree, sizeof(fast_btree_t));
+    }
+}
+
+void *
+fast_btree_find(fast_btree_t *tree, fast_btree_key_t key)
+{
+    fast_btree_node_t  *node = tree->root;
+    size_t              pos;
+
+    if (!node) {
+        return NULL;
+    }
+    for ( ;; ) {
+        fast_btree_prefetch(tree, node);
+        if (node->leaf) {
+            break;
+        }
+        pos = fast_btree_rank(node->keys, node->count, key, FAST_BTREE_TRUE);
+        node = fast_btree_child(tree, node, pos);
+    }
+    pos = fast_btree_rank(node->keys, node->count, key, FAST_BTREE_FALSE);
+    if (pos < node->count && node->keys[pos] == key) {
+        return fast_btree_ptrs(tree, node)[pos];
+    }
+    return NULL;
+}
+
+int
+fast_btree_insert(fast_btree_t *tree, fast_btree_key_t key, void *value)
+{
+    fast_btree_path_t   path[FAST_BTREE_MAX_HEIGHT];
+    fast_btree_node_t  *leaf, *spare[FAST_BTREE_MAX_HEIGHT + 1];
+    void              **values;
+    size_t              depth, pos, need, d, i;
+
+    if (!tree->root) {
+        tree->root = fast_btree_node_new(tree, FAST_BTREE_TRUE);
+        if (!tree->root) {
+            return FAST_BTREE_ERROR;
+        }
+        tree->height = 1;
+    }
+    if (tree->height >= FAST_BTREE_MAX_HEIGHT) {
+        return FAST_BTREE_ERROR;
+    }
+
+    depth = fast_btree_descend(tree, key, path);
+    leaf = path[depth].node;
+    values = fast_btree_ptrs(tree, leaf);
+    pos = path[depth].pos;
+
+    if (pos < leaf->count && leaf->keys[pos] == key) {
+        values[pos] = value;
+        return FAST_BTREE_OK;
+    }
+
+    /*
+     * a full leaf splits, so does every full node above it and a new
+     * root may be wanted: the nodes are had before the tree is touched,
+     * a failed insert leaves it as it was
+     */
+    need = 0;
+    if (leaf->count == tree->cap) {
+        need = 1;
+        for (d = depth; d > 0 && path[d - 1].node->count == tree->cap; d--) {
+            need++;
+        }
+        if (!d) {
+            need++;
+        }
+    }
+    for (i = 0; i < need; i++) {
+        spare[i] = fast_btree_node_new(tree, FAST_BTREE_FALSE);
+        if (!spare[i]) {
+            while (i--) {
+                fast_btree_node_free(tree, spare[i]);
+            }
+            return FAST_BTREE_ERROR;
+        }
+    }
+
+    memmove(leaf->keys + pos + 1, leaf->keys + pos,
+        (leaf->count - pos) * sizeof(fast_btree_key_t));
+    memmove(values + pos + 1, values + pos,
+        (leaf->count - pos) * sizeof(void *));
+    leaf->keys[pos] = key;
+    values[pos] = value;
+    leaf->count++;
+    tree->count++;
+
+    if (need) {
+        fast_btree_split(tree, path, depth, spare);
+    }
+    return FAST_BTREE_OK;
+}
+
+void *
+fast_btree_delete(fast_btree_t *tree, fast_btree_key_t key)
+{
+    fast_btree_path_t   path[FAST_BTREE_MAX_HEIGHT];
+    fast_btree_node_t  *leaf;
+    void              **values, *value;
+    size_t              depth, pos;
+
+    if (!tree->root) {
+        return NULL;
+    }
+
+    depth = fast_btree_descend(tree, key, path);
+    leaf = path[depth].node;
+    values = fast_btree_ptrs(tree, leaf);
+    pos = path[depth].pos;
+
+    if (pos >= leaf->count || leaf->keys[pos] != key) {
+        return NULL;
+    }
+    value = values[pos];
+
+    leaf->count--;
+    memmove(leaf->keys + pos, leaf->keys + pos + 1,
+        (leaf->count - pos) * sizeof(fast_btree_key_t));
+    memmove(values + pos, values + pos + 1,
+        (leaf->count - pos) * sizeof(void *));
+    tree->count--;
+
+    if (!leaf->count) {
+        fast_btree_unlink(tree, path, depth);
+    }
+    return value;
+}
+
+int
+fast_btree_load(fast_btree_t *tree, const fast_btree_key_t *keys,
+    void **values, size_t n)
+{
+    fast_btree_node_t **level, *node, *prev = NULL;
+    fast_btree_key_t   *low;
+    void              **ptrs;
+    size_t              i, j, fill, nodes, per, extra, done, next, count;
+    int                 leaf = FAST_BTREE_TRUE;
+
+    if (tree->root) {
+        return FAST_BTREE_ERROR;
+    }
+    if (!n) {
+        return FAST_BTREE_OK;
+    }
+    for (i = 1; i < n; i++) {
+        if (keys[i - 1] >= keys[i]) {
+            return FAST_BTREE_ERROR;
+        }
+    }
+
+    fill = tree->cap * FAST_BTREE_LOAD_FILL / 100;
+    if (fill < 2) {
+        fill = 2;
+    }
+    nodes = (n + fill - 1) / fill;
+
+    //the nodes of a level and the lowest key under each
+    level = memory_alloc(nodes * sizeof(fast_btree_node_t *));
+    low = memory_alloc(nodes * sizeof(fast_btree_key_t));
+    if (!level || !low) {
+        goto failed;
+    }
+
+    count = n;
+    tree->height = 0;
+    for ( ;; ) {
+        //spread the entries evenly, the last node is no emptier than the rest
+        per = count / nodes;
+        extra = count % nodes;
+        for (i = 0, done = 0; i < nodes; i++, done = next) {
+            next = done + per + (i < extra);
+            node = fast_btree_node_new(tree, leaf);
+            if (!node) {
+                //the level built so far and what it has not taken yet
+                for (j = 0; j < i; j++) {
+                    fast_btree_free_node(tree, level[j]);
+                }
+                for (j = done; !leaf && j < count; j++) {
+                    fast_btree_free_node(tree, level[j]);
+                }
+                goto failed;
+            }
+            ptrs = fast_btree_ptrs(tree, node);
+            if (leaf) {
+                memcpy(node->keys, keys + done,
+                    (next - done) * sizeof(fast_btree_key_t));
+                memcpy(ptrs, values + done, (next - done) * sizeof(void *));
+                node->count = next - done;
+                if (prev) {
+                    prev->next = node;
+                }
+                prev = node;
+                low[i] = keys[done];
+            } else {
+                //a child beside another takes the key of its lowest entry
+                for (j = done; j < next; j++) {
+                    ptrs[j - done] = level[j];
+                    if (j > done) {
+                        node->keys[j - done - 1] = low[j];
+                    }
+                }
+                node->count = next - done - 1;
+                low[i] = low[done];
+            }
+            level[i] = node;
+        }
+        tree->height++;
+        leaf = FAST_BTREE_FALSE;
+
+        if (nodes == 1) {
+            break;
+        }
+        //an inner node has fill + 1 children
+        count = nodes;
+        nodes = (count + fill) / (fill + 1);
+    }
+
+    tree->root = level[0];
+    tree->count = n;
+    memory_free(level, 0);
+    memory_free(low, 0);
+    return FAST_BTREE_OK;
+
+failed:
+    if (level) {
+        memory_free(level, 0);
+    }
+    if (low) {
+        memory_free(low, 0);
+    }
+    tree->root = NULL;
+    tree->height = 0;
+    return FAST_BTREE_ERROR;
+}
+
+void
+fast_btree_seek(fast_btree_t *tree, fast_btree_key_t key,
+    fast_btree_iter_t *it)
+{
+    fast_btree_node_t  *node = tree->root;
+    size_t              pos;
+
+    it->tree = tree;
+    it->node = NULL;
+    it->pos = 0;
+    if (!node) {
+        return;
+    }
+    for ( ;; ) {
+        fast_btree_prefetch(tree, node);
+        if (node->leaf) {
+            break;
+        }
+        pos = fast_btree_rank(node->keys, node->count, key, FAST_BTREE_TRUE);
+        node = fast_btree_child(tree, node, pos);
+    }
+    pos = fast_btree_rank(node->keys, node->count, key, FAST_BTREE_FALSE);
+    if (pos == node->count) {
+        node = node->next;
+        pos = 0;
+    }
+    it->node = node;
+    it->pos = pos;
+}
+
+void
+fast_btree_first(fast_btree_t *tree, fast_btree_iter_t *it)
+{
+    fast_btree_node_t  *node = tree->root;
+
+    it->tree = tree;
+    it->pos = 0;
+    if (node) {
+        while (!node->leaf) {
+            node = fast_btree_child(tree, node, 0);
+        }
+    }
+    it->node = node;
+}
+
+int
+fast_btree_iter_next(fast_btree_iter_t *it, fast_btree_key_t *key,
+    void **value)
+{
+    fast_btree_node_t  *node = it->node;
+
+    if (!node) {
+        return FAST_BTREE_FALSE;
+    }
+    if (key) {
+        *key = node->keys[it->pos];
+    }
+    if (value) {
+        *value = fast_btree_ptrs(it->tree, node)[it->pos];
+    }
+    if (++it->pos == node->count) {
+        it->node = node->next;
+        it->pos = 0;
+        //the next leaf is wanted soon, it was never near this one
+        if (it->node) {
+            __builtin_prefetch(it->node);
+        }
+    }
+    return FAST_BTREE_TRUE;
+}
+
+size_t
+fast_btree_range(fast_btree_t *tree, fast_btree_key_t low,
+    fast_btree_key_t high, fast_btree_walk_pt walk, void *data)
+{
+    fast_btree_iter_t   it;
+    fast_btree_key_t    key;
+    void               *value;
+    size_t              n = 0;
+
+    fast_btree_seek(tree, low, &it);
+    while (fast_btree_iter_next(&it, &key, &value)) {
+        if (key >= high) {
+            break;
+        }
+        n++;
+        if (walk && walk(key, value, data)) {
+            break;
+        }
+    }
+    return n;
+}
+
+static fast_btree_node_t *
+fast_btree_node_new(fast_btree_t *tree, uint16_t leaf)
+{
+    fast_btree_node_t  *node;
+    unsigned int        err_no;
+
+    if (tree->allocator) {
+        node = fast_mem_allocator_memalign(tree->allocator,
+            DEFAULT_CACHELINE_SIZE, tree->node_size, &err_no);
+    } else {
+        node = memory_memalign(DEFAULT_CACHELINE_SIZE, tree->node_size);
+    }
+    if (!node) {
+        return NULL;
+    }
+    node->count = 0;
+    node->leaf = leaf;
+    node->reserved = 0;
+    node->next = NULL;
+    tree->nodes++;
+
+    return node;
+}
+
+static void
+fast_btree_node_free(fast_btree_t *tree, fast_btree_node_t *node)
+{
+    unsigned int    err_no;
+
+    tree->nodes--;
+    if (tree->allocator) {
+        fast_mem_allocator_memalign_free(tree->allocator, node, &err_no);
+    } else {
+        memory_free(node, 0);
+    }
+}
+
+static void
+fast_btree_free_node(fast_btree_t *tree, fast_btree_node_t *node)
+{
+    size_t  i;
+
+    if (!node->leaf) {
+        for (i = 0; i <= node->count; i++) {
+            fast_btree_free_node(tree, fast_btree_child(tree, node, i));
+        }
+    }
+    fast_btree_node_free(tree, node);
+}
+
+//fills path from the root down, returns the depth of the leaf
+static size_t
+fast_btree_descend(fast_btree_t *tree, fast_btree_key_t key,
+    fast_btree_path_t *path)
+{
+    fast_btree_node_t  *node = tree->root;
+    size_t              depth = 0;
+
+    for ( ;; ) {
+        fast_btree_prefetch(tree, node);
+        if (node->leaf) {
+            break;
+        }
+        path[depth].node = node;
+        path[depth].pos = fast_btree_rank(node->keys, node->count, key,
+            FAST_BTREE_TRUE);
+        node = fast_btree_child(tree, node, path[depth].pos);
+        depth++;
+    }
+    path[depth].node = node;
+    path[depth].pos = fast_btree_rank(node->keys, node->count, key,
+        FAST_BTREE_FALSE);
+
+    return depth;
+}
+
+/*
+ * the node at depth holds one key over the capacity: its upper half
+ * moves to a spare node and the key parting them goes up, which may
+ * split the parent in turn. insert counted the spares wanted
+ */
+static void
+fast_btree_split(fast_btree_t *tree, fast_btree_path_t *path, size_t depth,
+    fast_btree_node_t **spare)
+{
+    fast_btree_node_t  *node, *right, *parent;
+    fast_btree_key_t    sep;
+    void              **ptrs, **rptrs, **pptrs;
+    size_t              half, pos;
+
+    for ( ;; ) {
+        node = path[depth].node;
+        right = *spare++;
+        right->leaf = node->leaf;
+        ptrs = fast_btree_ptrs(tree, node);
+        rptrs = fast_btree_ptrs(tree, right);
+        half = node->count / 2;
+
+        if (node->leaf) {
+            right->count = node->count - half;
+            memcpy(right->keys, node->keys + half,
+                right->count * sizeof(fast_btree_key_t));
+            memcpy(rptrs, ptrs + half, right->count * sizeof(void *));
+            node->count = half;
+            right->next = node->next;
+            node->next = right;
+            sep = right->keys[0];
+        } else {
+            //the middle key goes up and out of both halves
+            sep = node->keys[half];
+            right->count = node->count - half - 1;
+            memcpy(right->keys, node->keys + half + 1,
+                right->count * sizeof(fast_btree_key_t));
+            memcpy(rptrs, ptrs + half + 1,
+                (right->count + 1) * sizeof(void *));
+            node->count = half;
+        }
+
+        if (!depth) {
+            parent = *spare;
+            parent->keys[0] = sep;
+            pptrs = fast_btree_ptrs(tree, parent);
+            pptrs[0] = node;
+            pptrs[1] = right;
+            parent->count = 1;
+            tree->root = parent;
+            tree->height++;
+            return;
+        }
+
+        depth--;
+        parent = path[depth].node;
+        pptrs = fast_btree_ptrs(tree, parent);
+        pos = path[depth].pos;
+        memmove(parent->keys + pos + 1, parent->keys + pos,
+            (parent->count - pos) * sizeof(fast_btree_key_t));
+        memmove(pptrs + pos + 2, pptrs + pos + 1,
+            (parent->count - pos) * sizeof(void *));
+        parent->keys[pos] = sep;
+        pptrs[pos + 1] = right;
+        parent->count++;
+
+        if (parent->count <= tree->cap) {
+            return;
+        }
+    }
+}
+
+/*
+ * the leaf at depth is empty: it leaves the chain and its parent, an
+ * inner node left with no child goes the same way, a root left with one
+ * child hands the tree down to it
+ */
+static void
+fast_btree_unlink(fast_btree_t *tree, fast_btree_path_t *path, size_t depth)
+{
+    fast_btree_node_t  *node = path[depth].node, *prev, *parent;
+    void              **pptrs;
+    size_t              d, pos;
+
+    //the leaf before is the last one under the nearest left sibling
+    for (d = depth; d > 0 && !path[d - 1].pos; d--) {
+        /* void */
+    }
+    if (d > 0) {
+        prev = fast_btree_child(tree, path[d - 1].node, path[d - 1].pos - 1);
+        while (!prev->leaf) {
+            prev = fast_btree_child(tree, prev, prev->count);
+        }
+        prev->next = node->next;
+    }
+
+    for ( ;; ) {
+        fast_btree_node_free(tree, node);
+        if (!depth) {
+            tree->root = NULL;
+            tree->height = 0;
+            return;
+        }
+
+        depth--;
+        parent = path[depth].node;
+        pptrs = fast_btree_ptrs(tree, parent);
+        pos = path[depth].pos;
+
+        if (!parent->count) {
+            //the only child went, the parent is empty too
+            node = parent;
+            continue;
+        }
+        //the key on the side of the child goes with it
+        if (pos) {
+            memmove(parent->keys + pos - 1, parent->keys + pos,
+                (parent->count - pos) * sizeof(fast_btree_key_t));
+        } else {
+            memmove(parent->keys, parent->keys + 1,
+                (parent->count - 1) * sizeof(fast_btree_key_t));
+        }
+        memmove(pptrs + pos, pptrs + pos + 1,
+            (parent->count - pos) * sizeof(void *));
+        parent->count--;
+        break;
+    }
+
+    while (!tree->root->leaf && !tree->root->count) {
+        node = tree->root;
+        tree->root = fast_btree_child(tree, node, 0);
+        tree->height--;
+        fast_btree_node_free(tree, node);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef _FAST_BTREE_H
+#define _FAST_BTREE_H
+
+#include "fast_types.h"
+#include "fast_mem_allocator.h"
+
+/*
+ * b+tree ordered map of 64 bit signed keys to pointers, for indexes
+ * that are read much more than written. a node is a few cache lines
+ * holding its keys side by side, a lookup reads them in one pass (AVX2
+ * or SSE4.2 when built for them) instead of chasing a pointer per
+ * compare. values live in the leaves, which are chained for scans.
+ *
+ * a delete takes the key out of its leaf and frees the leaf once it is
+ * empty, nodes are not merged: after many deletes, load the tree again.
+ * a NULL value can not be told from a missing key by fast_btree_find.
+ */
+
+#define FAST_BTREE_OK             (0)
+#define FAST_BTREE_ERROR          (-1)
+
+#define FAST_BTREE_FALSE          0
+#define FAST_BTREE_TRUE           1
+
+//cache lines per node when the node size is left to the tree
+#define FAST_BTREE_NODE_LINES     8
+#define FAST_BTREE_NODE_MIN       128
+//percent of a node filled by fast_btree_load, room for a few inserts
+#define FAST_BTREE_LOAD_FILL      90
+#define FAST_BTREE_MAX_HEIGHT     32
+
+typedef int64_t fast_btree_key_t;
+
+typedef struct fast_btree_node_s fast_btree_node_t;
+
+struct fast_btree_node_s {
+    uint16_t                count;
+    uint16_t                leaf;
+    uint32_t                reserved;
+    fast_btree_node_t      *next;       // leaves: the next leaf or NULL
+    fast_btree_key_t        keys[];     // slots keys, then slots + 1 pointers
+};
+
+typedef struct fast_btree_s {
+    fast_btree_node_t      *root;
+    fast_mem_allocator_t   *allocator;  // NULL for memory_alloc
+    size_t                  node_size;
+    size_t                  slots;      // key room, one over the capacity
+    size_t                  cap;        // keys a node keeps
+    size_t                  height;     // 1 for a lone leaf
+    size_t                  count;
+    size_t                  nodes;
+} fast_btree_t;
+
+typedef struct fast_btree_iter_s {
+    fast_btree_t           *tree;
+    fast_btree_node_t      *node;
+    size_t                  pos;
+} fast_btree_iter_t;
+
+//non zero stops the walk
+typedef int (*fast_btree_walk_pt)(fast_btree_key_t key, void *value,
+    void *data);
+
+/*
+ * node_size 0 takes FAST_BTREE_NODE_LINES lines of the size
+ * sys_get_info reports
+ */
+fast_btree_t *fast_btree_create(size_t node_size,
+    fast_mem_allocator_t *allocator);
+void  fast_btree_free_memory(fast_btree_t *tree);
+
+void *fast_btree_find(fast_btree_t *tree, fast_btree_key_t key);
+//a key already there gets the new value
+int   fast_btree_insert(fast_btree_t *tree, fast_btree_key_t key,
+    void *value);
+//returns the value taken out, NULL if the key was not there
+void *fast_btree_delete(fast_btree_t *tree, fast_btree_key_t key);
+
+/*
+ * builds an empty tree from n keys in strictly increasing order, leaves
+ * and inner nodes FAST_BTREE_LOAD_FILL full, bottom up in one pass
+ */
+int   fast_btree_load(fast_btree_t *tree, const fast_btree_key_t *keys,
+    void **values, size_t n);
+
+//the iterator stands on the first key not below key
+void  fast_btree_seek(fast_btree_t *tree, fast_btree_key_t key,
+    fast_btree_iter_t *it);
+void  fast_btree_first(fast_btree_t *tree, fast_btree_iter_t *it);
+//FALSE past the end, key and value may be NULL
+int   fast_btree_iter_next(fast_btree_iter_t *it, fast_btree_key_t *key,
+    void **value);
+//keys from low up to, not including, high; returns the keys walked
+size_t fast_btree_range(fast_btree_t *tree, fast_btree_key_t low,
+    fast_btree_key_t high, fast_btree_walk_pt walk, void *data);
+
+#endif
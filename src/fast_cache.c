@@ -0,0 +1,444 @@
+#include "fast_cache.h"
+#include "fast_shmem.h"
+#include "fast_math.h"
+
+typedef struct fast_cache_copy_s {
+    fast_shmem_hashtable_t  *index;
+    void                    *buf;
+    size_t                   size;     // of buf
+    size_t                   vlen;
+    size_t                   slot;
+    time_t                   expire;
+} fast_cache_copy_t;
+
+static const char *fast_cache_err_string[] = {
+    "fast_cache: unknown error number",
+
+    "fast_cache_create: parameter error",
+    "fast_cache_create: shmem create failed",
+    "fast_cache_create: slabs create failed",
+    "fast_cache_create: index create failed",
+
+    "fast_cache_set: parameter error",
+    "fast_cache_set: key and value larger than item_max",
+    "fast_cache_set: no memory left after eviction",
+
+    NULL
+};
+
+#define fast_cache_expired(item, now) \
+    ((item)->expire && (item)->expire <= (now))
+
+static void fast_cache_copy(fast_shmem_hashtable_link_t *hl, void *arg);
+static void fast_cache_item_free(fast_cache_t *cache, fast_cache_item_t *item);
+static int  fast_cache_evict(fast_cache_t *cache, time_t now);
+static size_t fast_cache_expire_locked(fast_cache_t *cache, size_t n,
+    time_t now);
+
+fast_cache_t *
+fast_cache_create(size_t size, size_t items, size_t item_max,
+    unsigned int *cache_errno)
+{
+    fast_shmem_allocator_param_t  param;
+    fast_mem_allocator_t         *allocator;
+    fast_slab_errno_t             slab_errno;
+    fast_cache_t                 *cache;
+    size_t                        chunk_max, i;
+    unsigned int                  shmem_errno;
+
+    *cache_errno = FAST_CACHE_ERR_NONE;
+    if (!size || !items || !item_max) {
+        *cache_errno = FAST_CACHE_ERR_CREATE_PARAM;
+        return NULL;
+    }
+    chunk_max = sizeof(fast_cache_item_t) + item_max;
+    if (chunk_max < 2 * FAST_CACHE_ITEM_SIZE_MIN) {
+        chunk_max = 2 * FAST_CACHE_ITEM_SIZE_MIN;
+    }
+
+    //room for the index, the ring, the stripes and slab rounding
+    param.size = size + size / 8 + 2 * chunk_max
+        + items * (sizeof(size_t) * 2 + sizeof(fast_cache_slot_t))
+        + FAST_SHMEM_HASHTABLE_STRIPES * DEFAULT_CACHELINE_SIZE * 2
+        + DEFAULT_PAGESIZE;
+    param.min_size = FAST_CACHE_ITEM_SIZE_MIN;
+    param.max_size = chunk_max + sizeof(chunk_link_t);
+    param.factor = FAST_SHMEM_EXP_FACTOR;
+    param.level_type = FAST_SHMEM_LEVEL_TYPE_EXP;
+    param.err_no = 0;
+
+    allocator = fast_mem_allocator_new_init(FAST_MEM_ALLOCATOR_TYPE_SHMEM,
+        &param);
+    if (!allocator) {
+        *cache_errno = FAST_CACHE_ERR_CREATE_SHMEM;
+        return NULL;
+    }
+
+    cache = allocator->calloc(allocator, sizeof(fast_cache_t), &shmem_errno);
+    if (!cache) {
+        *cache_errno = FAST_CACHE_ERR_CREATE_SHMEM;
+        goto failed;
+    }
+    cache->allocator = allocator;
+    cache->slabs = fast_slabs_create(allocator, FAST_SLAB_UPTYPE_POWER,
+        FAST_SLAB_POWER_FACTOR, FAST_CACHE_ITEM_SIZE_MIN, chunk_max,
+        &slab_errno);
+    if (!cache->slabs) {
+        *cache_errno = FAST_CACHE_ERR_CREATE_SLABS;
+        goto failed;
+    }
+    cache->index = fast_shmem_hashtable_create(allocator->private_data,
+        items, 0, &shmem_errno);
+    cache->clock = allocator->calloc(allocator,
+        items * sizeof(fast_cache_slot_t), &shmem_errno);
+    if (!cache->index || !cache->clock) {
+        *cache_errno = FAST_CACHE_ERR_CREATE_INDEX;
+        goto failed;
+    }
+
+    //every slot starts on the free list
+    for (i = 0; i < items; i++) {
+        cache->clock[i].next = i + 1;
+    }
+    cache->free = 0;
+    cache->item_max = item_max;
+    cache->stat.limit = size;
+    cache->stat.slots = items;
+    fast_atomic_lock_init(&cache->lock);
+    cache->lock.allocator = NULL;
+
+    return cache;
+
+failed:
+    fast_mem_allocator_delete(allocator);
+    return NULL;
+}
+
+int
+fast_cache_release(fast_cache_t *cache)
+{
+    if (!cache) {
+        return FAST_CACHE_ERROR;
+    }
+    //items, index and ring all go with the region
+    fast_mem_allocator_delete(cache->allocator);
+
+    return FAST_CACHE_OK;
+}
+
+int
+fast_cache_get(fast_cache_t *cache, const void *key, size_t klen,
+    void *buf, size_t *len)
+{
+    fast_cache_copy_t    copy;
+    fast_cache_item_t   *item;
+    fast_lock_errno_t    lock_errno;
+    time_t               now;
+
+    if (!cache || !key || !klen || !len || (*len && !buf)) {
+        return FAST_CACHE_ERROR;
+    }
+    copy.index = cache->index;
+    copy.buf = buf;
+    copy.size = *len;
+
+    if (fast_shmem_hashtable_read(cache->index, key, klen, fast_cache_copy,
+        &copy) != FAST_HASHTABLE_OK) {
+        __sync_fetch_and_add(&cache->stat.misses, 1);
+        return FAST_CACHE_NOT_FOUND;
+    }
+
+    now = time(NULL);
+    if (copy.expire && copy.expire <= now) {
+        //drop it if no writer is in, the sweep gets it otherwise
+        if (fast_atomic_lock_try_on(&cache->lock, &lock_errno)
+            == FAST_LOCK_ON) {
+            item = (fast_cache_item_t *)fast_shmem_hashtable_lookup(
+                cache->index, key, klen);
+            if (item && fast_cache_expired(item, now)) {
+                fast_cache_item_free(cache, item);
+                cache->stat.expired++;
+            }
+            fast_atomic_lock_off(&cache->lock, &lock_errno);
+        }
+        __sync_fetch_and_add(&cache->stat.misses, 1);
+        return FAST_CACHE_NOT_FOUND;
+    }
+
+    //the slot may have been given to another item since, that one then
+    //gets a pass it did not earn, the ring itself is never freed
+    if (copy.slot < cache->stat.slots && !cache->clock[copy.slot].ref) {
+        cache->clock[copy.slot].ref = 1;
+    }
+    __sync_fetch_and_add(&cache->stat.hits, 1);
+    *len = copy.vlen;
+
+    return FAST_CACHE_OK;
+}
+
+int
+fast_cache_set(fast_cache_t *cache, const void *key, size_t klen,
+    const void *value, size_t vlen, time_t ttl, unsigned int *cache_errno)
+{
+    fast_cache_item_t   *item, *old;
+    fast_slab_errno_t    slab_errno;
+    fast_lock_errno_t    lock_errno;
+    size_t               need, slab_size, slot;
+    time_t               now;
+
+    *cache_errno = FAST_CACHE_ERR_NONE;
+    if (!cache || !key || !klen || (vlen && !value)) {
+        *cache_errno = FAST_CACHE_ERR_SET_PARAM;
+        return FAST_CACHE_ERROR;
+    }
+    if (klen + vlen > cache->item_max) {
+        *cache_errno = FAST_CACHE_ERR_SET_TOO_LARGE;
+        return FAST_CACHE_ERROR;
+    }
+    need = sizeof(fast_cache_item_t) + klen + vlen;
+    now = time(NULL);
+
+    fast_atomic_lock_on(&cache->lock, &lock_errno);
+    fast_cache_expire_locked(cache, FAST_CACHE_EXPIRE_STEP, now);
+
+    item = NULL;
+    while (cache->free == cache->stat.slots
+        || cache->stat.used + need > cache->stat.limit
+        || !(item = fast_slabs_alloc(cache->slabs, FAST_SLAB_ALLOC_TYPE_ACT,
+            need, &slab_size, &slab_errno))) {
+        if (fast_cache_evict(cache, now) != FAST_CACHE_OK) {
+            fast_atomic_lock_off(&cache->lock, &lock_errno);
+            *cache_errno = FAST_CACHE_ERR_SET_NO_MEMORY;
+            return FAST_CACHE_ERROR;
+        }
+    }
+
+    slot = cache->free;
+    cache->free = cache->clock[slot].next;
+
+    memcpy(item->data, key, klen);
+    memcpy(item->data + klen, value, vlen);
+    item->link.key = fast_shmem_hashtable_offset(cache->index, item->data);
+    item->link.len = klen;
+    item->link.next = 0;
+    item->expire = ttl ? now + ttl : 0;
+    item->slot = slot;
+    item->size = slab_size + sizeof(chunk_link_t);
+    item->vlen = vlen;
+
+    //the old item is looked up after eviction, which may have taken it.
+    //the new one is joined first, a get finds one or the other
+    old = (fast_cache_item_t *)fast_shmem_hashtable_lookup(cache->index,
+        key, klen);
+    fast_shmem_hashtable_join(cache->index, &item->link);
+    cache->clock[slot].item = item;
+    cache->clock[slot].ref = 0;
+    cache->stat.used += item->size;
+    cache->stat.items++;
+    cache->stat.sets++;
+    if (old) {
+        fast_cache_item_free(cache, old);
+    }
+
+    fast_atomic_lock_off(&cache->lock, &lock_errno);
+
+    return FAST_CACHE_OK;
+}
+
+int
+fast_cache_delete(fast_cache_t *cache, const void *key, size_t klen)
+{
+    fast_cache_item_t   *item;
+    fast_lock_errno_t    lock_errno;
+
+    if (!cache || !key || !klen) {
+        return FAST_CACHE_ERROR;
+    }
+
+    fast_atomic_lock_on(&cache->lock, &lock_errno);
+    item = (fast_cache_item_t *)fast_shmem_hashtable_lookup(cache->index,
+        key, klen);
+    if (item) {
+        fast_cache_item_free(cache, item);
+        cache->stat.deletes++;
+    }
+    fast_atomic_lock_off(&cache->lock, &lock_errno);
+
+    return item ? FAST_CACHE_OK : FAST_CACHE_NOT_FOUND;
+}
+
+int
+fast_cache_touch(fast_cache_t *cache, const void *key, size_t klen,
+    time_t ttl)
+{
+    fast_cache_item_t   *item;
+    fast_lock_errno_t    lock_errno;
+    time_t               now;
+    int                  rc = FAST_CACHE_NOT_FOUND;
+
+    if (!cache || !key || !klen) {
+        return FAST_CACHE_ERROR;
+    }
+    now = time(NULL);
+
+    fast_atomic_lock_on(&cache->lock, &lock_errno);
+    item = (fast_cache_item_t *)fast_shmem_hashtable_lookup(cache->index,
+        key, klen);
+    if (item && fast_cache_expired(item, now)) {
+        fast_cache_item_free(cache, item);
+        cache->stat.expired++;
+    } else if (item) {
+        item->expire = ttl ? now + ttl : 0;
+        rc = FAST_CACHE_OK;
+    }
+    fast_atomic_lock_off(&cache->lock, &lock_errno);
+
+    return rc;
+}
+
+size_t
+fast_cache_expire(fast_cache_t *cache, size_t n)
+{
+    fast_lock_errno_t    lock_errno;
+    size_t               dropped;
+
+    if (!cache) {
+        return 0;
+    }
+    fast_atomic_lock_on(&cache->lock, &lock_errno);
+    dropped = fast_cache_expire_locked(cache, n, time(NULL));
+    fast_atomic_lock_off(&cache->lock, &lock_errno);
+
+    return dropped;
+}
+
+int
+fast_cache_get_stat(fast_cache_t *cache, fast_cache_stat_t *stat)
+{
+    if (!cache || !stat) {
+        return FAST_CACHE_ERROR;
+    }
+    *stat = cache->stat;
+
+    return FAST_CACHE_OK;
+}
+
+const char *
+fast_cache_strerror(unsigned int cache_errno)
+{
+    if (cache_errno <= FAST_CACHE_ERR_START
+        || cache_errno >= FAST_CACHE_ERR_END) {
+        return fast_cache_err_string[0];
+    }
+    return fast_cache_err_string[cache_errno - FAST_CACHE_ERR_START];
+}
+
+/*
+ * runs inside the sequence check of the index, the item may be changing
+ * under it: every length read is bounded by buf and by the region
+ */
+static void
+fast_cache_copy(fast_shmem_hashtable_link_t *hl, void *arg)
+{
+    fast_cache_copy_t   *copy = arg;
+    fast_cache_item_t   *item = (fast_cache_item_t *)hl;
+    size_t               limit = copy->index->limit;
+    size_t               off, len, n;
+
+    copy->vlen = item->vlen;
+    copy->slot = item->slot;
+    copy->expire = item->expire;
+
+    //the value follows the key, both read once: a writer may have moved
+    //them since find checked the key
+    off = *(volatile size_t *)&hl->key;
+    len = *(volatile size_t *)&hl->len;
+    if (off > limit || len > limit - off) {
+        return;
+    }
+    off += len;
+    n = copy->vlen < copy->size ? copy->vlen : copy->size;
+    if (n > limit - off) {
+        n = limit - off;
+    }
+    memcpy(copy->buf, fast_shmem_hashtable_base(copy->index) + off, n);
+}
+
+static void
+fast_cache_item_free(fast_cache_t *cache, fast_cache_item_t *item)
+{
+    fast_slab_errno_t    slab_errno;
+    fast_cache_slot_t   *slot;
+
+    fast_shmem_hashtable_remove_link(cache->index, &item->link);
+
+    slot = &cache->clock[item->slot];
+    slot->item = NULL;
+    slot->ref = 0;
+    slot->next = cache->free;
+    cache->free = item->slot;
+
+    cache->stat.used -= item->size;
+    cache->stat.items--;
+    //readers still on it fail their sequence check and start over
+    fast_slabs_free(cache->slabs, item, &slab_errno);
+}
+
+/*
+ * the hand clears the marks it passes and takes the first unmarked
+ * item, two turns of the ring find one if there is any
+ */
+static int
+fast_cache_evict(fast_cache_t *cache, time_t now)
+{
+    fast_cache_slot_t   *slot;
+    size_t               n;
+
+    for (n = 0; n < 2 * cache->stat.slots; n++) {
+        slot = &cache->clock[cache->hand];
+        if (++cache->hand == cache->stat.slots) {
+            cache->hand = 0;
+        }
+        if (!slot->item) {
+            continue;
+        }
+        if (fast_cache_expired(slot->item, now)) {
+            fast_cache_item_free(cache, slot->item);
+            cache->stat.expired++;
+            return FAST_CACHE_OK;
+        }
+        if (slot->ref) {
+            slot->ref = 0;
+            continue;
+        }
+        fast_cache_item_free(cache, slot->item);
+        cache->stat.evictions++;
+        return FAST_CACHE_OK;
+    }
+
+    return FAST_CACHE_ERROR;
+}
+
+static size_t
+fast_cache_expire_locked(fast_cache_t *cache, size_t n, time_t now)
+{
+    fast_cache_slot_t   *slot;
+    size_t               dropped = 0;
+
+    if (n > cache->stat.slots) {
+        n = cache->stat.slots;
+    }
+    while (n--) {
+        slot = &cache->clock[cache->sweep];
+        if (++cache->sweep == cache->stat.slots) {
+            cache->sweep = 0;
+        }
+        if (slot->item && fast_cache_expired(slot->item, now)) {
+            fast_cache_item_free(cache, slot->item);
+            cache->stat.expired++;
+            dropped++;
+        }
+    }
+
+    return dropped;
+}
@@ -0,0 +1,116 @@
+#ifndef _FAST_CACHE_H
+#define _FAST_CACHE_H
+
+#include "fast_shmem_hashtable.h"
+#include "fast_slabs.h"
+
+/*
+ * key value cache in one shmem region, shared by the processes forked
+ * after fast_cache_create. items are slab chunks holding the key and the
+ * value, indexed by a fast_shmem_hashtable_t.
+ *
+ * fast_cache_get takes no lock: it copies the value out under the
+ * sequence check of the index and marks the item's slot of the clock
+ * ring as referenced, a hit writes one byte and moves nothing. set,
+ * delete and touch take the cache lock. when the memory or the slots
+ * run out the clock hand evicts the first item not referenced since it
+ * last passed, clearing the marks on its way.
+ *
+ * expired items are dropped when a get or a set meets them and by an
+ * incremental sweep over the ring, FAST_CACHE_EXPIRE_STEP slots on
+ * every set or more from fast_cache_expire called on a timer.
+ */
+
+#define FAST_CACHE_OK               (0)
+#define FAST_CACHE_ERROR            (-1)
+#define FAST_CACHE_NOT_FOUND        (1)
+
+#define FAST_CACHE_ITEM_SIZE_MIN    64
+#define FAST_CACHE_EXPIRE_STEP      8
+
+enum {
+    FAST_CACHE_ERR_NONE = 0,
+    FAST_CACHE_ERR_START = 100,
+
+    FAST_CACHE_ERR_CREATE_PARAM,
+    FAST_CACHE_ERR_CREATE_SHMEM,
+    FAST_CACHE_ERR_CREATE_SLABS,
+    FAST_CACHE_ERR_CREATE_INDEX,
+
+    FAST_CACHE_ERR_SET_PARAM,
+    FAST_CACHE_ERR_SET_TOO_LARGE,
+    FAST_CACHE_ERR_SET_NO_MEMORY,
+
+    FAST_CACHE_ERR_END
+};
+
+typedef struct fast_cache_item_s {
+    fast_shmem_hashtable_link_t  link;     // key points into data
+    time_t                       expire;   // 0 never
+    size_t                       slot;     // index in the clock ring
+    size_t                       size;     // slab bytes, for the budget
+    size_t                       vlen;
+    uchar_t                      data[];   // key then value
+} fast_cache_item_t;
+
+typedef struct fast_cache_slot_s {
+    fast_cache_item_t           *item;     // NULL if free
+    size_t                       next;     // next free slot
+    volatile uchar_t             ref;      // set by hits
+} fast_cache_slot_t;
+
+typedef struct fast_cache_stat_s {
+    size_t                       limit;    // bytes items may take
+    size_t                       used;
+    size_t                       items;
+    size_t                       slots;
+    size_t                       hits;
+    size_t                       misses;
+    size_t                       sets;
+    size_t                       deletes;
+    size_t                       evictions;
+    size_t                       expired;
+} fast_cache_stat_t;
+
+typedef struct fast_cache_s {
+    fast_atomic_lock_t           lock;     // writers
+    fast_mem_allocator_t        *allocator;
+    fast_slab_manager_t         *slabs;
+    fast_shmem_hashtable_t      *index;
+    fast_cache_slot_t           *clock;
+    size_t                       hand;     // next slot to evict from
+    size_t                       sweep;    // next slot to expire from
+    size_t                       free;     // first free slot
+    size_t                       item_max;
+    fast_cache_stat_t            stat;
+} fast_cache_t;
+
+/*
+ * size is the bytes items may take, the region is made larger for the
+ * index and the ring. items is the most the cache holds, item_max the
+ * largest key plus value. the cache lives in its region, the allocator
+ * is the only part in process memory
+ */
+fast_cache_t *fast_cache_create(size_t size, size_t items, size_t item_max,
+    unsigned int *cache_errno);
+int  fast_cache_release(fast_cache_t *cache);
+
+/*
+ * *len is the size of buf on the way in and the length of the value on
+ * the way out, a value longer than buf is cut
+ */
+int  fast_cache_get(fast_cache_t *cache, const void *key, size_t klen,
+    void *buf, size_t *len);
+//ttl in seconds, 0 never expires
+int  fast_cache_set(fast_cache_t *cache, const void *key, size_t klen,
+    const void *value, size_t vlen, time_t ttl, unsigned int *cache_errno);
+int  fast_cache_delete(fast_cache_t *cache, const void *key, size_t klen);
+int  fast_cache_touch(fast_cache_t *cache, const void *key, size_t klen,
+    time_t ttl);
+//sweeps n slots of the ring, returns the items dropped
+size_t fast_cache_expire(fast_cache_t *cache, size_t n);
+int  fast_cache_get_stat(fast_cache_t *cache, fast_cache_stat_t *stat);
+
+const char *fast_cache_strerror(unsigned int cache_errno);
+
+#endif
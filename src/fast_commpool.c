@@ -4,6 +4,12 @@
 #define fast_align_ptr(p, a)       \
         (uchar_t *) (((uintptr_t)(p) + ((uintptr_t)(a) - 1)) & ~((uintptr_t)(a) - 1))
 
+#define MPOOL_MGMT_HEADER   sizeof(size_t)
+#define mpool_block_size(ptr)  (*(size_t *)((uchar_t *)(ptr) - MPOOL_MGMT_HEADER))
+
+static void *mpool_bump(mpool_mgmt_t *pm, size_t size);
+static int mpool_class(size_t *size);
+
 
 mpool_mgmt_t *mpool_mgmt_create(mpool_mgmt_param_t *param)
 {
@@ -14,6 +20,11 @@ mpool_mgmt_t *mpool_mgmt_create(mpool_mgmt_param_t *param)
     pm->start = param->mem_addr;
     pm->free = (void*) pm + sizeof(mpool_mgmt_t);
     pm->mem_size = param->mem_size;
+    pm->flags = param->flags;
+    memset(pm->free_lists, 0, sizeof(pm->free_lists));
+    pm->large = NULL;
+    pm->freed = 0;
+    pm->reused = 0;
 
     return pm;
 }
@@ -23,24 +34,188 @@ void *mpool_alloc(mpool_mgmt_t *pm, size_t size)
 {
     assert(pm);
 
-    void *ptr;
+    void *ptr, **prev;
+    int   idx;
 
-    pm->free = fast_align_ptr(pm->free, FAST_ALIGNMENT);
-    if (pm->free > pm->start + pm->mem_size) {
-        pm->free = pm->start + pm->mem_size;
+    if (!(pm->flags & MPOOL_MGMT_FREE_LISTS)) {
+        return mpool_bump(pm, size);
+    }
+
+    idx = mpool_class(&size);
+    if (idx >= 0) {
+        ptr = pm->free_lists[idx];
+        if (ptr) {
+            pm->free_lists[idx] = *(void **)ptr;
+            pm->freed -= size;
+            pm->reused++;
+            return ptr;
+        }
+
+    } else {
+        for (prev = &pm->large; *prev; prev = (void **)*prev) {
+            ptr = *prev;
+            if (mpool_block_size(ptr) >= size) {
+                *prev = *(void **)ptr;
+                pm->freed -= mpool_block_size(ptr);
+                pm->reused++;
+                return ptr;
+            }
+        }
+    }
+
+    ptr = mpool_bump(pm, size + MPOOL_MGMT_HEADER);
+    if (!ptr) {
         return NULL;
     }
 
-    if (size + pm->free > pm->start + pm->mem_size) {
+    *(size_t *)ptr = size;
+
+    return (uchar_t *)ptr + MPOOL_MGMT_HEADER;
+}
+
+void mpool_free(mpool_mgmt_t *pm, void *ptr)
+{
+    assert(pm);
+
+    size_t size;
+    int    idx;
+
+    if (!ptr || !(pm->flags & MPOOL_MGMT_FREE_LISTS)) {
+        return;
+    }
+
+    size = mpool_block_size(ptr);
+    pm->freed += size;
+
+    idx = mpool_class(&size);
+    if (idx >= 0) {
+        *(void **)ptr = pm->free_lists[idx];
+        pm->free_lists[idx] = ptr;
+        return;
+    }
+
+    *(void **)ptr = pm->large;
+    pm->large = ptr;
+}
+
+size_t mpool_usable_size(mpool_mgmt_t *pm, void *ptr)
+{
+    assert(pm);
+
+    if (!ptr || !(pm->flags & MPOOL_MGMT_FREE_LISTS)) {
+        return 0;
+    }
+
+    return mpool_block_size(ptr);
+}
+
+void *mpool_realloc(mpool_mgmt_t *pm, void *ptr, size_t old_size, size_t size)
+{
+    assert(pm);
+
+    void   *np;
+    size_t  usable;
+
+    if (!ptr) {
+        return mpool_alloc(pm, size);
+    }
+
+    usable = old_size;
+    if (pm->flags & MPOOL_MGMT_FREE_LISTS) {
+        usable = mpool_block_size(ptr);
+        mpool_class(&size);
+    }
+    if (size <= usable) {
+        return ptr;
+    }
+
+    //the last bump allocation grows in place
+    if ((uchar_t *)ptr + usable == pm->free
+        && (uchar_t *)ptr + size <= (uchar_t *)pm->start + pm->mem_size) {
+        pm->free = (uchar_t *)ptr + size;
+        if (pm->flags & MPOOL_MGMT_FREE_LISTS) {
+            mpool_block_size(ptr) = size;
+        }
+        return ptr;
+    }
+
+    np = mpool_alloc(pm, size);
+    if (!np) {
         return NULL;
     }
-    
-    ptr = pm->free;
-    pm->free += size;
+    memcpy(np, ptr, old_size && old_size < usable ? old_size : usable);
+    mpool_free(pm, ptr);
+
+    return np;
+}
+
+void *mpool_memalign(mpool_mgmt_t *pm, size_t alignment, size_t size)
+{
+    assert(pm);
+
+    uchar_t *ptr;
+    size_t   header = 0;
+
+    if (!alignment || (alignment & (alignment - 1))) {
+        return NULL;
+    }
+
+    if (pm->flags & MPOOL_MGMT_FREE_LISTS) {
+        header = MPOOL_MGMT_HEADER;
+        mpool_class(&size);
+    }
+
+    ptr = fast_align_ptr((uchar_t *)pm->free + header, alignment);
+    if (ptr + size > (uchar_t *)pm->start + pm->mem_size) {
+        return NULL;
+    }
+    pm->free = ptr + size;
+
+    if (header) {
+        mpool_block_size(ptr) = size;
+    }
 
     return ptr;
 }
 
+size_t mpool_alloc_batch(mpool_mgmt_t *pm, size_t size, void **ptrs, size_t n)
+{
+    assert(pm);
+
+    uchar_t *ptr;
+    size_t   i, room;
+
+    if (pm->flags & MPOOL_MGMT_FREE_LISTS) {
+        for (i = 0; i < n; i++) {
+            ptrs[i] = mpool_alloc(pm, size);
+            if (!ptrs[i]) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    //one bounds check for the whole batch on the bump path
+    size = (size + FAST_ALIGNMENT - 1) & ~(size_t)(FAST_ALIGNMENT - 1);
+    if (!size) {
+        return 0;
+    }
+    ptr = fast_align_ptr(pm->free, FAST_ALIGNMENT);
+    if (ptr >= (uchar_t *)pm->start + pm->mem_size) {
+        return 0;
+    }
+    room = ((uchar_t *)pm->start + pm->mem_size - ptr) / size;
+    if (n > room) {
+        n = room;
+    }
+    for (i = 0; i < n; i++) {
+        ptrs[i] = ptr + i * size;
+    }
+    pm->free = ptr + n * size;
+
+    return n;
+}
+
 void destroy_mpool_mgmt(mpool_mgmt_t *pm)
 {
     assert(pm);
@@ -49,4 +224,46 @@ void destroy_mpool_mgmt(mpool_mgmt_t *pm)
     return;
 }
 
+//round size up to its class, returns the class or -1 for large blocks
+static int mpool_class(size_t *size)
+{
+    size_t s = *size ? *size : 1;
+    int    shift;
 
+    if (s <= MPOOL_MGMT_SMALL_MAX) {
+        *size = (s + MPOOL_MGMT_SMALL_STEP - 1) & ~(size_t)(MPOOL_MGMT_SMALL_STEP - 1);
+        return *size / MPOOL_MGMT_SMALL_STEP - 1;
+    }
+
+    if (s > MPOOL_MGMT_CLASS_MAX) {
+        *size = (s + FAST_ALIGNMENT - 1) & ~(size_t)(FAST_ALIGNMENT - 1);
+        return -1;
+    }
+
+    for (shift = 9; ((size_t)1 << shift) < s; shift++) {
+        /* void */
+    }
+    *size = (size_t)1 << shift;
+
+    return MPOOL_MGMT_SMALL_MAX / MPOOL_MGMT_SMALL_STEP + shift - 9;
+}
+
+static void *mpool_bump(mpool_mgmt_t *pm, size_t size)
+{
+    void *ptr;
+
+    pm->free = fast_align_ptr(pm->free, FAST_ALIGNMENT);
+    if (pm->free > pm->start + pm->mem_size) {
+        pm->free = pm->start + pm->mem_size;
+        return NULL;
+    }
+
+    if (size + pm->free > pm->start + pm->mem_size) {
+        return NULL;
+    }
+    
+    ptr = pm->free;
+    pm->free += size;
+
+    return ptr;
+}
@@ -8,15 +8,36 @@
 #include "fast_mem_allocator.h"
 
 
+/*
+ * MPOOL_MGMT_FREE_LISTS: every block carries a size header and freed
+ * blocks are kept on per class free lists inside the region for reuse.
+ * classes are 16 byte steps up to 256, then powers of two up to
+ * MPOOL_MGMT_CLASS_MAX, bigger blocks go to a first fit list.
+ */
+#define MPOOL_MGMT_FREE_LISTS       0x01
+
+#define MPOOL_MGMT_SMALL_STEP       16
+#define MPOOL_MGMT_SMALL_MAX        256
+#define MPOOL_MGMT_CLASS_MAX_SHIFT  20
+#define MPOOL_MGMT_CLASS_MAX        (1 << MPOOL_MGMT_CLASS_MAX_SHIFT)
+#define MPOOL_MGMT_CLASSES          (MPOOL_MGMT_SMALL_MAX / MPOOL_MGMT_SMALL_STEP \
+                                     + MPOOL_MGMT_CLASS_MAX_SHIFT - 8)
+
 typedef struct mpool_mgmt_param_s {
     void *mem_addr;
     size_t mem_size;
+    int flags;
 }mpool_mgmt_param_t;
 
 typedef struct mpool_mgmt_s {
     void *start;
     void *free;
     size_t mem_size;
+    int flags;
+    void *free_lists[MPOOL_MGMT_CLASSES];
+    void *large;
+    size_t freed;       //bytes sitting on the free lists
+    size_t reused;      //allocations served from the free lists
 }mpool_mgmt_t;
 
 
@@ -24,6 +45,17 @@ mpool_mgmt_t *mpool_mgmt_create(mpool_mgmt_param_t *param);
 
 void *mpool_alloc(mpool_mgmt_t *pm, size_t size);
 
+void mpool_free(mpool_mgmt_t *pm, void *ptr);
+
+size_t mpool_usable_size(mpool_mgmt_t *pm, void *ptr);
+
+//old_size may be 0 with MPOOL_MGMT_FREE_LISTS, the header knows the size
+void *mpool_realloc(mpool_mgmt_t *pm, void *ptr, size_t old_size, size_t size);
+
+void *mpool_memalign(mpool_mgmt_t *pm, size_t alignment, size_t size);
+
+size_t mpool_alloc_batch(mpool_mgmt_t *pm, size_t size, void **ptrs, size_t n);
+
 void destroy_mpool_mgmt(mpool_mgmt_t *pm);
 
 #endif
@@ -74,16 +74,85 @@ static void * mpool_mgmt_allocator_calloc(fast_mem_allocator_t *this,
 static int mpool_mgmt_allocator_free(fast_mem_allocator_t *this,
         void *ptr, void *param_data) {
 
-        (void)this;
-        (void)ptr;
         (void)param_data;
 
+        mpool_mgmt_t *pool = this->private_data;
+
+        if (!pool) {
+            return FAST_MEM_ALLOCATOR_ERROR;
+        }
+
+        //a no-op unless the pool was created with MPOOL_MGMT_FREE_LISTS
+        mpool_free(pool, ptr);
+
         return FAST_MEM_ALLOCATOR_OK;
 }
 
 
 
 
+static void * mpool_mgmt_allocator_realloc(fast_mem_allocator_t *this,
+        void *ptr, size_t old_size, size_t size, void *param_data)
+{
+    (void)param_data;
+
+    mpool_mgmt_t *pool = this->private_data;
+
+    if (!pool) {
+        return NULL;
+    }
+
+    return mpool_realloc(pool, ptr, old_size, size);
+}
+
+
+static void * mpool_mgmt_allocator_memalign(fast_mem_allocator_t *this,
+        size_t alignment, size_t size, void *param_data)
+{
+    (void)param_data;
+
+    mpool_mgmt_t *pool = this->private_data;
+
+    if (!pool) {
+        return NULL;
+    }
+
+    return mpool_memalign(pool, alignment, size);
+}
+
+
+static size_t mpool_mgmt_allocator_alloc_batch(fast_mem_allocator_t *this,
+        size_t size, void **ptrs, size_t n, void *param_data)
+{
+    (void)param_data;
+
+    mpool_mgmt_t *pool = this->private_data;
+
+    if (!pool) {
+        return 0;
+    }
+
+    return mpool_alloc_batch(pool, size, ptrs, n);
+}
+
+
+static size_t mpool_mgmt_allocator_usable_size(fast_mem_allocator_t *this,
+        void *ptr, void *param_data)
+{
+    (void)param_data;
+
+    mpool_mgmt_t *pool = this->private_data;
+
+    if (!pool) {
+        return 0;
+    }
+
+    return mpool_usable_size(pool, ptr);
+}
+
+
+
+
 static  fast_mem_allocator_t fast_mpool_mgmt = {
     .private_data   = NULL,
     .type           = FAST_MEM_ALLOCATOR_TYPE_COMMPOOL,
@@ -92,6 +161,10 @@ static  fast_mem_allocator_t fast_mpool_mgmt = {
     .alloc          = mpool_mgmt_allocator_alloc,
     .calloc         = mpool_mgmt_allocator_calloc,
     .free           = mpool_mgmt_allocator_free,
+    .realloc        = mpool_mgmt_allocator_realloc,
+    .memalign       = mpool_mgmt_allocator_memalign,
+    .alloc_batch    = mpool_mgmt_allocator_alloc_batch,
+    .usable_size    = mpool_mgmt_allocator_usable_size,
 
 };
 
@@ -3,6 +3,7 @@
 #include "fast_event_timer.h"
 #include "fast_lock.h"
 #include "fast_conn.h"
+#include "fast_mem_governor.h"
 
 conn_pool_t comm_conn_pool;
 fast_atomic_lock_t comm_conn_lock;
@@ -99,6 +100,10 @@ conn_pool_get_connection(conn_pool_t *pool)
     int           num  = 0;
 	uint32_t      n    = 0;
 
+    //no new connections above the hard memory limit
+    if (mem_governor_admit() != FAST_MEM_GOVERNOR_OK) {
+        return NULL;
+    }
     c = pool->free_connections;
     if (!c) {
         if (pool->change_n >= 0) {
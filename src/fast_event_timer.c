@@ -15,20 +15,14 @@ void event_timers_expire(event_timer_t *timer)
 
     event_t       *ev = NULL;
     rbtree_node_t *node = NULL;
-    rbtree_node_t *root = NULL;
-    rbtree_node_t *sentinel = NULL;
 
     for ( ;; ) {
 
-        sentinel = timer->timer_rbtree.sentinel;
-        root = timer->timer_rbtree.root;
-
-        if (root == sentinel) {
+        node = rbtree_first(&timer->timer_rbtree);
+        if (!node) {
             return;
         }
 
-        node = rbtree_min(root, sentinel);
-
         if (node->key <= timer->time_handler()) {
             ev = (event_t *) ((char *) node - offsetof(event_t, timer));
 
@@ -49,17 +43,12 @@ rb_msec_t event_find_timer(event_timer_t *ev_timer)
 {
     rb_msec_int_t  timer = 0;
     rbtree_node_t *node = NULL;
-    rbtree_node_t *root = NULL;
-    rbtree_node_t *sentinel = NULL;
 
-    if (ev_timer->timer_rbtree.root == &ev_timer->timer_sentinel) {
+    node = rbtree_first(&ev_timer->timer_rbtree);
+    if (!node) {
         return EVENT_TIMER_INFINITE;
     }
 
-    root = ev_timer->timer_rbtree.root;
-    sentinel = ev_timer->timer_rbtree.sentinel;
-    node = rbtree_min(root, sentinel);
-
     timer = node->key - ev_timer->time_handler();
 
     return (timer > 0 ? timer : 0);
@@ -1,155 +1,340 @@
-#include "fast_half_life_mempool.h"
-#include "fast_queue.h"
-#include <stdlib.h>
-struct hl_mempool_s{
-    int      max_size;
-    int      min_size;
-    int      element_size;
-    int      free_size;
-    queue_t  free_q;   
-};
-
-typedef struct hl_mem_node_s{
-    queue_t    q;
-    char       ptr[0];
-} hl_mem_node_t;
-static void do_clean(hl_mempool_t* pool);
-static int do_expand(hl_mempool_t* pool);
-static void do_shrink(hl_mempool_t* pool);
-
-hl_mempool_t* hl_mempool_create(int max_reserv_size,
-    int min_reserv_size,int elememt_size)
-{
-    hl_mempool_t  *t=NULL;
-    hl_mem_node_t *node;
-    int            alloc_size;
-    if (max_reserv_size <=0 || max_reserv_size< min_reserv_size 
-    ||elememt_size< 0 ){
-       return NULL; 
-    }
-    t= (hl_mempool_t*)malloc(sizeof(hl_mempool_t));
-    if (!t) {
-        return NULL;
-    }
-    memset(t, 0x00, sizeof(hl_mempool_t));
-    t->max_size = max_reserv_size;
-    t->min_size = min_reserv_size;
-    t->element_size = elememt_size;
-    queue_init(&t->free_q);
-    t->free_size = 0;
-    alloc_size = sizeof(queue_t) + t->element_size;
-    for (;t->free_size< t->max_size;)
-    {
-        node = malloc(alloc_size); 
-        if (!node) {
-            do_clean(t);
-            free(t);
-            return NULL;
-        }
-        memset(node, 0x00, alloc_size);
-        queue_insert_head(&t->free_q,&node->q);
-        t->free_size++;
-        
-    }
-    
-    return t;
-       
-}
-
-void        * hl_mempool_get(hl_mempool_t* pool)
-{
-    int            ret;
-    queue_t       *queue;
-    hl_mem_node_t *node;
-    ret = do_expand(pool);
-    if (ret !=0 && pool->free_size<=0) {
-          return NULL;
-     }
-    
-    queue = queue_head(&pool->free_q);
-    if ( !queue) {
-        return NULL;
-    }
-    queue_remove(queue);
-
-    pool->free_size--;
-    node = queue_data(queue, hl_mem_node_t, q);
-    return node->ptr;
-}
-void          hl_mempool_free(hl_mempool_t* pool,void* ptr)
-{
-    queue_t       *queue;
-    hl_mem_node_t *node;
-
-    node = queue_data(ptr, hl_mem_node_t, ptr);
-    queue = &node->q;
-    queue_insert_tail(&pool->free_q, queue);
-    pool->free_size ++;
-    do_shrink(pool);
-    
-}
-
-int           hl_mempool_get_free_size(hl_mempool_t* pool)
-{
-    return pool->free_size;
-}
-
-void          hl_mempool_destroy(hl_mempool_t* pool)
-{
-    if (!pool) {
-        return;
-    }
-    do_clean(pool);
-    free(pool);
-}
-static void do_clean(hl_mempool_t* pool)
-{
-    queue_t  *que;
-    hl_mem_node_t * node;
-    if (!pool) {
-        return ;
-    }
-    while (!queue_empty(&pool->free_q)) {
-        que = queue_head(&pool->free_q);
-        queue_remove(que);
-        node = queue_data(que, hl_mem_node_t,q);
-        free(node);
-        pool->free_size--;
-    }
-          
-}
-static int do_expand(hl_mempool_t* pool)
-{
-    hl_mem_node_t  *node; 
-    int             alloc_size;
-    
-    if (pool->free_size > pool->min_size) {
-            return 0;
-    }
-    alloc_size = pool->element_size + sizeof(queue_t);
-    for (; pool->free_size < pool->max_size; ) {
-        node = malloc(alloc_size);
-        if (! node) {
-            return -1;
-        }
-        memset(node, 0x00, alloc_size);
-        queue_insert_tail(&pool->free_q,&node->q);
-        pool->free_size++;
-    }  
-    return 0;
-}
-static void do_shrink(hl_mempool_t* pool)
-{
-    hl_mem_node_t  *node; 
-    queue_t        *que;  
-    if (pool->free_size <=pool->max_size) {
-        return ;
-    }
-    while (pool->free_size > pool->max_size) {
-        que = queue_head(&pool->free_q);
-        queue_remove(que);
-        pool->free_size--;
-        node = queue_data(que, hl_mem_node_t, q);
-        free(node);
-    }
-}
+
+#include "fast_half_life_mempool.h"
+#include "fast_queue.h"
+#include <stdlib.h>
+#include <time.h>
+
+//the clock is read once every HL_MEMPOOL_TICK_OPS get/free calls
+#define HL_MEMPOOL_TICK_OPS  64
+
+struct hl_mempool_s{
+    int      max_size;
+    int      min_size;
+    int      element_size;
+    int      free_size;
+    int      used_size;
+    int      peak_size;     //max used_size in the current period
+    int      demand;
+    int      node_size;
+    int      slab_size;     //elements per slab
+    int      slabs;
+    int      half_life;
+    uint32_t ops;
+    int64_t  last_decay;
+    uint64_t slab_allocs;
+    uint64_t slab_frees;
+    uint64_t decays;
+    queue_t  slab_q;        //all slabs
+    queue_t  avail_q;       //slabs with free elements, empty ones at tail
+};
+
+typedef struct hl_mem_slab_s{
+    queue_t    q;
+    queue_t    avail;
+    queue_t    free_q;
+    int        total;
+    int        free;
+} hl_mem_slab_t;
+
+typedef struct hl_mem_node_s{
+    hl_mem_slab_t *slab;
+    queue_t        q;
+    char           ptr[0];
+} hl_mem_node_t;
+
+static void do_clean(hl_mempool_t* pool);
+static int do_expand(hl_mempool_t* pool, int want);
+static void do_shrink(hl_mempool_t* pool);
+static int do_alloc_slab(hl_mempool_t* pool);
+static void do_free_slab(hl_mempool_t* pool, hl_mem_slab_t *slab);
+static int64_t do_now_msec(void);
+static void do_tick(hl_mempool_t* pool);
+
+hl_mempool_t* hl_mempool_create(int max_reserv_size,
+    int min_reserv_size,int elememt_size)
+{
+    hl_mempool_t  *t=NULL;
+    if (max_reserv_size <=0 || max_reserv_size< min_reserv_size 
+    ||elememt_size< 0 ){
+       return NULL; 
+    }
+    t= (hl_mempool_t*)malloc(sizeof(hl_mempool_t));
+    if (!t) {
+        return NULL;
+    }
+    memset(t, 0x00, sizeof(hl_mempool_t));
+    t->max_size = max_reserv_size;
+    t->min_size = min_reserv_size;
+    t->element_size = elememt_size;
+    t->node_size = (sizeof(hl_mem_node_t) + elememt_size
+                    + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    t->slab_size = max_reserv_size / 8;
+    if (t->slab_size < 1) {
+        t->slab_size = 1;
+    }
+    if (t->slab_size > HL_MEMPOOL_SLAB_MAX) {
+        t->slab_size = HL_MEMPOOL_SLAB_MAX;
+    }
+    t->half_life = HL_MEMPOOL_HALF_LIFE_DEFAULT;
+    t->demand = max_reserv_size;
+    t->last_decay = do_now_msec();
+    queue_init(&t->slab_q);
+    queue_init(&t->avail_q);
+    t->free_size = 0;
+    if (do_expand(t, t->max_size) != 0) {
+        do_clean(t);
+        free(t);
+        return NULL;
+    }
+    
+    return t;
+       
+}
+
+void        * hl_mempool_get(hl_mempool_t* pool)
+{
+    int            want;
+    queue_t       *queue;
+    hl_mem_slab_t *slab;
+    hl_mem_node_t *node;
+
+    do_tick(pool);
+
+    if (pool->free_size <= pool->min_size) {
+        //refill towards the expected demand instead of max_size
+        want = pool->demand - pool->used_size;
+        if (want > pool->max_size) {
+            want = pool->max_size;
+        }
+        if (want <= pool->min_size) {
+            want = pool->min_size + 1;
+        }
+        if (do_expand(pool, want) != 0 && pool->free_size <= 0) {
+            return NULL;
+        }
+    }
+
+    if (queue_empty(&pool->avail_q)) {
+        return NULL;
+    }
+    slab = queue_data(queue_head(&pool->avail_q), hl_mem_slab_t, avail);
+
+    queue = queue_head(&slab->free_q);
+    queue_remove(queue);
+    if (--slab->free == 0) {
+        queue_remove(&slab->avail);
+    }
+
+    pool->free_size--;
+    pool->used_size++;
+    if (pool->used_size > pool->peak_size) {
+        pool->peak_size = pool->used_size;
+    }
+    node = queue_data(queue, hl_mem_node_t, q);
+    return node->ptr;
+}
+void          hl_mempool_free(hl_mempool_t* pool,void* ptr)
+{
+    hl_mem_slab_t *slab;
+    hl_mem_node_t *node;
+
+    node = queue_data(ptr, hl_mem_node_t, ptr);
+    slab = node->slab;
+    queue_insert_head(&slab->free_q, &node->q);
+
+    if (slab->free++ == 0) {
+        queue_insert_head(&pool->avail_q, &slab->avail);
+    }
+    if (slab->free == slab->total) {
+        queue_remove(&slab->avail);
+        queue_insert_tail(&pool->avail_q, &slab->avail);
+    }
+
+    pool->free_size ++;
+    pool->used_size --;
+    do_shrink(pool);
+    do_tick(pool);
+    
+}
+
+int           hl_mempool_get_free_size(hl_mempool_t* pool)
+{
+    return pool->free_size;
+}
+
+int           hl_mempool_reserve(hl_mempool_t* pool,int size)
+{
+    if (!pool || size < 0) {
+        return -1;
+    }
+    return do_expand(pool, size);
+}
+
+void          hl_mempool_set_half_life(hl_mempool_t* pool,int msec)
+{
+    if (!pool || msec <= 0) {
+        return;
+    }
+    pool->half_life = msec;
+}
+
+void          hl_mempool_decay(hl_mempool_t* pool)
+{
+    queue_t       *que, *prev;
+    hl_mem_slab_t *slab;
+    int            reserve, release;
+
+    if (!pool) {
+        return;
+    }
+
+    pool->decays++;
+    pool->last_decay = do_now_msec();
+
+    //the weight of an old period halves every period
+    pool->demand = (pool->demand + pool->peak_size + 1) / 2;
+    pool->peak_size = pool->used_size;
+
+    reserve = pool->demand - pool->used_size;
+    if (reserve < pool->min_size) {
+        reserve = pool->min_size;
+    }
+    if (pool->free_size <= reserve) {
+        return;
+    }
+    release = (pool->free_size - reserve + 1) / 2;
+
+    for (que = queue_tail(&pool->avail_q);
+         que != queue_sentinel(&pool->avail_q) && release > 0; que = prev) {
+        prev = queue_prev(que);
+        slab = queue_data(que, hl_mem_slab_t, avail);
+        if (slab->free != slab->total
+            || pool->free_size - slab->total < reserve) {
+            continue;
+        }
+        release -= slab->total;
+        do_free_slab(pool, slab);
+    }
+}
+
+void          hl_mempool_get_stat(hl_mempool_t* pool,hl_mempool_stat_t *stat)
+{
+    if (!pool || !stat) {
+        return;
+    }
+    stat->free_size = pool->free_size;
+    stat->used_size = pool->used_size;
+    stat->demand = pool->demand;
+    stat->slabs = pool->slabs;
+    stat->slab_allocs = pool->slab_allocs;
+    stat->slab_frees = pool->slab_frees;
+    stat->decays = pool->decays;
+}
+
+void          hl_mempool_destroy(hl_mempool_t* pool)
+{
+    if (!pool) {
+        return;
+    }
+    do_clean(pool);
+    free(pool);
+}
+static void do_clean(hl_mempool_t* pool)
+{
+    queue_t  *que;
+    hl_mem_slab_t * slab;
+    if (!pool) {
+        return ;
+    }
+    while (!queue_empty(&pool->slab_q)) {
+        que = queue_head(&pool->slab_q);
+        queue_remove(que);
+        slab = queue_data(que, hl_mem_slab_t, q);
+        pool->free_size -= slab->free;
+        free(slab);
+    }
+    pool->slabs = 0;
+          
+}
+static int do_expand(hl_mempool_t* pool, int want)
+{
+    for (; pool->free_size < want; ) {
+        if (do_alloc_slab(pool) != 0) {
+            return -1;
+        }
+    }  
+    return 0;
+}
+static void do_shrink(hl_mempool_t* pool)
+{
+    queue_t        *que;  
+    hl_mem_slab_t  *slab;
+    while (pool->free_size > pool->max_size 
+           && !queue_empty(&pool->avail_q)) {
+        que = queue_tail(&pool->avail_q);
+        slab = queue_data(que, hl_mem_slab_t, avail);
+        if (slab->free != slab->total 
+            || pool->free_size - slab->total < pool->min_size) {
+            return;
+        }
+        do_free_slab(pool, slab);
+    }
+}
+static int do_alloc_slab(hl_mempool_t* pool)
+{
+    hl_mem_slab_t  *slab;
+    hl_mem_node_t  *node;
+    char           *p;
+    int             i;
+
+    slab = malloc(sizeof(hl_mem_slab_t) 
+                  + (size_t)pool->node_size * pool->slab_size);
+    if (!slab) {
+        return -1;
+    }
+    slab->total = pool->slab_size;
+    slab->free = pool->slab_size;
+    queue_init(&slab->free_q);
+
+    p = (char *)slab + sizeof(hl_mem_slab_t);
+    for (i = 0; i < slab->total; i++, p += pool->node_size) {
+        node = (hl_mem_node_t *)p;
+        node->slab = slab;
+        queue_insert_tail(&slab->free_q, &node->q);
+    }
+
+    queue_insert_tail(&pool->slab_q, &slab->q);
+    queue_insert_tail(&pool->avail_q, &slab->avail);
+    pool->free_size += slab->total;
+    pool->slabs++;
+    pool->slab_allocs++;
+    return 0;
+}
+static void do_free_slab(hl_mempool_t* pool, hl_mem_slab_t *slab)
+{
+    queue_remove(&slab->avail);
+    queue_remove(&slab->q);
+    pool->free_size -= slab->total;
+    pool->slabs--;
+    pool->slab_frees++;
+    free(slab);
+}
+static int64_t do_now_msec(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+static void do_tick(hl_mempool_t* pool)
+{
+    if (++pool->ops % HL_MEMPOOL_TICK_OPS) {
+        return;
+    }
+    if (do_now_msec() - pool->last_decay >= pool->half_life) {
+        hl_mempool_decay(pool);
+    }
+}
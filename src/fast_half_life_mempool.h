@@ -1,20 +1,41 @@
-#ifndef HALFLIF_MEMEPOOL
-#define HALFLIF_MEMEPOOL
-/*
-not thread safe typedef struct hl_mempool_s hl_mempool_t;
-
-*/
-typedef struct hl_mempool_s hl_mempool_t;
-
-hl_mempool_t* hl_mempool_create(int max_reserv_size,int min_reserv_size,int elememt_size);
-
-void        * hl_mempool_get(hl_mempool_t* pool);
-void          hl_mempool_free(hl_mempool_t* pool,void* ptr);
-
-int           hl_mempool_get_free_size(hl_mempool_t* pool);
-
-int           hl_mempool_reserve(hl_mempool_t* pool,int size);
-
-void          hl_mempool_destroy(hl_mempool_t* pool);
-#endif
-
+#ifndef HALFLIF_MEMEPOOL
+#define HALFLIF_MEMEPOOL
+#include <stdint.h>
+/*
+not thread safe typedef struct hl_mempool_s hl_mempool_t;
+
+elements are carved from contiguous slabs. every half life period the pool
+returns half of the free elements above the expected demand (an average of
+the per period peak usage, never less than min_reserv_size) to the system,
+a slab is released once all of its elements are free.
+*/
+typedef struct hl_mempool_s hl_mempool_t;
+
+#define HL_MEMPOOL_HALF_LIFE_DEFAULT   1000  //msec
+#define HL_MEMPOOL_SLAB_MAX            256   //elements per slab
+
+typedef struct hl_mempool_stat_s {
+    int      free_size;
+    int      used_size;
+    int      demand;       //smoothed peak usage per period
+    int      slabs;
+    uint64_t slab_allocs;
+    uint64_t slab_frees;
+    uint64_t decays;
+} hl_mempool_stat_t;
+
+hl_mempool_t* hl_mempool_create(int max_reserv_size,int min_reserv_size,int elememt_size);
+
+void        * hl_mempool_get(hl_mempool_t* pool);
+void          hl_mempool_free(hl_mempool_t* pool,void* ptr);
+
+int           hl_mempool_get_free_size(hl_mempool_t* pool);
+
+int           hl_mempool_reserve(hl_mempool_t* pool,int size);
+
+void          hl_mempool_set_half_life(hl_mempool_t* pool,int msec);
+void          hl_mempool_decay(hl_mempool_t* pool);
+void          hl_mempool_get_stat(hl_mempool_t* pool,hl_mempool_stat_t *stat);
+
+void          hl_mempool_destroy(hl_mempool_t* pool);
+#endif
@@ -14,6 +14,128 @@
 
 #define FAST_HASH4(x) ((x) = ((x) << 5) + (x) + *key++) 
 
+//empty buckets passed over per bucket moved
+#define FAST_HASHTABLE_REHASH_EMPTY  10
+
+#define fast_hashtable_prefetch(p)   __builtin_prefetch(p)
+
+static fast_hashtable_link_t **fast_hashtable_buckets_alloc(
+    fast_hashtable_t *ht, size_t size);
+static void fast_hashtable_buckets_free(fast_hashtable_t *ht,
+    fast_hashtable_link_t **buckets, size_t size);
+static void fast_hashtable_resize(fast_hashtable_t *ht);
+static uint64_t fast_hashtable_hash_key(fast_hashtable_t *ht,
+    const void *key, size_t len);
+static size_t fast_hashtable_pow2(size_t size);
+static void *fast_hashtable_find(fast_hashtable_t *ht,
+    fast_hashtable_link_t *walker, uint64_t hash, const void *key, size_t len);
+static int fast_hashtable_filter_build(fast_hashtable_t *ht,
+    size_t bits_per_key);
+
+#define fast_hashtable_index(ht, h, size) \
+    ((ht)->flags & FAST_HASHTABLE_FLAG_POW2 ? (size_t)(h) & ((size) - 1) \
+                                            : (size_t)((h) % (size)))
+
+static const uint64_t fast_hash64_secret[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline uint64_t
+fast_hash64_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+fast_hash64_r8(const uchar_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t
+fast_hash64_r4(const uchar_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+uint64_t
+fast_hash64(const void *key, size_t len, uint64_t seed)
+{
+    const uint64_t *secret = fast_hash64_secret;
+    const uchar_t  *p = key;
+    uint64_t        a, b, see1, see2;
+    __uint128_t     r;
+    size_t          i;
+
+    seed ^= fast_hash64_mix(seed ^ secret[0], secret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (fast_hash64_r4(p) << 32) | fast_hash64_r4(p + ((len >> 3) << 2));
+            b = (fast_hash64_r4(p + len - 4) << 32)
+                | fast_hash64_r4(p + len - 4 - ((len >> 3) << 2));
+
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8)
+                | p[len - 1];
+            b = 0;
+
+        } else {
+            a = b = 0;
+        }
+
+    } else {
+        i = len;
+        if (i > 48) {
+            //three independent multiply chains keep the pipeline full
+            see1 = seed;
+            see2 = seed;
+            do {
+                seed = fast_hash64_mix(fast_hash64_r8(p) ^ secret[1],
+                    fast_hash64_r8(p + 8) ^ seed);
+                see1 = fast_hash64_mix(fast_hash64_r8(p + 16) ^ secret[2],
+                    fast_hash64_r8(p + 24) ^ see1);
+                see2 = fast_hash64_mix(fast_hash64_r8(p + 32) ^ secret[3],
+                    fast_hash64_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = fast_hash64_mix(fast_hash64_r8(p) ^ secret[1],
+                fast_hash64_r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = fast_hash64_r8(p + i - 16);
+        b = fast_hash64_r8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+
+    return fast_hash64_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+size_t
+fast_hashtable_hash_wy(const void *data, size_t data_size,
+    size_t hashtable_size)
+{
+    return fast_hash64(data, data_size, 0) % hashtable_size;
+}
+
 size_t
 fast_hashtable_hash_hash4(const void *data, size_t data_size, size_t hashtable_size);
 
@@ -23,9 +145,10 @@ fast_hashtable_hash_hash4(const void *data, size_t data_size, size_t hashtable_s
 
     size_t      ret = 0;
     size_t      loop = data_size >> 3;
+    size_t      rest = data_size & (8 - 1);
     const char *key = data;
 
-    if (data_size & (8 - 1)) {
+    while (rest--) {
         FAST_HASH4(ret);
     }
 
@@ -58,10 +181,9 @@ fast_hashtable_hash_key8(const void *data,
         loop++;
     }
     for (i = 0; i < loop; i++) {
-        one = *((uint64_t *)s);
-        if (bnum && i == loop - 1) {
-           one >>= (bnum * 8);
-        }
+        //the last word of a short tail is read byte by byte
+        one = 0;
+        memcpy(&one, s, bnum && i == loop - 1 ? (size_t)bnum : 8);
         n ^= 271 * one; 
         s += 8;
     }
@@ -116,7 +238,7 @@ fast_hashtable_create(FAST_HASHTABLE_CMP *cmp_func, size_t hash_sz,
     }
     
     if (allocator) {
-        allocator->free(allocator, ht, &err_no);
+        fast_mem_allocator_free(allocator, ht, &err_no);
     } else {
         memory_free(ht, sizeof(fast_hashtable_t));
     }
@@ -130,8 +252,6 @@ fast_hashtable_init(fast_hashtable_t *ht, FAST_HASHTABLE_CMP *cmp_func,
     size_t hash_sz, FAST_HASHTABLE_HASH *hash_func,
      fast_mem_allocator_t *allocator)
 {    
-    unsigned int     err_no;
-
     if (!ht) {
         return FAST_HASHTABLE_ERROR;
     }
@@ -139,18 +259,11 @@ fast_hashtable_init(fast_hashtable_t *ht, FAST_HASHTABLE_CMP *cmp_func,
     //set hash size
     ht->size = !hash_sz ? FAST_HASHTABLE_DEFAULT_SIZE :
         fast_math_find_prime(hash_sz);
+    ht->min_size = ht->size;
         
     //calloc buckets, freebkts and lock if need
-    if (allocator) {
-        ht->allocator = allocator;
-        ht->buckets = allocator->calloc(allocator,
-            ht->size * sizeof(fast_hashtable_link_t *), &err_no);
-    } else {
-        ht->buckets = memory_calloc(ht->size *
-            sizeof(fast_hashtable_link_t *));
-        ht->allocator = NULL;
-    }
-
+    ht->allocator = allocator;
+    ht->buckets = fast_hashtable_buckets_alloc(ht, ht->size);
     if (!ht->buckets) {
         return FAST_HASHTABLE_ERROR;
     }
@@ -158,6 +271,12 @@ fast_hashtable_init(fast_hashtable_t *ht, FAST_HASHTABLE_CMP *cmp_func,
     ht->cmp = cmp_func;
     ht->hash = hash_func;
     ht->count = 0;
+    ht->old_buckets = NULL;
+    ht->old_size = 0;
+    ht->rehash_idx = 0;
+    ht->flags = 0;
+    ht->seed = fast_hash64(&ht, sizeof(ht), (uint64_t)time(NULL));
+    ht->filter = NULL;
 
     return FAST_HASHTABLE_OK;
 }
@@ -177,10 +296,22 @@ fast_hashtable_join(fast_hashtable_t *ht, fast_hashtable_link_t *hl)
     if (!ht || !hl) {
         return FAST_HASHTABLE_ERROR;
     }
-    i = ht->hash(hl->key, hl->len, ht->size);
+    if (ht->old_buckets) {
+        fast_hashtable_rehash(ht, FAST_HASHTABLE_REHASH_STEP);
+    }
+    hl->hash = fast_hashtable_hash_key(ht, hl->key, hl->len);
+    i = fast_hashtable_index(ht, hl->hash, ht->size);
     hl->next = ht->buckets[i];
     ht->buckets[i] = hl;
     ht->count++;
+    fast_hashtable_resize(ht);
+    if (ht->filter) {
+        fast_bloom_add(ht->filter, hl->hash);
+        if (ht->filter->added - ht->filter->stale
+            > 2 * ht->filter->capacity) {
+            fast_hashtable_filter_rebuild(ht);
+        }
+    }
     
     return FAST_HASHTABLE_OK;
 }
@@ -194,24 +325,88 @@ void *
 fast_hashtable_lookup(fast_hashtable_t *ht, const void *key, size_t len)
 {
     size_t                i = 0;
-    fast_hashtable_link_t *walker = NULL;
+    uint64_t              hash;
+    void                 *walker;
     
     if (!key || !ht) {
         return NULL;
     }
     // Modify by Dingyj: add len info
-    i = ht->hash(key, len, ht->size);
-    for (walker = ht->buckets[i]; walker; walker = walker->next) {
-        if (!walker->key) {
-            return NULL;
+    hash = fast_hashtable_hash_key(ht, key, len);
+    if (ht->filter && !fast_bloom_test(ht->filter, hash)) {
+        return NULL;
+    }
+    i = fast_hashtable_index(ht, hash, ht->size);
+    walker = fast_hashtable_find(ht, ht->buckets[i], hash, key, len);
+    if (!walker && ht->filter) {
+        fast_bloom_false_positive(ht->filter);
+    }
+
+    return walker;
+}
+
+/*
+ * the keys go through in groups of FAST_HASHTABLE_BATCH, each step runs
+ * over the whole group before the next one needs its loads: all hashes
+ * and filter lines, then a prefetch of every bucket the filter lets
+ * through, then of every first link and the key it points to, then the
+ * compares
+ */
+size_t
+fast_hashtable_lookup_batch(fast_hashtable_t *ht, const void **keys,
+    const size_t *lens, size_t n, void **results)
+{
+    uint64_t               hash[FAST_HASHTABLE_BATCH];
+    fast_hashtable_link_t *first[FAST_HASHTABLE_BATCH];
+    fast_hashtable_link_t **bucket[FAST_HASHTABLE_BATCH];
+    size_t                 i, j, m, found = 0;
+
+    if (!ht || !keys || !lens || !results) {
+        return 0;
+    }
+    for (i = 0; i < n; i += m) {
+        m = n - i < FAST_HASHTABLE_BATCH ? n - i : FAST_HASHTABLE_BATCH;
+
+        for (j = 0; j < m; j++) {
+            hash[j] = keys[i + j] ? fast_hashtable_hash_key(ht, keys[i + j],
+                lens[i + j]) : 0;
+            if (ht->filter) {
+                fast_bloom_prefetch(ht->filter, hash[j]);
+            }
         }
-        if ((ht->cmp) (key, walker->key, len) == 0) {
-            return (walker);
+        for (j = 0; j < m; j++) {
+            bucket[j] = NULL;
+            if (!keys[i + j]
+                || (ht->filter && !fast_bloom_test(ht->filter, hash[j]))) {
+                continue;
+            }
+            bucket[j] = &ht->buckets[fast_hashtable_index(ht, hash[j],
+                ht->size)];
+            fast_hashtable_prefetch(bucket[j]);
+        }
+        for (j = 0; j < m; j++) {
+            first[j] = bucket[j] ? *bucket[j] : NULL;
+            if (first[j]) {
+                fast_hashtable_prefetch(first[j]);
+            }
+        }
+        for (j = 0; j < m; j++) {
+            if (first[j] && first[j]->hash == hash[j]) {
+                fast_hashtable_prefetch(first[j]->key);
+            }
+        }
+        for (j = 0; j < m; j++) {
+            results[i + j] = bucket[j] ? fast_hashtable_find(ht, first[j],
+                hash[j], keys[i + j], lens[i + j]) : NULL;
+            if (results[i + j]) {
+                found++;
+            } else if (bucket[j] && ht->filter) {
+                fast_bloom_false_positive(ht->filter);
+            }
         }
-        assert(walker != walker->next);
     }
-    
-    return NULL;
+
+    return found;
 }
 
 /*
@@ -225,23 +420,132 @@ fast_hashtable_lookup(fast_hashtable_t *ht, const void *key, size_t len)
 int
 fast_hashtable_remove_link(fast_hashtable_t *ht, fast_hashtable_link_t *hl)
 {
-    int                      i;
+    size_t                   i;
     fast_hashtable_link_t   **link;
 
     if (!ht || !hl) {
         return FAST_HASHTABLE_ERROR;
     }
+    if (ht->old_buckets) {
+        fast_hashtable_rehash(ht, FAST_HASHTABLE_REHASH_STEP);
+    }
     
-    i = ht->hash(hl->key, hl->len, ht->size);
+    i = fast_hashtable_index(ht, hl->hash, ht->size);
     for (link = &ht->buckets[i]; *link; link = &(*link)->next) {
         if (*link == hl) {
-            *link = hl->next;
-            ht->count--;
-            return FAST_HASHTABLE_OK;
+            goto found;
+        }
+    }
+    if (!ht->old_buckets) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    i = fast_hashtable_index(ht, hl->hash, ht->old_size);
+    for (link = &ht->old_buckets[i]; *link; link = &(*link)->next) {
+        if (*link == hl) {
+            goto found;
         }
     }
 
     return FAST_HASHTABLE_ERROR;
+
+found:
+    *link = hl->next;
+    ht->count--;
+    fast_hashtable_resize(ht);
+    if (ht->filter) {
+        fast_bloom_stale(ht->filter);
+        if (ht->filter->stale > ht->filter->added / 2) {
+            fast_hashtable_filter_rebuild(ht);
+        }
+    }
+
+    return FAST_HASHTABLE_OK;
+}
+
+int
+fast_hashtable_rehash(fast_hashtable_t *ht, size_t n)
+{
+    size_t                   i, empty;
+    fast_hashtable_link_t   *walker, *next;
+
+    if (!ht || !ht->old_buckets) {
+        return FAST_HASHTABLE_FALSE;
+    }
+    empty = n * FAST_HASHTABLE_REHASH_EMPTY;
+    while (n && ht->rehash_idx < ht->old_size) {
+        walker = ht->old_buckets[ht->rehash_idx];
+        if (!walker) {
+            ht->rehash_idx++;
+            //a long run of empty buckets ends the step as well
+            if (--empty == 0) {
+                break;
+            }
+            continue;
+        }
+        for (; walker; walker = next) {
+            next = walker->next;
+            i = fast_hashtable_index(ht, walker->hash, ht->size);
+            walker->next = ht->buckets[i];
+            ht->buckets[i] = walker;
+        }
+        ht->old_buckets[ht->rehash_idx++] = NULL;
+        n--;
+    }
+    if (ht->rehash_idx < ht->old_size) {
+        return FAST_HASHTABLE_TRUE;
+    }
+
+    fast_hashtable_buckets_free(ht, ht->old_buckets, ht->old_size);
+    ht->old_buckets = NULL;
+    ht->old_size = 0;
+    ht->rehash_idx = 0;
+
+    return FAST_HASHTABLE_FALSE;
+}
+
+int
+fast_hashtable_configure(fast_hashtable_t *ht, uint32_t flags, uint64_t seed)
+{
+    fast_hashtable_link_t  **buckets;
+    size_t                   size;
+
+    if (!ht || ht->count || ht->old_buckets) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    size = flags & FAST_HASHTABLE_FLAG_POW2
+        ? fast_hashtable_pow2(ht->min_size) : ht->min_size;
+    if (size != ht->size) {
+        buckets = fast_hashtable_buckets_alloc(ht, size);
+        if (!buckets) {
+            return FAST_HASHTABLE_ERROR;
+        }
+        fast_hashtable_buckets_free(ht, ht->buckets, ht->size);
+        ht->buckets = buckets;
+        ht->size = size;
+    }
+    ht->min_size = size;
+    ht->flags = flags;
+    ht->seed = seed;
+
+    return FAST_HASHTABLE_OK;
+}
+
+int
+fast_hashtable_filter(fast_hashtable_t *ht, size_t bits_per_key)
+{
+    if (!ht) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    return fast_hashtable_filter_build(ht, bits_per_key);
+}
+
+int
+fast_hashtable_filter_rebuild(fast_hashtable_t *ht)
+{
+    if (!ht || !ht->filter) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    return fast_hashtable_filter_build(ht, ht->filter->bits_per_key);
 }
 
 /*
@@ -267,17 +571,16 @@ fast_hashtable_free_memory(fast_hashtable_t *ht)
         return;
     }
     
+    if (ht->buckets) {
+        fast_hashtable_buckets_free(ht, ht->buckets, ht->size);
+    }
+    if (ht->old_buckets) {
+        fast_hashtable_buckets_free(ht, ht->old_buckets, ht->old_size);
+    }
+    fast_bloom_free(ht->filter);
     if (ht->allocator) {
-        if (ht->buckets) {
-            ht->allocator->free(ht->allocator, ht->buckets, &err_no);
-        }
-       
-        ht->allocator->free(ht->allocator, ht, &err_no);
+        fast_mem_allocator_free(ht->allocator, ht, &err_no);
     } else {
-        if (ht->buckets) {
-            memory_free(ht->buckets,
-                ht->size * sizeof(fast_hashtable_link_t *));
-        }
         memory_free(ht, sizeof(fast_hashtable_t));
     }
 }
@@ -301,6 +604,14 @@ fast_hashtable_free_items(fast_hashtable_t *ht,
             ht->count--;
         }
     }
+    for (i = 0; ht->old_buckets && i < ht->old_size; i++) {
+        for (walker = ht->old_buckets[i]; walker;) {
+            next = walker->next;
+            free_object_func(walker);
+            walker = next;
+            ht->count--;
+        }
+    }
 }
 
 int fast_hashtable_empty(fast_hashtable_t *ht)
@@ -308,3 +619,163 @@ int fast_hashtable_empty(fast_hashtable_t *ht)
     return ht && ht->count ? FAST_HASHTABLE_FALSE : FAST_HASHTABLE_TRUE;
 }
 
+static fast_hashtable_link_t **
+fast_hashtable_buckets_alloc(fast_hashtable_t *ht, size_t size)
+{
+    unsigned int err_no;
+
+    if (ht->allocator) {
+        return ht->allocator->calloc(ht->allocator,
+            size * sizeof(fast_hashtable_link_t *), &err_no);
+    }
+    return memory_calloc(size * sizeof(fast_hashtable_link_t *));
+}
+
+static void
+fast_hashtable_buckets_free(fast_hashtable_t *ht,
+    fast_hashtable_link_t **buckets, size_t size)
+{
+    unsigned int err_no;
+
+    if (ht->allocator) {
+        fast_mem_allocator_free(ht->allocator, buckets, &err_no);
+    } else {
+        memory_free(buckets, size * sizeof(fast_hashtable_link_t *));
+    }
+}
+
+/*
+ * starts a resize when the load leaves [1/8, 1], the links move later
+ * in steps. a failed allocation leaves the table as it is
+ */
+static void
+fast_hashtable_resize(fast_hashtable_t *ht)
+{
+    fast_hashtable_link_t  **buckets;
+    size_t                   count = (size_t)ht->count;
+    size_t                   size;
+
+    if (ht->old_buckets) {
+        return;
+    }
+    if (count > ht->size) {
+        size = ht->flags & FAST_HASHTABLE_FLAG_POW2
+            ? ht->size * 2 : fast_math_find_prime(ht->size * 2);
+
+    } else if (count < ht->size / 8 && ht->size > ht->min_size) {
+        size = count * 2 > ht->min_size ? count * 2 : ht->min_size;
+        size = ht->flags & FAST_HASHTABLE_FLAG_POW2
+            ? fast_hashtable_pow2(size) : fast_math_find_prime(size);
+        if (size >= ht->size) {
+            return;
+        }
+
+    } else {
+        return;
+    }
+
+    buckets = fast_hashtable_buckets_alloc(ht, size);
+    if (!buckets) {
+        return;
+    }
+    ht->old_buckets = ht->buckets;
+    ht->old_size = ht->size;
+    ht->rehash_idx = 0;
+    ht->buckets = buckets;
+    ht->size = size;
+}
+
+static uint64_t
+fast_hashtable_hash_key(fast_hashtable_t *ht, const void *key, size_t len)
+{
+    uint64_t h;
+
+    if (!ht->hash) {
+        return fast_hash64(key, len, ht->seed);
+    }
+    h = ht->hash(key, len, (size_t)-1);
+    if (ht->flags & FAST_HASHTABLE_FLAG_POW2) {
+        //a mask keeps only the low bits, spread the others into them
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+    }
+    return h;
+}
+
+static size_t
+fast_hashtable_pow2(size_t size)
+{
+    size_t n = 1;
+
+    while (n < size) {
+        n <<= 1;
+    }
+    return n;
+}
+
+//walker is the head of the key's bucket in the new table
+static void *
+fast_hashtable_find(fast_hashtable_t *ht, fast_hashtable_link_t *walker,
+    uint64_t hash, const void *key, size_t len)
+{
+    size_t i;
+
+    for ( ; walker; walker = walker->next) {
+        if (!walker->key) {
+            return NULL;
+        }
+        if (walker->hash == hash && (ht->cmp) (key, walker->key, len) == 0) {
+            return (walker);
+        }
+        assert(walker != walker->next);
+    }
+    if (!ht->old_buckets) {
+        return NULL;
+    }
+    //not moved yet
+    i = fast_hashtable_index(ht, hash, ht->old_size);
+    for (walker = ht->old_buckets[i]; walker; walker = walker->next) {
+        if (!walker->key) {
+            return NULL;
+        }
+        if (walker->hash == hash && (ht->cmp) (key, walker->key, len) == 0) {
+            return (walker);
+        }
+    }
+    
+    return NULL;
+}
+
+/*
+ * a new filter is filled before it takes the place of the old one, if
+ * it can not be allocated the old one stays
+ */
+static int
+fast_hashtable_filter_build(fast_hashtable_t *ht, size_t bits_per_key)
+{
+    fast_bloom_t           *filter;
+    fast_hashtable_link_t  *walker;
+    size_t                  i, keys;
+
+    keys = (size_t)ht->count * 2 > ht->min_size
+        ? (size_t)ht->count * 2 : ht->min_size;
+    filter = fast_bloom_create(keys, bits_per_key, ht->allocator);
+    if (!filter) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    for (i = 0; i < ht->size; i++) {
+        for (walker = ht->buckets[i]; walker; walker = walker->next) {
+            fast_bloom_add(filter, walker->hash);
+        }
+    }
+    for (i = 0; ht->old_buckets && i < ht->old_size; i++) {
+        for (walker = ht->old_buckets[i]; walker; walker = walker->next) {
+            fast_bloom_add(filter, walker->hash);
+        }
+    }
+    fast_bloom_free(ht->filter);
+    ht->filter = filter;
+
+    return FAST_HASHTABLE_OK;
+}
@@ -7,10 +7,15 @@
 
 #define  FAST_HASHTABLE_DEFAULT_SIZE       7951
 #define  FAST_HASHTABLE_STORE_DEFAULT_SIZE 16777217
+//buckets migrated by each join or remove while resizing
+#define  FAST_HASHTABLE_REHASH_STEP        1
+//keys whose loads fast_hashtable_lookup_batch overlaps
+#define  FAST_HASHTABLE_BATCH              16
 
 #include "fast_lock.h"
 #include "fast_queue.h"
 #include "fast_mem_allocator.h"
+#include "fast_bloom.h"
 
 typedef void    FAST_HASHTABLE_FREE(void *);
 typedef int     FAST_HASHTABLE_CMP(const void *, const void *, size_t);
@@ -27,11 +32,15 @@ enum {
 #define FAST_HASHTABLE_FALSE     0
 #define FAST_HASHTABLE_TRUE      1
 
+//bucket numbers are powers of 2 and picked by a mask, not a division
+#define FAST_HASHTABLE_FLAG_POW2 0x01
+
 typedef struct fast_hashtable_link_s fast_hashtable_link_t;
 struct fast_hashtable_link_s {
     void                    *key;
     size_t                   len;
     fast_hashtable_link_t    *next;
+    uint64_t                 hash;        // set by join, compared first
 };
 
 typedef struct fast_hashtable_errno_s {
@@ -40,6 +49,19 @@ typedef struct fast_hashtable_errno_s {
     fast_lock_errno_t    lock_errno;
 } fast_hashtable_errno_t;
 
+/*
+ * a link keeps the full hash of its key, computed once by join: chain
+ * walks compare it before calling cmp and resizing never hashes again.
+ * with a NULL hash function keys go through fast_hash64 seeded per
+ * table, a given one is called with (size_t)-1 as the table size and
+ * must return the same value for the same key.
+ *
+ * the bucket number follows the load: above one link per bucket the
+ * table grows to the prime after twice the size, below one per eight it
+ * shrinks, never under the size given to init. links move from
+ * old_buckets to buckets a few buckets per join and remove, lookups look
+ * at both and never move anything, so they are safe under a read lock
+ */
 typedef struct fast_hashtable_s {
     fast_hashtable_link_t   **buckets;
     FAST_HASHTABLE_CMP       *cmp;         // compare function
@@ -48,20 +70,35 @@ typedef struct fast_hashtable_s {
     size_t                   size;        // bucket number
     int                      coll;        // collection algrithm
     int                      count;       // total element that inserted to hashtable
+    fast_hashtable_link_t   **old_buckets; // being migrated, NULL if not resizing
+    size_t                   old_size;
+    size_t                   rehash_idx;  // next bucket of old_buckets to move
+    size_t                   min_size;    // the table never shrinks below
+    uint32_t                 flags;       // FAST_HASHTABLE_FLAG_XXX
+    uint64_t                 seed;        // of fast_hash64 when hash is NULL
+    fast_bloom_t            *filter;      // of the link hashes, NULL if off
 } fast_hashtable_t;
 
 //harmful modified
 //#define hashtable_link_make(str) {(void*)(str), sizeof((str)) - 1, NULL}
-#define fast_hashtable_link_make(str) {(void*)(str), sizeof((str)) - 1, NULL,NULL}
+#define fast_hashtable_link_make(str) {(void*)(str), sizeof((str)) - 1, NULL, 0}
 
 //harmful modified
 //#define hashtable_link_null      {NULL, 0, NULL,NULL}
-#define fast_hashtable_link_null      {NULL, 0, NULL,NULL}
+#define fast_hashtable_link_null      {NULL, 0, NULL, 0}
 
 
 FAST_HASHTABLE_HASH fast_hashtable_hash_hash4;
 FAST_HASHTABLE_HASH fast_hashtable_hash_key8;
 FAST_HASHTABLE_HASH fast_hashtable_hash_low;
+//fast_hash64 with seed 0
+FAST_HASHTABLE_HASH fast_hashtable_hash_wy;
+
+/*
+ * wyhash (final version 4, public domain): 64 bit multiply-mix, long keys
+ * are taken 48 bytes at a time in three independent lanes
+ */
+uint64_t fast_hash64(const void *key, size_t len, uint64_t seed);
 
 fast_hashtable_t *
 fast_hashtable_create(FAST_HASHTABLE_CMP *cmp_func, size_t hash_sz,
@@ -73,10 +110,32 @@ int   fast_hashtable_empty(fast_hashtable_t *ht);
 int   fast_hashtable_join(fast_hashtable_t *, fast_hashtable_link_t *);
 int   fast_hashtable_remove_link(fast_hashtable_t *, fast_hashtable_link_t *);
 void *fast_hashtable_lookup(fast_hashtable_t *, const void *, size_t len);
+/*
+ * results[i] is what fast_hashtable_lookup gives for keys[i], lens[i]; a
+ * NULL key gets NULL. returns the number found
+ */
+size_t fast_hashtable_lookup_batch(fast_hashtable_t *, const void **keys,
+    const size_t *lens, size_t n, void **results);
 void  fast_hashtable_free_memory(fast_hashtable_t *);
 void fast_hashtable_free_items(fast_hashtable_t *ht,
     void (*free_object_func)(void*), void*);
+//the buckets of the new table only, finish a resize before walking them
 fast_hashtable_link_t *fast_hashtable_get_bucket(fast_hashtable_t *, uint32_t);
+//flags and seed can only change while the table is empty
+int   fast_hashtable_configure(fast_hashtable_t *, uint32_t flags,
+    uint64_t seed);
+//move n buckets of a resize, (size_t)-1 finishes it. TRUE if more is left
+int   fast_hashtable_rehash(fast_hashtable_t *, size_t n);
+/*
+ * puts a bloom filter of the link hashes in front of lookups, most
+ * misses then end on one cache line instead of a chain walk. it comes
+ * from the allocator of the table and is built again from the links, at
+ * a join or a remove, once it holds twice the keys it was sized for or
+ * half of its keys were removed. bits_per_key 0 picks
+ * FAST_BLOOM_BITS_PER_KEY
+ */
+int   fast_hashtable_filter(fast_hashtable_t *, size_t bits_per_key);
+int   fast_hashtable_filter_rebuild(fast_hashtable_t *);
 
 
 #endif
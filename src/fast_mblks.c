@@ -1,19 +1,40 @@
 #include <string.h>
 #include "fast_mblks.h"
 
+static __thread int mem_mblks_thread = -1;
+static volatile int mem_mblks_threads;
+
+static void mem_mblks_push(struct mem_mblks *mblks, struct mem_data *first,
+    struct mem_data *last, int64_t count);
+static struct mem_data *mem_mblks_pop(struct mem_mblks *mblks);
+static int mem_mblks_grow(struct mem_mblks *mblks, int64_t total);
+static mem_mblks_cache_t *mem_mblks_cache(struct mem_mblks *mblks);
+static void mem_mblks_cache_fill(struct mem_mblks *mblks,
+    mem_mblks_cache_t *cache);
+static void mem_mblks_cache_drain(struct mem_mblks *mblks,
+    mem_mblks_cache_t *cache, int64_t count);
+
 struct mem_mblks * mem_mblks_new_fn(size_t sizeof_type, int64_t count, mem_mblks_param_t *param)
 {
     struct mem_mblks *mblks;
-    struct mem_data *ptr;
+    struct mem_data *ptr, *first, *last;
 
-    int idx;
-    size_t sizeof_mblks;
+    int64_t idx;
+    size_t sizeof_mblks, sizeof_caches;
 
-    if (!param || !param->mem_alloc) {
+    if (!param || !param->mem_alloc || !param->mem_free || count <= 0) {
         return NULL;
     }
 
-    sizeof_mblks = SIZEOF_PER_MEM_BLOCK(sizeof_type) * count + sizeof(struct mem_mblks);
+    if (param->max_count && param->max_count < count) {
+        return NULL;
+    }
+
+    sizeof_caches = param->cache_size > 0
+                  ? sizeof(mem_mblks_cache_t) * MEM_MBLKS_CACHE_THREADS : 0;
+
+    sizeof_mblks = SIZEOF_PER_MEM_BLOCK(sizeof_type) * count
+                 + sizeof(struct mem_mblks) + sizeof_caches;
 
     mblks =  param->mem_alloc(param->priv, sizeof_mblks);
     if (!mblks) {
@@ -23,16 +44,29 @@ struct mem_mblks * mem_mblks_new_fn(size_t sizeof_type, int64_t count, mem_mblks
     memset(mblks, 0, sizeof_mblks);
 
     LOCK_INIT(&mblks->lock);
-    mblks->cold_count = count;
     mblks->padded_sizeof_type = SIZEOF_PER_MEM_BLOCK(sizeof_type);
     mblks->real_sizeof_type = sizeof_type;
     mblks->param = *param;
-    mblks->free_blks = (struct mem_data*)((void *)mblks + sizeof(struct mem_mblks));
-    
-    for ( ptr = mblks->free_blks, idx = 0; idx < count; idx++) {
+    mblks->grow_count = param->grow_count > 0 ? param->grow_count : count;
+    mblks->max_count = param->max_count > 0 ? param->max_count : 0;
+    mblks->cache_size = param->cache_size > 0 ? param->cache_size : 0;
+
+    if (sizeof_caches) {
+        mblks->caches = (void *)mblks + sizeof(struct mem_mblks);
+    }
+
+    first = (struct mem_data*)((void *)mblks + sizeof(struct mem_mblks)
+                               + sizeof_caches);
+
+    for (ptr = first, idx = 0; idx < count - 1; idx++) {
         ptr->next = (void *)ptr + mblks->padded_sizeof_type;
         ptr = ptr->next;
     }
+    last = ptr;
+
+    mblks->total_count = count;
+    mem_mblks_push(mblks, first, last, count);
+
     return mblks;
 }
 
@@ -40,29 +74,43 @@ struct mem_mblks * mem_mblks_new_fn(size_t sizeof_type, int64_t count, mem_mblks
 void *mem_get(struct mem_mblks *mblks)
 {
     struct mem_data *pdata = NULL;
+    mem_mblks_cache_t *cache;
+    int64_t total;
 
     if (!mblks) {
         return NULL;
     }
 
-    LOCK(&mblks->lock);
-    {
-        if (mblks->cold_count) {
-            pdata = mblks->free_blks;
-            mblks->free_blks= pdata->next;
-
-            pdata->next = (void *)mblks;
-
-            mblks->hot_count++;
-            mblks->cold_count--;
-            
-        } else {
-            UNLOCK(&mblks->lock);
+    cache = mem_mblks_cache(mblks);
+    if (cache) {
+        if (!cache->head) {
+            mem_mblks_cache_fill(mblks, cache);
+        }
+
+        pdata = cache->head;
+        if (!pdata) {
             return NULL;
-            //log
+        }
+
+        cache->head = pdata->next;
+        cache->count--;
+
+    } else {
+        for ( ;; ) {
+            total = mblks->total_count;
+
+            pdata = mem_mblks_pop(mblks);
+            if (pdata) {
+                break;
+            }
+
+            if (mem_mblks_grow(mblks, total) == -1) {
+                return NULL;
+            }
         }
     }
-    UNLOCK(&mblks->lock);
+
+    pdata->next = (void *)mblks;
 
     return (void *)pdata->data;
 }
@@ -87,6 +135,7 @@ void mem_put(void *ptr)
 {
     struct mem_data *pdata;
     struct mem_mblks *mblks;
+    mem_mblks_cache_t *cache;
 
     if (!ptr) {
         return;
@@ -102,21 +151,29 @@ void mem_put(void *ptr)
         return;
     }
 
-    LOCK(&mblks->lock);
-    {
-        mblks->hot_count--;
-        mblks->cold_count++;
+    cache = mem_mblks_cache(mblks);
+    if (cache) {
+        pdata->next = cache->head;
+        cache->head = pdata;
+        cache->count++;
+
+        //keep half of the cache so get/put near the limit does not thrash
+        if (cache->count > mblks->cache_size) {
+            mem_mblks_cache_drain(mblks, cache,
+                                  cache->count - mblks->cache_size / 2);
+        }
 
-        pdata->next = mblks->free_blks;
-        mblks->free_blks = pdata;
+        return;
     }
-    UNLOCK(&mblks->lock);
+
+    mem_mblks_push(mblks, pdata, pdata, 1);
 
     return;
 }
 
 void mem_mblks_destroy(struct mem_mblks *mblks) 
 {
+    mem_mblks_chunk_t *chunk, *next;
 
     assert(mblks);
 
@@ -127,7 +184,171 @@ void mem_mblks_destroy(struct mem_mblks *mblks)
 
     LOCK_DESTROY(&mblks->lock);
 
+    for (chunk = mblks->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        param->mem_free(param->priv, chunk);
+    }
+
     param->mem_free(param->priv, mblks);
     
     return;
 }
+
+static void mem_mblks_push(struct mem_mblks *mblks, struct mem_data *first,
+    struct mem_data *last, int64_t count)
+{
+    uint64_t head;
+
+    do {
+        head = mblks->free_blks;
+        last->next = mem_tag_ptr(head);
+
+    } while (!__sync_bool_compare_and_swap(&mblks->free_blks, head,
+                                           mem_tag_make(first, head)));
+
+    __sync_fetch_and_add(&mblks->cold_count, count);
+}
+
+static struct mem_data *mem_mblks_pop(struct mem_mblks *mblks)
+{
+    uint64_t head;
+    struct mem_data *pdata;
+
+    do {
+        head = mblks->free_blks;
+
+        pdata = mem_tag_ptr(head);
+        if (!pdata) {
+            return NULL;
+        }
+
+        //blocks are never unmapped before destroy, so a stale next is
+        //harmless: the tag has moved on and the CAS fails
+    } while (!__sync_bool_compare_and_swap(&mblks->free_blks, head,
+                                           mem_tag_make(pdata->next, head)));
+
+    __sync_fetch_and_sub(&mblks->cold_count, 1);
+
+    return pdata;
+}
+
+//add grow_count blocks unless another thread grew or freed since total
+//was sampled, returns -1 when the pool is at max_count or out of memory
+static int mem_mblks_grow(struct mem_mblks *mblks, int64_t total)
+{
+    mem_mblks_chunk_t *chunk;
+    struct mem_data *ptr, *first;
+    int64_t count, idx;
+
+    LOCK(&mblks->lock);
+
+    if (mblks->total_count != total || mem_tag_ptr(mblks->free_blks)) {
+        UNLOCK(&mblks->lock);
+        return 0;
+    }
+
+    count = mblks->grow_count;
+    if (mblks->max_count && total + count > mblks->max_count) {
+        count = mblks->max_count - total;
+    }
+
+    if (count <= 0) {
+        UNLOCK(&mblks->lock);
+        return -1;
+    }
+
+    chunk = mblks->param.mem_alloc(mblks->param.priv, sizeof(mem_mblks_chunk_t)
+                                   + mblks->padded_sizeof_type * count);
+    if (!chunk) {
+        UNLOCK(&mblks->lock);
+        return -1;
+    }
+
+    chunk->count = count;
+    chunk->next = mblks->chunks;
+    mblks->chunks = chunk;
+
+    first = (struct mem_data *)((void *)chunk + sizeof(mem_mblks_chunk_t));
+    for (ptr = first, idx = 0; idx < count - 1; idx++) {
+        ptr->next = (void *)ptr + mblks->padded_sizeof_type;
+        ptr = ptr->next;
+    }
+
+    __sync_fetch_and_add(&mblks->total_count, count);
+    mem_mblks_push(mblks, first, ptr, count);
+
+    UNLOCK(&mblks->lock);
+
+    return 0;
+}
+
+//per thread slot of mblks, NULL when caching is off or the thread has no slot
+static mem_mblks_cache_t *mem_mblks_cache(struct mem_mblks *mblks)
+{
+    if (!mblks->caches) {
+        return NULL;
+    }
+
+    if (mem_mblks_thread == -1) {
+        mem_mblks_thread = __sync_fetch_and_add(&mem_mblks_threads, 1);
+    }
+
+    if (mem_mblks_thread >= MEM_MBLKS_CACHE_THREADS) {
+        return NULL;
+    }
+
+    return &mblks->caches[mem_mblks_thread];
+}
+
+static void mem_mblks_cache_fill(struct mem_mblks *mblks,
+    mem_mblks_cache_t *cache)
+{
+    struct mem_data *pdata;
+    int64_t want, total;
+
+    want = mblks->cache_size / 2;
+    if (want < 1) {
+        want = 1;
+    }
+
+    while (cache->count < want) {
+        total = mblks->total_count;
+
+        pdata = mem_mblks_pop(mblks);
+        if (!pdata) {
+            if (cache->count || mem_mblks_grow(mblks, total) == -1) {
+                return;
+            }
+            continue;
+        }
+
+        pdata->next = cache->head;
+        cache->head = pdata;
+        cache->count++;
+    }
+}
+
+static void mem_mblks_cache_drain(struct mem_mblks *mblks,
+    mem_mblks_cache_t *cache, int64_t count)
+{
+    struct mem_data *first, *last;
+    int64_t idx;
+
+    if (count <= 0 || !cache->head) {
+        return;
+    }
+
+    if (count > cache->count) {
+        count = cache->count;
+    }
+
+    first = last = cache->head;
+    for (idx = 1; idx < count; idx++) {
+        last = last->next;
+    }
+
+    cache->head = last->next;
+    cache->count -= count;
+
+    mem_mblks_push(mblks, first, last, count);
+}
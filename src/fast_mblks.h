@@ -6,6 +6,22 @@
 #define MEM_BLOCK_HEAD  sizeof(struct mem_data)
 #define SIZEOF_PER_MEM_BLOCK(X) ((X) + MEM_BLOCK_HEAD)
 
+//threads beyond this number use the shared free list directly
+#define MEM_MBLKS_CACHE_THREADS  64
+
+/*
+ * the free list head is a pointer tagged with a counter in its upper
+ * bits, so a pop that raced with pop/push of the same block fails its CAS
+ */
+#define MEM_MBLKS_TAG_SHIFT      48
+#define MEM_MBLKS_PTR_MASK       ((1ULL << MEM_MBLKS_TAG_SHIFT) - 1)
+
+#define mem_tag_ptr(v) \
+    ((struct mem_data *)(uintptr_t)((v) & MEM_MBLKS_PTR_MASK))
+#define mem_tag_make(p, v) \
+    (((((v) >> MEM_MBLKS_TAG_SHIFT) + 1) << MEM_MBLKS_TAG_SHIFT) \
+     | ((uintptr_t)(p) & MEM_MBLKS_PTR_MASK))
+
 #define LOCK_INIT(x) do  { \
     fast_atomic_lock_init(x); \
 }while(0)
@@ -29,7 +45,7 @@
 #define LOCK_DESTROY(x) {}
 
 struct mem_data {
-    void *next;
+    void *next;   //free: next free block, in use: the owner mem_mblks
     char data[0];
 };
 
@@ -37,18 +53,38 @@ typedef struct mem_mblks_param_s {
     void *(*mem_alloc) (void *priv, size_t size);
     void (*mem_free) (void *priv,void *mem_addr);
     void *priv;
+    int64_t grow_count;  //blocks added when the pool runs out, 0: count
+    int64_t max_count;   //upper limit of blocks, 0: unlimited
+    int     cache_size;  //per thread hot cache, 0: off, process private only
 }mem_mblks_param_t;
 
+typedef struct mem_mblks_chunk_s mem_mblks_chunk_t;
+struct mem_mblks_chunk_s {
+    mem_mblks_chunk_t  *next;
+    int64_t             count;
+};
+
+typedef struct mem_mblks_cache_s {
+    struct mem_data    *head;
+    int64_t             count;
+    char                pad[DEFAULT_CACHELINE_SIZE - sizeof(void *)
+                            - sizeof(int64_t)];
+} mem_mblks_cache_t;
+
 struct mem_mblks {
-    int     hot_count;
-    int     cold_count;
+    volatile uint64_t   free_blks;   //tagged head of the shared free list
+    char                pad[DEFAULT_CACHELINE_SIZE - sizeof(uint64_t)];
+    volatile int64_t    cold_count;  //blocks on the shared free list
+    volatile int64_t    total_count; //blocks owned by the pool
+    int64_t             grow_count;
+    int64_t             max_count;
+    int                 cache_size;
     size_t  padded_sizeof_type;
     size_t  real_sizeof_type;
-    void    *start_mblks;
-    void    *end_mblks;
     mem_mblks_param_t   param;
-    fast_atomic_lock_t  lock;
-    struct mem_data     *free_blks;
+    fast_atomic_lock_t  lock;        //serializes growth only
+    mem_mblks_chunk_t  *chunks;      //blocks added after creation
+    mem_mblks_cache_t  *caches;      //MEM_MBLKS_CACHE_THREADS slots or NULL
 };
 
 
@@ -1,6 +1,7 @@
 #include "fast_mem_allocator.h"
 #include "fast_shmem_allocator.h"
 #include "fast_mempool_allocator.h"
+#include "fast_memory.h"
 
 fast_mem_allocator_t *fast_mem_allocator_new(int allocator_type)
 {
@@ -18,7 +19,10 @@ fast_mem_allocator_t *fast_mem_allocator_new(int allocator_type)
             break;
        case FAST_MEM_ALLOCATOR_TYPE_COMMPOOL:
             *allocator = *fast_get_commpool_allocator();
- 
+            break;
+        case FAST_MEM_ALLOCATOR_TYPE_TCACHE:
+            *allocator = *fast_get_tcache_allocator();
+            break;
         default:
             return NULL;
     }
@@ -46,6 +50,9 @@ fast_mem_allocator_t *fast_mem_allocator_new_init(int allocator_type,
         case FAST_MEM_ALLOCATOR_TYPE_COMMPOOL:
             *allocator = *fast_get_commpool_allocator();
             break;
+        case FAST_MEM_ALLOCATOR_TYPE_TCACHE:
+            *allocator = *fast_get_tcache_allocator();
+            break;
         default:
             return NULL;
     }
@@ -74,6 +81,7 @@ void fast_mem_allocator_delete(fast_mem_allocator_t *allocator)
                 allocator->release(allocator, &mempool);
                 break;
             case FAST_MEM_ALLOCATOR_TYPE_COMMPOOL:
+            case FAST_MEM_ALLOCATOR_TYPE_TCACHE:
                 allocator->release(allocator, NULL);
                 break;
         }
@@ -81,3 +89,149 @@ void fast_mem_allocator_delete(fast_mem_allocator_t *allocator)
 
     free(allocator);
 }
+
+void *fast_mem_allocator_realloc(fast_mem_allocator_t *allocator, void *ptr,
+    size_t old_size, size_t size, void *param_data)
+{
+    void   *np;
+    size_t  usable;
+
+    if (!allocator || !size) {
+        return NULL;
+    }
+    if (allocator->realloc) {
+        return allocator->realloc(allocator, ptr, old_size, size, param_data);
+    }
+    if (!ptr) {
+        return allocator->alloc(allocator, size, param_data);
+    }
+
+    usable = fast_mem_allocator_usable_size(allocator, ptr, param_data);
+    if (!old_size || (usable && usable < old_size)) {
+        old_size = usable;
+    }
+    if (!old_size) {
+        return NULL;
+    }
+    if (size <= old_size || size <= usable) {
+        return ptr;
+    }
+
+    np = allocator->alloc(allocator, size, param_data);
+    if (!np) {
+        return NULL;
+    }
+    memory_memcpy(np, ptr, old_size);
+    fast_mem_allocator_free(allocator, ptr, param_data);
+    return np;
+}
+
+void *fast_mem_allocator_memalign(fast_mem_allocator_t *allocator,
+    size_t alignment, size_t size, void *param_data)
+{
+    uchar_t *p, *a;
+
+    if (!allocator || !alignment || (alignment & (alignment - 1))) {
+        return NULL;
+    }
+    if (allocator->memalign) {
+        return allocator->memalign(allocator, alignment, size, param_data);
+    }
+
+    //an allocator without free never needs the original address back
+    if (!allocator->free) {
+        p = allocator->alloc(allocator, size + alignment - 1, param_data);
+        return p ? fast_align_ptr(p, alignment) : NULL;
+    }
+
+    //room to align and to keep the address free wants just below
+    if (alignment < sizeof(void *)) {
+        alignment = sizeof(void *);
+    }
+    p = allocator->alloc(allocator, size + alignment + sizeof(void *),
+        param_data);
+    if (!p) {
+        return NULL;
+    }
+    a = fast_align_ptr(p + sizeof(void *), alignment);
+    ((void **)a)[-1] = p;
+    return a;
+}
+
+int fast_mem_allocator_free(fast_mem_allocator_t *allocator, void *ptr,
+    void *param_data)
+{
+    if (!allocator || !ptr) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    //a pool allocator has no free, the block goes with the pool
+    if (!allocator->free) {
+        return FAST_MEM_ALLOCATOR_OK;
+    }
+    return allocator->free(allocator, ptr, param_data);
+}
+
+int fast_mem_allocator_memalign_free(fast_mem_allocator_t *allocator,
+    void *ptr, void *param_data)
+{
+    if (!allocator || !ptr) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    if (allocator->free && !allocator->memalign) {
+        ptr = ((void **)ptr)[-1];
+    }
+    return fast_mem_allocator_free(allocator, ptr, param_data);
+}
+
+size_t fast_mem_allocator_alloc_batch(fast_mem_allocator_t *allocator,
+    size_t size, void **ptrs, size_t n, void *param_data)
+{
+    size_t i;
+
+    if (!allocator || !ptrs) {
+        return 0;
+    }
+    if (allocator->alloc_batch) {
+        return allocator->alloc_batch(allocator, size, ptrs, n, param_data);
+    }
+    for (i = 0; i < n; i++) {
+        ptrs[i] = allocator->alloc(allocator, size, param_data);
+        if (!ptrs[i]) {
+            break;
+        }
+    }
+    return i;
+}
+
+int fast_mem_allocator_free_batch(fast_mem_allocator_t *allocator,
+    void **ptrs, size_t n, void *param_data)
+{
+    size_t i;
+    int    rc = FAST_MEM_ALLOCATOR_OK;
+
+    if (!allocator || !ptrs) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    if (allocator->free_batch) {
+        return allocator->free_batch(allocator, ptrs, n, param_data);
+    }
+    if (!allocator->free) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    for (i = 0; i < n; i++) {
+        if (ptrs[i] && allocator->free(allocator, ptrs[i], param_data)
+            == FAST_MEM_ALLOCATOR_ERROR) {
+            rc = FAST_MEM_ALLOCATOR_ERROR;
+        }
+    }
+    return rc;
+}
+
+size_t fast_mem_allocator_usable_size(fast_mem_allocator_t *allocator,
+    void *ptr, void *param_data)
+{
+    if (!allocator || !ptr || !allocator->usable_size) {
+        return 0;
+    }
+    return allocator->usable_size(allocator, ptr, param_data);
+}
@@ -26,6 +26,23 @@ typedef const char* (*fast_strerror_ptr_t) (fast_mem_allocator_t *this,
 
 typedef int (*fast_stat_ptr_t) (fast_mem_allocator_t *this, void *stat_data);
 
+//optional entries, NULL ones are served by the fast_mem_allocator_xxx
+//wrappers with a generic fallback built on alloc and free
+//realloc: old_size may be 0 if the allocator knows the block size
+typedef void* (*fast_realloc_ptr_t)  (fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data);
+//memalign: alignment must be a power of 2
+typedef void* (*fast_memalign_ptr_t) (fast_mem_allocator_t *this,
+    size_t alignment, size_t size, void *param_data);
+//alloc_batch: returns the number of objects stored in ptrs
+typedef size_t (*fast_alloc_batch_ptr_t) (fast_mem_allocator_t *this,
+    size_t size, void **ptrs, size_t n, void *param_data);
+typedef int  (*fast_free_batch_ptr_t) (fast_mem_allocator_t *this,
+    void **ptrs, size_t n, void *param_data);
+//usable_size: 0 if unknown
+typedef size_t (*fast_usable_size_ptr_t) (fast_mem_allocator_t *this,
+    void *ptr, void *param_data);
+
 struct fast_mem_allocator_s {
     void                 *private_data;
     int                   type;
@@ -37,6 +54,11 @@ struct fast_mem_allocator_s {
     fast_free_ptr_t        free;
     fast_strerror_ptr_t    strerror;
     fast_stat_ptr_t        stat;
+    fast_realloc_ptr_t     realloc;
+    fast_memalign_ptr_t    memalign;
+    fast_alloc_batch_ptr_t alloc_batch;
+    fast_free_batch_ptr_t  free_batch;
+    fast_usable_size_ptr_t usable_size;
     log_t                  *log;
 };
 
@@ -44,6 +66,7 @@ enum {
     FAST_MEM_ALLOCATOR_TYPE_SHMEM = 1,
     FAST_MEM_ALLOCATOR_TYPE_MEMPOOL,
     FAST_MEM_ALLOCATOR_TYPE_COMMPOOL,
+    FAST_MEM_ALLOCATOR_TYPE_TCACHE,
 };
 
 #define FAST_MEM_ALLOCATOR_OK    (0)
@@ -53,11 +76,30 @@ enum {
 extern const fast_mem_allocator_t *fast_get_mempool_allocator(void);
 extern const fast_mem_allocator_t *fast_get_shmem_allocator(void);
 extern const fast_mem_allocator_t *fast_get_commpool_allocator(void);
+extern const fast_mem_allocator_t *fast_get_tcache_allocator(void);
 
 fast_mem_allocator_t *fast_mem_allocator_new(int allocator_type);
 fast_mem_allocator_t *
 fast_mem_allocator_new_init(int allocator_type, void *init_param);
 
 void fast_mem_allocator_delete(fast_mem_allocator_t *allocator);
+
+//no-op for an allocator without free, whose blocks go with it
+int fast_mem_allocator_free(fast_mem_allocator_t *allocator, void *ptr,
+    void *param_data);
+void *fast_mem_allocator_realloc(fast_mem_allocator_t *allocator, void *ptr,
+    size_t old_size, size_t size, void *param_data);
+void *fast_mem_allocator_memalign(fast_mem_allocator_t *allocator,
+    size_t alignment, size_t size, void *param_data);
+//memory from fast_mem_allocator_memalign goes back through here: without
+//a memalign entry the block starts before the address handed out
+int fast_mem_allocator_memalign_free(fast_mem_allocator_t *allocator,
+    void *ptr, void *param_data);
+size_t fast_mem_allocator_alloc_batch(fast_mem_allocator_t *allocator,
+    size_t size, void **ptrs, size_t n, void *param_data);
+int fast_mem_allocator_free_batch(fast_mem_allocator_t *allocator,
+    void **ptrs, size_t n, void *param_data);
+size_t fast_mem_allocator_usable_size(fast_mem_allocator_t *allocator,
+    void *ptr, void *param_data);
 #endif
 
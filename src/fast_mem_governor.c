@@ -0,0 +1,294 @@
+#include "fast_mem_governor.h"
+#include "fast_memory_pool.h"
+#include "fast_tcache.h"
+#include "fast_lock.h"
+#include <time.h>
+
+typedef struct mem_governor_handler_s {
+    mem_governor_reclaim_pt  handler;
+    void                    *data;
+} mem_governor_handler_t;
+
+volatile int                  mem_governor_state = FAST_MEM_GOVERNOR_NORMAL;
+volatile int                  mem_governor_on;
+volatile uint32_t             mem_governor_epoch;
+__thread int64_t              mem_governor_local;
+
+static volatile int64_t       mem_governor_used;
+static volatile size_t        mem_governor_peak;
+static volatile size_t        mem_governor_soft;
+static volatile size_t        mem_governor_hard;
+static mem_governor_stat_t    mem_governor_counters;
+static fast_atomic_lock_t     mem_governor_lock;
+static mem_governor_handler_t mem_governor_handlers[FAST_MEM_GOVERNOR_HANDLERS];
+static size_t                 mem_governor_nhandlers;
+static int64_t                mem_governor_last_reclaim;
+static int                    mem_governor_inited;
+static pthread_once_t         mem_governor_once = PTHREAD_ONCE_INIT;
+static pthread_key_t          mem_governor_key;
+static __thread int           mem_governor_registered;
+
+static void mem_governor_key_create(void);
+static void mem_governor_thread_exit(void *data);
+static void mem_governor_update(int64_t used);
+static int64_t mem_governor_now_msec(void);
+static size_t mem_governor_reclaim_pools(void *data, size_t excess,
+    mem_governor_state_t state);
+static size_t mem_governor_reclaim_tcache(void *data, size_t excess,
+    mem_governor_state_t state);
+
+int
+mem_governor_init(size_t soft_limit, size_t hard_limit)
+{
+    if (mem_governor_inited) {
+        return mem_governor_set_limits(soft_limit, hard_limit);
+    }
+    if (fast_atomic_lock_init(&mem_governor_lock) != FAST_LOCK_OK) {
+        return FAST_MEM_GOVERNOR_ERROR;
+    }
+    mem_governor_inited = 1;
+    if (mem_governor_set_limits(soft_limit, hard_limit)
+        != FAST_MEM_GOVERNOR_OK) {
+        mem_governor_inited = 0;
+        return FAST_MEM_GOVERNOR_ERROR;
+    }
+    mem_governor_register(mem_governor_reclaim_pools, NULL);
+    mem_governor_register(mem_governor_reclaim_tcache, NULL);
+
+    return FAST_MEM_GOVERNOR_OK;
+}
+
+int
+mem_governor_set_limits(size_t soft_limit, size_t hard_limit)
+{
+    if (hard_limit && soft_limit > hard_limit) {
+        return FAST_MEM_GOVERNOR_ERROR;
+    }
+    mem_governor_soft = soft_limit;
+    mem_governor_hard = hard_limit;
+    mem_governor_on = soft_limit || hard_limit;
+    mem_governor_update(mem_governor_used);
+
+    return FAST_MEM_GOVERNOR_OK;
+}
+
+int
+mem_governor_register(mem_governor_reclaim_pt handler, void *data)
+{
+    fast_lock_errno_t error;
+    int               rc = FAST_MEM_GOVERNOR_ERROR;
+
+    if (!handler || !mem_governor_inited) {
+        return FAST_MEM_GOVERNOR_ERROR;
+    }
+    fast_atomic_lock_on(&mem_governor_lock, &error);
+    if (mem_governor_nhandlers < FAST_MEM_GOVERNOR_HANDLERS) {
+        mem_governor_handlers[mem_governor_nhandlers].handler = handler;
+        mem_governor_handlers[mem_governor_nhandlers].data = data;
+        mem_governor_nhandlers++;
+        rc = FAST_MEM_GOVERNOR_OK;
+    }
+    fast_atomic_lock_off(&mem_governor_lock, &error);
+
+    return rc;
+}
+
+int
+mem_governor_unregister(mem_governor_reclaim_pt handler, void *data)
+{
+    fast_lock_errno_t error;
+    size_t            i;
+    int               rc = FAST_MEM_GOVERNOR_ERROR;
+
+    if (!mem_governor_inited) {
+        return FAST_MEM_GOVERNOR_ERROR;
+    }
+    fast_atomic_lock_on(&mem_governor_lock, &error);
+    for (i = 0; i < mem_governor_nhandlers; i++) {
+        if (mem_governor_handlers[i].handler == handler
+            && mem_governor_handlers[i].data == data) {
+            //keep the order, handlers run as they were registered
+            memmove(&mem_governor_handlers[i], &mem_governor_handlers[i + 1],
+                (mem_governor_nhandlers - i - 1)
+                * sizeof(mem_governor_handler_t));
+            mem_governor_nhandlers--;
+            rc = FAST_MEM_GOVERNOR_OK;
+            break;
+        }
+    }
+    fast_atomic_lock_off(&mem_governor_lock, &error);
+
+    return rc;
+}
+
+int
+mem_governor_admit(void)
+{
+    if (mem_governor_state != FAST_MEM_GOVERNOR_HARD) {
+        return FAST_MEM_GOVERNOR_OK;
+    }
+    __sync_fetch_and_add(&mem_governor_counters.refused, 1);
+
+    return FAST_MEM_GOVERNOR_ERROR;
+}
+
+mem_governor_state_t
+mem_governor_check(void)
+{
+    fast_lock_errno_t     error;
+    mem_governor_state_t  state;
+    int64_t               now, used;
+    size_t                i, excess, bytes = 0;
+
+    mem_governor_flush();
+    state = (mem_governor_state_t)mem_governor_state;
+    if (state == FAST_MEM_GOVERNOR_NORMAL || !mem_governor_inited) {
+        return state;
+    }
+    now = mem_governor_now_msec();
+    if (now - mem_governor_last_reclaim < FAST_MEM_GOVERNOR_INTERVAL_MSEC
+        || fast_atomic_lock_try_on(&mem_governor_lock, &error)
+        != FAST_LOCK_ON) {
+        return state;
+    }
+    mem_governor_last_reclaim = now;
+    mem_governor_counters.reclaims++;
+    for (i = 0; i < mem_governor_nhandlers; i++) {
+        used = mem_governor_used;
+        if (used < (int64_t)mem_governor_soft) {
+            break;
+        }
+        excess = (size_t)used - mem_governor_soft;
+        bytes += mem_governor_handlers[i].handler(
+            mem_governor_handlers[i].data, excess ? excess : 1, state);
+        mem_governor_flush();
+    }
+    mem_governor_counters.reclaimed += bytes;
+    fast_atomic_lock_off(&mem_governor_lock, &error);
+
+    return (mem_governor_state_t)mem_governor_state;
+}
+
+void
+mem_governor_get_stat(mem_governor_stat_t *stat)
+{
+    int64_t used = mem_governor_used;
+
+    if (!stat) {
+        return;
+    }
+    *stat = mem_governor_counters;
+    stat->soft_limit = mem_governor_soft;
+    stat->hard_limit = mem_governor_hard;
+    stat->used = used > 0 ? (size_t)used : 0;
+    stat->peak = mem_governor_peak;
+    stat->state = mem_governor_state;
+    stat->handlers = mem_governor_nhandlers;
+}
+
+void
+mem_governor_flush(void)
+{
+    int64_t delta = mem_governor_local;
+    int64_t used;
+    size_t  peak;
+
+    if (!mem_governor_registered) {
+        //the thread's last delta is folded in by the key destructor
+        pthread_once(&mem_governor_once, mem_governor_key_create);
+        pthread_setspecific(mem_governor_key, (void *)1);
+        mem_governor_registered = 1;
+    }
+    if (!delta) {
+        return;
+    }
+    mem_governor_local = 0;
+    used = __sync_add_and_fetch(&mem_governor_used, delta);
+    for (peak = mem_governor_peak; used > (int64_t)peak;
+         peak = mem_governor_peak) {
+        if (__sync_bool_compare_and_swap(&mem_governor_peak, peak,
+            (size_t)used)) {
+            break;
+        }
+    }
+    mem_governor_update(used);
+}
+
+static void
+mem_governor_key_create(void)
+{
+    pthread_key_create(&mem_governor_key, mem_governor_thread_exit);
+}
+
+static void
+mem_governor_thread_exit(void *data)
+{
+    int64_t delta = mem_governor_local;
+
+    if (delta) {
+        mem_governor_local = 0;
+        __sync_add_and_fetch(&mem_governor_used, delta);
+    }
+}
+
+static void
+mem_governor_update(int64_t used)
+{
+    size_t soft = mem_governor_soft;
+    size_t hard = mem_governor_hard;
+    int    old, state = FAST_MEM_GOVERNOR_NORMAL;
+
+    if (hard && used >= (int64_t)hard) {
+        state = FAST_MEM_GOVERNOR_HARD;
+
+    } else if (soft && used >= (int64_t)soft) {
+        state = FAST_MEM_GOVERNOR_SOFT;
+    }
+    old = mem_governor_state;
+    if (old == state
+        || !__sync_bool_compare_and_swap(&mem_governor_state, old, state)) {
+        return;
+    }
+    if (state > old) {
+        if (old == FAST_MEM_GOVERNOR_NORMAL) {
+            __sync_fetch_and_add(&mem_governor_counters.soft_events, 1);
+        }
+        if (state == FAST_MEM_GOVERNOR_HARD) {
+            __sync_fetch_and_add(&mem_governor_counters.hard_events, 1);
+        }
+    }
+}
+
+static int64_t
+mem_governor_now_msec(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * the pool caches belong to their threads: this thread's cache is
+ * released now, the others when they next touch their cache
+ */
+static size_t
+mem_governor_reclaim_pools(void *data, size_t excess,
+    mem_governor_state_t state)
+{
+    __sync_fetch_and_add(&mem_governor_epoch, 1);
+
+    return pool_cache_release();
+}
+
+static size_t
+mem_governor_reclaim_tcache(void *data, size_t excess,
+    mem_governor_state_t state)
+{
+    //free spans go at once under pressure, not after the idle time
+    return fast_tcache_release_idle(0);
+}
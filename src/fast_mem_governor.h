@@ -0,0 +1,96 @@
+#ifndef _FAST_MEM_GOVERNOR_H
+#define _FAST_MEM_GOVERNOR_H
+
+#include "fast_types.h"
+
+/*
+ * process memory budget. memory is charged where it comes from the system:
+ * libc blocks behind memory_alloc, pool blocks, the spans and mappings of
+ * the thread caching allocator and shmem segments, so the allocators on
+ * top of them are covered without counting twice. each thread adds to a
+ * local delta that is folded into the global count every
+ * FAST_MEM_GOVERNOR_BATCH bytes, a charge is a thread local add.
+ *
+ * above the soft limit mem_governor_check runs the registered reclaim
+ * handlers, at most once per FAST_MEM_GOVERNOR_INTERVAL_MSEC. above the
+ * hard limit mem_governor_admit refuses new work, conn_pool_get_connection
+ * among others. handlers never run from a charge, which may hold locks of
+ * the allocator it comes from, call mem_governor_check from a timer.
+ *
+ * with no limit set memory_alloc and memory_free on libc skip the
+ * malloc_usable_size and the charge, set the limits before the blocks
+ * they should count are allocated.
+ */
+
+#define FAST_MEM_GOVERNOR_OK              (0)
+#define FAST_MEM_GOVERNOR_ERROR           (-1)
+
+#define FAST_MEM_GOVERNOR_BATCH           (64 * 1024)
+#define FAST_MEM_GOVERNOR_HANDLERS        16
+#define FAST_MEM_GOVERNOR_INTERVAL_MSEC   100
+
+typedef enum {
+    FAST_MEM_GOVERNOR_NORMAL = 0,
+    FAST_MEM_GOVERNOR_SOFT,
+    FAST_MEM_GOVERNOR_HARD
+} mem_governor_state_t;
+
+/*
+ * asked to give back about excess bytes, returns what it released or 0
+ * if it can not tell
+ */
+typedef size_t (*mem_governor_reclaim_pt)(void *data, size_t excess,
+    mem_governor_state_t state);
+
+typedef struct mem_governor_stat_s {
+    size_t          soft_limit;   //0 if not set
+    size_t          hard_limit;   //0 if not set
+    size_t          used;         //bytes charged now
+    size_t          peak;
+    int             state;        //mem_governor_state_t
+    size_t          soft_events;  //times the soft limit was crossed
+    size_t          hard_events;  //times the hard limit was crossed
+    size_t          reclaims;     //rounds of reclaim handlers run
+    size_t          reclaimed;    //bytes the handlers reported
+    size_t          refused;      //work refused by mem_governor_admit
+    size_t          handlers;
+} mem_governor_stat_t;
+
+extern volatile int        mem_governor_state;
+//a limit is set: memory_alloc's libc blocks are only charged while on
+extern volatile int        mem_governor_on;
+extern volatile uint32_t   mem_governor_epoch;
+extern __thread int64_t    mem_governor_local;
+
+#define mem_governor_charge(size) do { \
+    if ((mem_governor_local += (int64_t)(size)) > FAST_MEM_GOVERNOR_BATCH) { \
+        mem_governor_flush(); \
+    } \
+} while (0)
+
+#define mem_governor_uncharge(size) do { \
+    if ((mem_governor_local -= (int64_t)(size)) < -FAST_MEM_GOVERNOR_BATCH) { \
+        mem_governor_flush(); \
+    } \
+} while (0)
+
+/*
+ * limits of 0 are off, a non zero hard limit can not be below the soft
+ * one. registers the built in handlers for the pool caches and the
+ * thread caching allocator
+ */
+int     mem_governor_init(size_t soft_limit, size_t hard_limit);
+int     mem_governor_set_limits(size_t soft_limit, size_t hard_limit);
+int     mem_governor_register(mem_governor_reclaim_pt handler, void *data);
+int     mem_governor_unregister(mem_governor_reclaim_pt handler, void *data);
+
+//FAST_MEM_GOVERNOR_ERROR above the hard limit, new work should be refused
+int     mem_governor_admit(void);
+//update the state and run the reclaim handlers when above the soft limit
+mem_governor_state_t mem_governor_check(void);
+void    mem_governor_get_stat(mem_governor_stat_t *stat);
+
+//fold this thread's delta into the global count, done at thread exit too
+void    mem_governor_flush(void);
+
+#endif
@@ -0,0 +1,595 @@
+#include "fast_mem_profile.h"
+#include "fast_lock.h"
+
+#define mem_profile_ptr_hash(p) \
+    ((((uintptr_t)(p) >> 3) * 0x9e3779b97f4a7c15ULL) >> 32)
+
+typedef struct mem_profile_site_s {
+    uint64_t        hash;
+    uint32_t        depth;
+    size_t          allocs;
+    size_t          alloc_bytes;
+    size_t          frees;
+    size_t          free_bytes;
+    void           *stack[FAST_MEM_PROFILE_DEPTH];
+} mem_profile_site_t;
+
+typedef struct mem_profile_live_s {
+    void * volatile ptr;     //NULL for an empty slot
+    void           *owner;
+    size_t          size;
+    uint32_t        site;
+} mem_profile_live_t;
+
+typedef struct mem_profile_allocator_s {
+    fast_mem_allocator_t    allocator;
+    fast_mem_allocator_t   *inner;
+} mem_profile_allocator_t;
+
+volatile int        mem_profile_enabled;
+volatile int        mem_profile_tracking;
+__thread int64_t    mem_profile_bytes_left;
+
+static __thread uint64_t    mem_profile_seed;
+static size_t               mem_profile_rate = FAST_MEM_PROFILE_DEFAULT_RATE;
+static mem_profile_site_t  *mem_profile_sites;
+static mem_profile_live_t  *mem_profile_live;
+static mem_profile_stat_t   mem_profile_stat;
+static fast_atomic_lock_t   mem_profile_lock;
+
+static int64_t mem_profile_next_interval(void);
+static void mem_profile_lock_on(void);
+static void mem_profile_lock_off(void);
+static mem_profile_site_t *mem_profile_site_get(void **stack, uint32_t depth);
+static void mem_profile_live_delete(size_t i);
+
+int
+mem_profile_start(size_t sample_bytes)
+{
+    if (!mem_profile_sites) {
+        fast_atomic_lock_init(&mem_profile_lock);
+        //libc directly, the profiler must not profile itself
+        mem_profile_sites = calloc(FAST_MEM_PROFILE_SITES,
+            sizeof(mem_profile_site_t));
+        mem_profile_live = calloc(FAST_MEM_PROFILE_LIVE,
+            sizeof(mem_profile_live_t));
+        if (!mem_profile_sites || !mem_profile_live) {
+            free(mem_profile_sites);
+            free(mem_profile_live);
+            mem_profile_sites = NULL;
+            mem_profile_live = NULL;
+            return FAST_MEM_PROFILE_ERROR;
+        }
+    }
+    mem_profile_rate = sample_bytes ? sample_bytes
+                                    : FAST_MEM_PROFILE_DEFAULT_RATE;
+    mem_profile_tracking = 1;
+    mem_profile_enabled = 1;
+
+    return FAST_MEM_PROFILE_OK;
+}
+
+void
+mem_profile_stop(void)
+{
+    //frees of sampled objects are still subtracted until reset
+    mem_profile_enabled = 0;
+}
+
+void
+mem_profile_reset(void)
+{
+    if (mem_profile_enabled || !mem_profile_sites) {
+        return;
+    }
+    mem_profile_lock_on();
+    mem_profile_tracking = 0;
+    memset(mem_profile_sites, 0,
+        FAST_MEM_PROFILE_SITES * sizeof(mem_profile_site_t));
+    memset(mem_profile_live, 0,
+        FAST_MEM_PROFILE_LIVE * sizeof(mem_profile_live_t));
+    memset(&mem_profile_stat, 0, sizeof(mem_profile_stat_t));
+    mem_profile_lock_off();
+}
+
+void
+mem_profile_get_stat(mem_profile_stat_t *stat)
+{
+    if (!stat) {
+        return;
+    }
+    if (!mem_profile_sites) {
+        memset(stat, 0, sizeof(mem_profile_stat_t));
+        return;
+    }
+    mem_profile_lock_on();
+    *stat = mem_profile_stat;
+    mem_profile_lock_off();
+}
+
+void
+mem_profile_sample(void *p, size_t size, void *owner)
+{
+    void                *stack[FAST_MEM_PROFILE_DEPTH + 1];
+    mem_profile_site_t  *site;
+    mem_profile_live_t  *live;
+    size_t               i;
+    int                  depth;
+
+    mem_profile_bytes_left = mem_profile_next_interval();
+
+    if (!mem_profile_sites) {
+        return;
+    }
+
+    //frame 0 is this function
+    depth = backtrace(stack, FAST_MEM_PROFILE_DEPTH + 1) - 1;
+    if (depth <= 0) {
+        return;
+    }
+
+    mem_profile_lock_on();
+
+    if (mem_profile_stat.live >= FAST_MEM_PROFILE_LIVE / 4 * 3) {
+        mem_profile_stat.dropped++;
+        mem_profile_lock_off();
+        return;
+    }
+    site = mem_profile_site_get(stack + 1, depth);
+    if (!site) {
+        mem_profile_stat.dropped++;
+        mem_profile_lock_off();
+        return;
+    }
+    site->allocs++;
+    site->alloc_bytes += size;
+
+    i = mem_profile_ptr_hash(p) & (FAST_MEM_PROFILE_LIVE - 1);
+    while (mem_profile_live[i].ptr) {
+        i = (i + 1) & (FAST_MEM_PROFILE_LIVE - 1);
+    }
+    live = &mem_profile_live[i];
+    live->owner = owner;
+    live->size = size;
+    live->site = site - mem_profile_sites;
+    live->ptr = p;
+
+    mem_profile_stat.samples++;
+    mem_profile_stat.live++;
+
+    mem_profile_lock_off();
+}
+
+void
+mem_profile_release(void *p)
+{
+    mem_profile_live_t  *live;
+    mem_profile_site_t  *site;
+    size_t               i;
+
+    i = mem_profile_ptr_hash(p) & (FAST_MEM_PROFILE_LIVE - 1);
+    //an empty home slot means p was never sampled, no lock needed
+    if (!mem_profile_live || !mem_profile_live[i].ptr) {
+        return;
+    }
+
+    mem_profile_lock_on();
+    for ( ; mem_profile_live[i].ptr; i = (i + 1) & (FAST_MEM_PROFILE_LIVE - 1)) {
+        live = &mem_profile_live[i];
+        if (live->ptr != p) {
+            continue;
+        }
+        site = &mem_profile_sites[live->site];
+        site->frees++;
+        site->free_bytes += live->size;
+        mem_profile_stat.frees++;
+        mem_profile_live_delete(i);
+        break;
+    }
+    mem_profile_lock_off();
+}
+
+void
+mem_profile_release_owner(void *owner)
+{
+    mem_profile_live_t  *live;
+    mem_profile_site_t  *site;
+    size_t               i;
+
+    if (!owner || !mem_profile_live) {
+        return;
+    }
+
+    mem_profile_lock_on();
+    for (i = 0; i < FAST_MEM_PROFILE_LIVE; ) {
+        live = &mem_profile_live[i];
+        if (!live->ptr || live->owner != owner) {
+            i++;
+            continue;
+        }
+        site = &mem_profile_sites[live->site];
+        site->frees++;
+        site->free_bytes += live->size;
+        mem_profile_stat.frees++;
+        //a later entry may have moved into slot i, look at it again
+        mem_profile_live_delete(i);
+    }
+    mem_profile_lock_off();
+}
+
+int
+mem_profile_dump_file(FILE *out)
+{
+    mem_profile_site_t  *site;
+    size_t               i, in_objs = 0, in_bytes = 0;
+    size_t               all_objs = 0, all_bytes = 0;
+    uint32_t             d;
+    FILE                *maps;
+    char                 buf[4096];
+    size_t               n;
+
+    if (!out || !mem_profile_sites) {
+        return FAST_MEM_PROFILE_ERROR;
+    }
+
+    mem_profile_lock_on();
+
+    for (i = 0; i < FAST_MEM_PROFILE_SITES; i++) {
+        site = &mem_profile_sites[i];
+        if (!site->depth) {
+            continue;
+        }
+        in_objs += site->allocs - site->frees;
+        in_bytes += site->alloc_bytes - site->free_bytes;
+        all_objs += site->allocs;
+        all_bytes += site->alloc_bytes;
+    }
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+        in_objs, in_bytes, all_objs, all_bytes, mem_profile_rate);
+
+    for (i = 0; i < FAST_MEM_PROFILE_SITES; i++) {
+        site = &mem_profile_sites[i];
+        if (!site->depth) {
+            continue;
+        }
+        fprintf(out, "%zu: %zu [%zu: %zu] @", site->allocs - site->frees,
+            site->alloc_bytes - site->free_bytes, site->allocs,
+            site->alloc_bytes);
+        for (d = 0; d < site->depth; d++) {
+            fprintf(out, " %p", site->stack[d]);
+        }
+        fputc('\n', out);
+    }
+
+    mem_profile_lock_off();
+
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) {
+            fwrite(buf, 1, n, out);
+        }
+        fclose(maps);
+    }
+
+    return ferror(out) ? FAST_MEM_PROFILE_ERROR : FAST_MEM_PROFILE_OK;
+}
+
+int
+mem_profile_dump(const char *path)
+{
+    FILE *out;
+    int   rc;
+
+    if (!path) {
+        return FAST_MEM_PROFILE_ERROR;
+    }
+    out = fopen(path, "w");
+    if (!out) {
+        return FAST_MEM_PROFILE_ERROR;
+    }
+    rc = mem_profile_dump_file(out);
+    if (fclose(out) != 0) {
+        rc = FAST_MEM_PROFILE_ERROR;
+    }
+    return rc;
+}
+
+//uniform in [1, 2 * rate], so one sample per rate bytes on average
+static int64_t
+mem_profile_next_interval(void)
+{
+    uint64_t x = mem_profile_seed;
+
+    if (!x) {
+        x = (uintptr_t)&mem_profile_seed ^ 0x2545f4914f6cdd1dULL;
+    }
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    mem_profile_seed = x;
+
+    return 1 + (int64_t)(x % (2 * (uint64_t)mem_profile_rate));
+}
+
+static void
+mem_profile_lock_on(void)
+{
+    fast_lock_errno_t error;
+
+    fast_atomic_lock_on(&mem_profile_lock, &error);
+}
+
+static void
+mem_profile_lock_off(void)
+{
+    fast_lock_errno_t error;
+
+    fast_atomic_lock_off(&mem_profile_lock, &error);
+}
+
+static mem_profile_site_t *
+mem_profile_site_get(void **stack, uint32_t depth)
+{
+    mem_profile_site_t  *site;
+    uint64_t             hash = 0xcbf29ce484222325ULL;
+    size_t               i, n;
+    uint32_t             d;
+
+    for (d = 0; d < depth; d++) {
+        hash ^= (uintptr_t)stack[d];
+        hash *= 0x100000001b3ULL;
+    }
+
+    i = hash & (FAST_MEM_PROFILE_SITES - 1);
+    for (n = 0; n < FAST_MEM_PROFILE_SITES; n++) {
+        site = &mem_profile_sites[i];
+        if (!site->depth) {
+            site->hash = hash;
+            site->depth = depth;
+            memcpy(site->stack, stack, depth * sizeof(void *));
+            mem_profile_stat.sites++;
+            return site;
+        }
+        if (site->hash == hash && site->depth == depth
+            && !memcmp(site->stack, stack, depth * sizeof(void *))) {
+            return site;
+        }
+        i = (i + 1) & (FAST_MEM_PROFILE_SITES - 1);
+    }
+    return NULL;
+}
+
+/*
+ * backward shift deletion, an entry is copied into the hole before its
+ * old slot is reused, so the home slot of a live entry never looks empty
+ * to the lock free check in mem_profile_release
+ */
+static void
+mem_profile_live_delete(size_t i)
+{
+    size_t  j, k;
+
+    for (j = i; ; ) {
+        j = (j + 1) & (FAST_MEM_PROFILE_LIVE - 1);
+        if (!mem_profile_live[j].ptr) {
+            break;
+        }
+        k = mem_profile_ptr_hash(mem_profile_live[j].ptr)
+            & (FAST_MEM_PROFILE_LIVE - 1);
+        //move j to i unless its home lies cyclically in (i, j]
+        if ((i < j) ? (k > i && k <= j) : (k > i || k <= j)) {
+            continue;
+        }
+        mem_profile_live[i].owner = mem_profile_live[j].owner;
+        mem_profile_live[i].size = mem_profile_live[j].size;
+        mem_profile_live[i].site = mem_profile_live[j].site;
+        mem_profile_live[i].ptr = mem_profile_live[j].ptr;
+        i = j;
+    }
+    mem_profile_live[i].ptr = NULL;
+    mem_profile_stat.live--;
+}
+
+//allocator wrapper
+
+#define mem_profile_inner(this) (((mem_profile_allocator_t *)(this))->inner)
+
+static int
+mem_profile_allocator_init(fast_mem_allocator_t *this, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    int                   rc;
+
+    rc = inner->init(inner, param_data);
+    this->private_data = inner->private_data;
+    return rc;
+}
+
+static int
+mem_profile_allocator_release(fast_mem_allocator_t *this, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    int                   rc;
+
+    rc = inner->release(inner, param_data);
+    this->private_data = inner->private_data;
+    return rc;
+}
+
+static void *
+mem_profile_allocator_alloc(fast_mem_allocator_t *this, size_t size,
+    void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    void                 *p;
+
+    p = inner->alloc(inner, size, param_data);
+    mem_profile_on_alloc(p, size, NULL);
+    return p;
+}
+
+static void *
+mem_profile_allocator_calloc(fast_mem_allocator_t *this, size_t size,
+    void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    void                 *p;
+
+    p = inner->calloc(inner, size, param_data);
+    mem_profile_on_alloc(p, size, NULL);
+    return p;
+}
+
+static void *
+mem_profile_allocator_split_alloc(fast_mem_allocator_t *this,
+    size_t *act_size, size_t req_minsize, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    void                 *p;
+
+    p = inner->split_alloc(inner, act_size, req_minsize, param_data);
+    mem_profile_on_alloc(p, *act_size, NULL);
+    return p;
+}
+
+static int
+mem_profile_allocator_free(fast_mem_allocator_t *this, void *ptr,
+    void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+
+    mem_profile_on_free(ptr);
+    return inner->free(inner, ptr, param_data);
+}
+
+static const char *
+mem_profile_allocator_strerror(fast_mem_allocator_t *this, void *err_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+
+    return inner->strerror(inner, err_data);
+}
+
+static int
+mem_profile_allocator_stat(fast_mem_allocator_t *this, void *stat_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+
+    return inner->stat(inner, stat_data);
+}
+
+static void *
+mem_profile_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    void                 *p;
+
+    p = inner->realloc(inner, ptr, old_size, size, param_data);
+    if (p) {
+        mem_profile_on_free(ptr);
+        mem_profile_on_alloc(p, size, NULL);
+    }
+    return p;
+}
+
+static void *
+mem_profile_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    void                 *p;
+
+    p = inner->memalign(inner, alignment, size, param_data);
+    mem_profile_on_alloc(p, size, NULL);
+    return p;
+}
+
+static size_t
+mem_profile_allocator_alloc_batch(fast_mem_allocator_t *this, size_t size,
+    void **ptrs, size_t n, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    size_t                i, got;
+
+    got = inner->alloc_batch(inner, size, ptrs, n, param_data);
+    for (i = 0; i < got; i++) {
+        mem_profile_on_alloc(ptrs[i], size, NULL);
+    }
+    return got;
+}
+
+static int
+mem_profile_allocator_free_batch(fast_mem_allocator_t *this, void **ptrs,
+    size_t n, void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+    size_t                i;
+
+    for (i = 0; i < n; i++) {
+        mem_profile_on_free(ptrs[i]);
+    }
+    return inner->free_batch(inner, ptrs, n, param_data);
+}
+
+static size_t
+mem_profile_allocator_usable_size(fast_mem_allocator_t *this, void *ptr,
+    void *param_data)
+{
+    fast_mem_allocator_t *inner = mem_profile_inner(this);
+
+    return inner->usable_size(inner, ptr, param_data);
+}
+
+fast_mem_allocator_t *
+mem_profile_wrap(fast_mem_allocator_t *allocator)
+{
+    mem_profile_allocator_t *w;
+    fast_mem_allocator_t    *a;
+
+    if (!allocator) {
+        return NULL;
+    }
+    w = malloc(sizeof(mem_profile_allocator_t));
+    if (!w) {
+        return NULL;
+    }
+    w->inner = allocator;
+    a = &w->allocator;
+
+    //entries missing in the inner allocator stay NULL so the generic
+    //fallbacks keep their meaning
+    *a = *allocator;
+#define MEM_PROFILE_FORWARD(name) \
+    a->name = allocator->name ? mem_profile_allocator_##name : NULL
+    MEM_PROFILE_FORWARD(init);
+    MEM_PROFILE_FORWARD(release);
+    MEM_PROFILE_FORWARD(alloc);
+    MEM_PROFILE_FORWARD(calloc);
+    MEM_PROFILE_FORWARD(split_alloc);
+    MEM_PROFILE_FORWARD(free);
+    MEM_PROFILE_FORWARD(strerror);
+    MEM_PROFILE_FORWARD(stat);
+    MEM_PROFILE_FORWARD(realloc);
+    MEM_PROFILE_FORWARD(memalign);
+    MEM_PROFILE_FORWARD(alloc_batch);
+    MEM_PROFILE_FORWARD(free_batch);
+    MEM_PROFILE_FORWARD(usable_size);
+#undef MEM_PROFILE_FORWARD
+
+    return a;
+}
+
+fast_mem_allocator_t *
+mem_profile_unwrap(fast_mem_allocator_t *wrapped)
+{
+    fast_mem_allocator_t *inner;
+
+    if (!wrapped) {
+        return NULL;
+    }
+    inner = mem_profile_inner(wrapped);
+    free(wrapped);
+    return inner;
+}
@@ -0,0 +1,79 @@
+#ifndef _FAST_MEM_PROFILE_H
+#define _FAST_MEM_PROFILE_H
+
+#include "fast_types.h"
+#include "fast_mem_allocator.h"
+
+/*
+ * sampling heap profiler for memory_alloc, pool_alloc and any wrapped
+ * fast_mem_allocator_t. about one allocation per sample_bytes is recorded
+ * with its backtrace, a sampled object that is freed again is subtracted
+ * from the in use numbers of its call site. mem_profile_dump writes the
+ * legacy heap_v2 text format understood by pprof.
+ *
+ * when the profiler is stopped a hook is a single test of a global flag.
+ */
+
+#define FAST_MEM_PROFILE_OK             (0)
+#define FAST_MEM_PROFILE_ERROR          (-1)
+
+#define FAST_MEM_PROFILE_DEPTH          32
+#define FAST_MEM_PROFILE_SITES          4096     //power of 2
+#define FAST_MEM_PROFILE_LIVE           65536    //power of 2
+#define FAST_MEM_PROFILE_DEFAULT_RATE   (512 * 1024)
+
+typedef struct mem_profile_stat_s {
+    size_t          samples;     //allocations sampled
+    size_t          frees;       //sampled allocations freed
+    size_t          live;        //sampled allocations alive now
+    size_t          sites;       //distinct call sites
+    size_t          dropped;     //samples lost because a table was full
+} mem_profile_stat_t;
+
+extern volatile int         mem_profile_enabled;
+extern volatile int         mem_profile_tracking;
+extern __thread int64_t     mem_profile_bytes_left;
+
+#define mem_profile_on_alloc(p, size, owner) do { \
+    if (__builtin_expect(mem_profile_enabled, 0) && (p) \
+        && (mem_profile_bytes_left -= (int64_t)(size)) < 0) { \
+        mem_profile_sample((p), (size), (owner)); \
+    } \
+} while (0)
+
+//as mem_profile_on_alloc, flag is set once an object of owner is sampled
+#define mem_profile_on_owned_alloc(p, size, owner, flag) do { \
+    if (__builtin_expect(mem_profile_enabled, 0) && (p) \
+        && (mem_profile_bytes_left -= (int64_t)(size)) < 0) { \
+        mem_profile_sample((p), (size), (owner)); \
+        (flag) = 1; \
+    } \
+} while (0)
+
+#define mem_profile_on_free(p) do { \
+    if (__builtin_expect(mem_profile_tracking, 0) && (p)) { \
+        mem_profile_release(p); \
+    } \
+} while (0)
+
+int   mem_profile_start(size_t sample_bytes);
+void  mem_profile_stop(void);
+//forget all samples, only valid while stopped
+void  mem_profile_reset(void);
+int   mem_profile_dump(const char *path);
+int   mem_profile_dump_file(FILE *out);
+void  mem_profile_get_stat(mem_profile_stat_t *stat);
+
+void  mem_profile_sample(void *p, size_t size, void *owner);
+void  mem_profile_release(void *p);
+//drop the samples of objects owned by a pool that is reset or destroyed
+void  mem_profile_release_owner(void *owner);
+
+/*
+ * a fast_mem_allocator_t that forwards to allocator and samples on the
+ * way, use mem_profile_unwrap to get the original back before deleting it
+ */
+fast_mem_allocator_t *mem_profile_wrap(fast_mem_allocator_t *allocator);
+fast_mem_allocator_t *mem_profile_unwrap(fast_mem_allocator_t *wrapped);
+
+#endif
@@ -1,14 +1,66 @@
 #include "fast_memory.h"
+#include "fast_mem_profile.h"
+#include "fast_mem_allocator.h"
+#include "fast_tcache.h"
+#include "fast_mem_governor.h"
+#include <malloc.h>
+
+/*
+ * the thread caching allocator charges the governor for its own mappings,
+ * libc blocks are charged here once a limit is set
+ */
+#define memory_charge(p) do { \
+    if (__builtin_expect(mem_governor_on, 0) && !memory_tcache && (p)) { \
+        mem_governor_charge(malloc_usable_size(p)); \
+    } \
+} while (0)
+
+#define memory_uncharge(p) do { \
+    if (__builtin_expect(mem_governor_on, 0) && !memory_tcache) { \
+        mem_governor_uncharge(malloc_usable_size(p)); \
+    } \
+} while (0)
+
+static int memory_tcache;
+
+int
+memory_init(int allocator_type)
+{
+    switch (allocator_type) {
+    case 0:
+        memory_tcache = 0;
+        return FAST_OK;
+    case FAST_MEM_ALLOCATOR_TYPE_TCACHE:
+        if (fast_tcache_init() != FAST_TCACHE_OK) {
+            return FAST_ERROR;
+        }
+        memory_tcache = 1;
+        return FAST_OK;
+    default:
+        return FAST_ERROR;
+    }
+}
 
 void *
 memory_alloc(size_t size)
 {
     void *p = NULL;
     
+    p = memory_alloc_raw(size);
+    mem_profile_on_alloc(p, size, NULL);
+    return p;
+}
+
+void *
+memory_alloc_raw(size_t size)
+{
+    void *p = NULL;
+
     if (size == 0) {
         return NULL;
     }
-    p = malloc(size);    
+    p = memory_tcache ? fast_tcache_alloc(size) : malloc(size);
+    memory_charge(p);
     return p;
 }
 
@@ -24,11 +76,49 @@ memory_calloc(size_t size)
     return p;
 }
 
+void *
+memory_realloc(void *p, size_t size)
+{
+    void *np = NULL;
+
+    if (p) {
+        memory_uncharge(p);
+    }
+    np = memory_tcache ? fast_tcache_realloc(p, size) : realloc(p, size);
+    if (!np && p && size) {
+        //p is left as it was
+        memory_charge(p);
+    }
+    memory_charge(np);
+    //size 0 frees p and returns NULL
+    if (p && (np || !size)) {
+        mem_profile_on_free(p);
+    }
+    if (np) {
+        mem_profile_on_alloc(np, size, NULL);
+    }
+    return np;
+}
+
 void
 memory_free(void *p, size_t size)
 {
     if (p) {
-        free(p);
+        mem_profile_on_free(p);
+        memory_free_raw(p, size);
+    }
+}
+
+void
+memory_free_raw(void *p, size_t size)
+{
+    if (p) {
+        memory_uncharge(p);
+        if (memory_tcache) {
+            fast_tcache_free(p, size);
+        } else {
+            free(p);
+        }
     }
 }
 
@@ -40,7 +130,16 @@ memory_memalign(size_t alignment, size_t size)
     if (size == 0) {
         return NULL;
     }
-    posix_memalign(&p, alignment, size);
+    if (memory_tcache) {
+        p = fast_tcache_memalign(alignment, size);
+        if (!p) {
+            return NULL;
+        }
+    } else if (posix_memalign(&p, alignment, size) != 0) {
+        return NULL;
+    }
+    memory_charge(p);
+    mem_profile_on_alloc(p, size, NULL);
     
     return p;
 }
@@ -14,7 +14,6 @@
  * icc7 may also inline several mov's of a zeroed register for small blocks.
  */
 #define memory_zero(buf, n)        (void) memset(buf, 0, n)
-#define memory_realloc(ptr, size)  realloc(ptr, size)
 
 /*
  * gcc3, msvc, and icc7 compile memcpy() to the inline "rep movs".
@@ -28,10 +27,22 @@
 
 
 
+/*
+ * memory_init picks the allocator behind memory_xxx: 0 for libc malloc or
+ * FAST_MEM_ALLOCATOR_TYPE_TCACHE for the thread caching allocator. call it
+ * before the first memory_alloc. the thread caching allocator finds the
+ * size class of a block from its address, the size given to memory_free
+ * is not relied on.
+ */
+int   memory_init(int allocator_type);
 void *memory_alloc(size_t size);
 void *memory_calloc(size_t size);
+void *memory_realloc(void *p, size_t size);
 void  memory_free(void *p, size_t size);
 void *memory_memalign(size_t alignment, size_t size);
+//past the heap profiler, for blocks whose objects it sees one by one
+void *memory_alloc_raw(size_t size);
+void  memory_free_raw(void *p, size_t size);
 int   memory_n2cmp(uchar_t *s1, uchar_t *s2, size_t n1, size_t n2);
 
 #endif
@@ -6,12 +6,103 @@
 #include "fast_memory_pool.h"
 #include "fast_memory.h"
 #include "fast_error_log.h"
+#include "fast_mem_profile.h"
+#include "fast_mem_governor.h"
+#include <sys/mman.h>
+#include <pthread.h>
 
 
 #define FAST_ALIGNMENT sizeof(uint64_t)
 
 static void *pool_alloc_block(pool_t *pool, size_t size);
 static void *pool_alloc_large(pool_t *pool, size_t size);
+static size_t pool_block_released(pool_t *p);
+static void pool_block_drop(pool_t *p);
+static void pool_cache_key_create(void);
+static void pool_cache_thread_exit(void *data);
+
+/*
+ * a cached block whose pages were given back by pool_cache_release has
+ * data.last set to NULL, the header page is kept
+ */
+typedef struct pool_cache_s {
+    pool_t             *blocks;  //linked by data.next, size from data.end
+    uint32_t            epoch;   //mem_governor_epoch seen last
+    pool_cache_stat_t   stat;
+} pool_cache_t;
+
+static __thread pool_cache_t pool_cache = {
+    NULL, 0, { 0, 0, 0, 0, 0, 0, FAST_POOL_CACHE_DEFAULT_MAX, 0 }
+};
+
+//the blocks a thread cached are flushed when it exits
+static pthread_once_t        pool_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t         pool_cache_key;
+static int                   pool_cache_key_ok;
+static __thread int          pool_cache_registered;
+
+#define pool_cache_pressure_check() do { \
+    if (__builtin_expect(pool_cache.epoch != mem_governor_epoch, 0)) { \
+        pool_cache.epoch = mem_governor_epoch; \
+        pool_cache_release(); \
+    } \
+} while (0)
+
+static void *
+pool_block_get(size_t size)
+{
+    pool_t  **link;
+    pool_t   *p;
+    size_t    released;
+
+    pool_cache_pressure_check();
+    for (link = &pool_cache.blocks; *link; link = &(*link)->data.next) {
+        p = *link;
+        if ((size_t)(p->data.end - (uchar_t *)p) == size) {
+            *link = p->data.next;
+            pool_cache.stat.hits++;
+            pool_cache.stat.count--;
+            pool_cache.stat.bytes -= size;
+            if (!p->data.last) {
+                released = pool_block_released(p);
+                pool_cache.stat.released -= released;
+                mem_governor_charge(released);
+            }
+            return p;
+        }
+    }
+    pool_cache.stat.misses++;
+
+    //blocks bypass the heap profiler, the objects carved from them do not.
+    //memory_alloc_raw charges the governor, the pool only makes up for
+    //the pages it gives back
+    return memory_alloc_raw(size);
+}
+
+static void
+pool_block_put(pool_t *p)
+{
+    size_t size = (size_t)(p->data.end - (uchar_t *)p);
+
+    pool_cache_pressure_check();
+    if (pool_cache.stat.count >= pool_cache.stat.max) {
+        pool_cache.stat.drops++;
+        pool_block_drop(p);
+        return;
+    }
+    if (!pool_cache_registered) {
+        pthread_once(&pool_cache_once, pool_cache_key_create);
+        if (pool_cache_key_ok) {
+            pthread_setspecific(pool_cache_key, (void *)1);
+        }
+        pool_cache_registered = 1;
+    }
+    p->data.next = pool_cache.blocks;
+    pool_cache.blocks = p;
+    pool_cache.stat.puts++;
+    pool_cache.stat.count++;
+    pool_cache.stat.bytes += size;
+}
 
 pool_t *
 pool_create(size_t size, size_t max_size, log_t *log)
@@ -24,13 +115,14 @@ pool_create(size_t size, size_t max_size, log_t *log)
     if (size < sizeof(pool_t)) {
         size += sizeof(pool_t);
     }
-    p = memory_alloc(size);
+    p = pool_block_get(size);
     if (!p) {
         return NULL;
     }
     p->data.last = (uchar_t *) p + sizeof(pool_t);
     p->data.end = (uchar_t *) p + size;
     p->data.next = NULL;
+    p->data.failed = 0;
     
     size -= sizeof(pool_t);
     p->max = (size < max_size) ?
@@ -38,7 +130,9 @@ pool_create(size_t size, size_t max_size, log_t *log)
 
     p->current = p;
     p->large = NULL;   
+    p->free = NULL;
     p->log = log;
+    p->sampled = 0;
     return p;
 }
 
@@ -51,6 +145,10 @@ pool_reset(pool_t *pool)
     if (!pool) {
         return;
     }
+    if (pool->sampled) {
+        mem_profile_release_owner(pool);
+        pool->sampled = 0;
+    }
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
             fast_log_debug(pool->log, FAST_LOG_DEBUG, 0,
@@ -62,12 +160,15 @@ pool_reset(pool_t *pool)
     }
     p = pool;
     p->current = p;
+    p->large = NULL;
+    p->free = NULL;
 
     while (p) {
         fast_log_debug(pool->log, FAST_LOG_DEBUG, 0,
             "pool_reset: reset pool:%p, size:%uL",
             p, (char *)p->data.end - ((char *)p));
         p->data.last = (uchar_t *)p + sizeof(pool_t);
+        p->data.failed = 0;
         p = p->data.next;
     }
 }
@@ -82,6 +183,9 @@ pool_destroy(pool_t *pool)
     if (!pool) {
         return;
     }
+    if (pool->sampled) {
+        mem_profile_release_owner(pool);
+    }
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
             fast_log_debug(pool->log, FAST_LOG_DEBUG, 0,
@@ -95,7 +199,7 @@ pool_destroy(pool_t *pool)
         //fast_log_debug(FAST_LOG_DEBUG_ALLOC, 0,
         //    "pool_destroy: free pool:%p, size:%uL",
         //    p, (char*)p->data.end - ((char*)p));
-        memory_free(p, ((char*)p->data.end) - ((char*)p));
+        pool_block_put(p);
         if (!n) {
             break;
         }
@@ -112,16 +216,27 @@ pool_alloc(pool_t *pool, size_t size)
         return NULL;
     }
     if (size <= pool->max) {
+        if (pool->free && size <= FAST_POOL_FREE_MAX) {
+            m = pool->free[(size - 1) / sizeof(void *)];
+            if (m) {
+                pool->free[(size - 1) / sizeof(void *)] = *(void **)m;
+                mem_profile_on_owned_alloc(m, size, pool, pool->sampled);
+                return m;
+            }
+        }
         p = pool->current;
         while (p) {
             m = (uchar_t *)fast_align_ptr(p->data.last, FAST_ALIGNMENT);
             if ( (m < p->data.end) && ((size_t) (p->data.end - m) >= size) ) {
                 p->data.last = m + size;
+                mem_profile_on_owned_alloc(m, size, pool, pool->sampled);
                 return m;
             }
             p = p->data.next;
         }
-        return pool_alloc_block(pool, size);
+        m = pool_alloc_block(pool, size);
+        mem_profile_on_owned_alloc(m, size, pool, pool->sampled);
+        return m;
     }
     return pool_alloc_large(pool, size);
 }
@@ -156,24 +271,30 @@ pool_alloc_block(pool_t *pool, size_t size)
     fast_log_debug(pool->log, FAST_LOG_DEBUG, 0, 
         "pool_alloc: alloc next block size:%d, need size:%d", psize, size);
 
-    nm = memory_alloc(psize);
+    nm = pool_block_get(psize);
     if (!nm) {
         return NULL;
     }
     np = (pool_t *) nm;
     np->data.end = nm + psize;
     np->data.next = NULL;
+    np->data.failed = 0;
     nm += sizeof(pool_data_t);
     nm = fast_align_ptr(nm, FAST_ALIGNMENT);
     np->data.last = nm + size;
     
+    /*
+     * every block walked here failed to serve this request, blocks that
+     * failed too often are dropped from the search by moving current
+     */
+    current = pool->current;
     for (p = pool->current; p->data.next; p = p->data.next) {
-        if ((size_t)(p->data.end - p->data.last) < FAST_ALIGNMENT) {
+        if (p->data.failed++ > FAST_POOL_FAILED_MAX) {
             current = p->data.next;
         }
     }
     p->data.next = np;
-    pool->current = current ? current : np;
+    pool->current = current;
     
     return nm;
 }
@@ -221,11 +342,12 @@ pool_memalign(pool_t *pool, size_t size, size_t alignment)
     }
     large = pool_alloc(pool, sizeof(pool_large_t));
     if (!large) {
-        memory_free(p, size);
+        memory_free(p, 0);
         return NULL;
     }
     large->alloc = p;
-    large->size = size;
+    //aligned blocks are freed without a size hint, see memory_init
+    large->size = 0;
     //insert into pool->large
     large->next = pool->large;
     pool->large = large;
@@ -233,6 +355,152 @@ pool_memalign(pool_t *pool, size_t size, size_t alignment)
     return p;
 }
 
+/*
+ * grows p in place when it is the last allocation of its block and the
+ * block has room, otherwise copies it and hands the old space to pool_free
+ */
+void *
+pool_realloc(pool_t *pool, void *p, size_t old_size, size_t size)
+{
+    pool_t   *b = NULL;
+    void     *np = NULL;
+
+    if (!pool || size == 0) {
+        return NULL;
+    }
+    if (!p) {
+        return pool_alloc(pool, size);
+    }
+    if (size <= old_size) {
+        return p;
+    }
+    if (old_size <= pool->max && size <= pool->max) {
+        for (b = pool->current; b; b = b->data.next) {
+            if ((uchar_t *)p + old_size == b->data.last
+                && (size_t)(b->data.end - (uchar_t *)p) >= size) {
+                b->data.last = (uchar_t *)p + size;
+                return p;
+            }
+        }
+    }
+    np = pool_alloc(pool, size);
+    if (!np) {
+        return NULL;
+    }
+    memory_memcpy(np, p, old_size);
+    pool_free(pool, p, old_size);
+
+    return np;
+}
+
+/*
+ * p must come from pool_alloc or pool_calloc, large memory goes back to
+ * the system at once, small objects are kept on the free list of the
+ * largest class they can fully serve
+ */
+void
+pool_free(pool_t *pool, void *p, size_t size)
+{
+    pool_large_t *l = NULL;
+
+    if (!pool || !p) {
+        return;
+    }
+    if (size > pool->max) {
+        for (l = pool->large; l; l = l->next) {
+            if (l->alloc == p) {
+                memory_free(l->alloc, l->size);
+                l->alloc = NULL;
+                return;
+            }
+        }
+        return;
+    }
+    mem_profile_on_free(p);
+    if (size < sizeof(void *) || size > FAST_POOL_FREE_MAX) {
+        return;
+    }
+    if (!pool->free) {
+        pool->free = pool_calloc(pool, FAST_POOL_FREE_CLASSES * sizeof(void *));
+        if (!pool->free) {
+            return;
+        }
+    }
+    *(void **)p = pool->free[size / sizeof(void *) - 1];
+    pool->free[size / sizeof(void *) - 1] = p;
+}
+
+pool_mark_t *
+pool_mark(pool_t *pool)
+{
+    pool_mark_t  *mark = NULL;
+    pool_t       *p = NULL;
+    size_t        n = 0;
+
+    if (!pool) {
+        return NULL;
+    }
+    for (p = pool->current; p; p = p->data.next) {
+        n++;
+    }
+    //one more slot for a block added by this allocation
+    mark = pool_alloc(pool, sizeof(pool_mark_t)
+        + (n + 1) * sizeof(pool_mark_block_t));
+    if (!mark) {
+        return NULL;
+    }
+    mark->current = pool->current;
+    mark->large = pool->large;
+    mark->nblocks = 0;
+    for (p = pool->current; p && mark->nblocks < n + 1; p = p->data.next) {
+        mark->blocks[mark->nblocks].block = p;
+        mark->blocks[mark->nblocks].last = p->data.last;
+        //the mark itself belongs to the scope
+        if ((uchar_t *)mark > (uchar_t *)p && (uchar_t *)mark < p->data.end) {
+            mark->blocks[mark->nblocks].last = (uchar_t *)mark;
+        }
+        mark->nblocks++;
+    }
+    //the free lists are detached so the scope can not hand out their
+    //objects and leave them linked to rewound memory
+    mark->free = pool->free;
+    pool->free = NULL;
+
+    return mark;
+}
+
+void
+pool_rewind(pool_t *pool, pool_mark_t *mark)
+{
+    pool_large_t *l = NULL;
+    pool_t       *tail = NULL;
+    pool_t       *p = NULL;
+    pool_t       *n = NULL;
+    size_t        i;
+
+    if (!pool || !mark) {
+        return;
+    }
+    for (l = pool->large; l && l != mark->large; l = l->next) {
+        if (l->alloc) {
+            memory_free(l->alloc, l->size);
+        }
+    }
+    pool->large = mark->large;
+    pool->current = mark->current;
+    pool->free = mark->free;
+
+    tail = mark->blocks[mark->nblocks - 1].block;
+    for (i = 0; i < mark->nblocks; i++) {
+        mark->blocks[i].block->data.last = mark->blocks[i].last;
+    }
+    for (p = tail->data.next; p; p = n) {
+        n = p->data.next;
+        pool_block_put(p);
+    }
+    tail->data.next = NULL;
+}
+
 size_t
 fast_align(size_t d, uint32_t a)
 {
@@ -242,3 +510,102 @@ fast_align(size_t d, uint32_t a)
 
     return d;
 }
+
+void
+pool_cache_set_max(size_t max)
+{
+    pool_t  *p;
+    size_t   size;
+
+    pool_cache.stat.max = max;
+    while (pool_cache.stat.count > max) {
+        p = pool_cache.blocks;
+        size = (size_t)(p->data.end - (uchar_t *)p);
+        pool_cache.blocks = p->data.next;
+        pool_cache.stat.count--;
+        pool_cache.stat.bytes -= size;
+        pool_cache.stat.drops++;
+        pool_block_drop(p);
+    }
+}
+
+void
+pool_cache_flush(void)
+{
+    size_t max = pool_cache.stat.max;
+
+    pool_cache_set_max(0);
+    pool_cache.stat.max = max;
+}
+
+size_t
+pool_cache_release(void)
+{
+    pool_t   *p;
+    size_t    len, bytes = 0;
+
+    for (p = pool_cache.blocks; p; p = p->data.next) {
+        len = pool_block_released(p);
+        if (!p->data.last || !len
+            || madvise(fast_align_ptr((uchar_t *)p + sizeof(pool_t),
+                DEFAULT_PAGESIZE), len, MADV_DONTNEED) != 0) {
+            continue;
+        }
+        p->data.last = NULL;
+        bytes += len;
+    }
+    pool_cache.stat.released += bytes;
+    mem_governor_uncharge(bytes);
+
+    return bytes;
+}
+
+void
+pool_cache_get_stat(pool_cache_stat_t *stat)
+{
+    if (stat) {
+        *stat = pool_cache.stat;
+    }
+}
+
+//the whole pages of a block behind its header, what pool_cache_release
+//gives back
+static size_t
+pool_block_released(pool_t *p)
+{
+    uchar_t *start, *end;
+
+    start = fast_align_ptr((uchar_t *)p + sizeof(pool_t), DEFAULT_PAGESIZE);
+    end = (uchar_t *)((uintptr_t)p->data.end
+        & ~(uintptr_t)(DEFAULT_PAGESIZE - 1));
+
+    return end > start ? (size_t)(end - start) : 0;
+}
+
+static void
+pool_cache_key_create(void)
+{
+    pool_cache_key_ok = pthread_key_create(&pool_cache_key,
+        pool_cache_thread_exit) == 0;
+}
+
+static void
+pool_cache_thread_exit(void *data)
+{
+    pool_cache_flush();
+}
+
+static void
+pool_block_drop(pool_t *p)
+{
+    size_t size = (size_t)(p->data.end - (uchar_t *)p);
+    size_t released;
+
+    if (!p->data.last) {
+        //memory_free_raw takes off the whole block
+        released = pool_block_released(p);
+        pool_cache.stat.released -= released;
+        mem_governor_charge(released);
+    }
+    memory_free_raw(p, size);
+}
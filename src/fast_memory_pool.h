@@ -13,6 +13,14 @@
 
 #define FAST_MAX_ALLOC_FROM_POOL ((size_t)(DEFAULT_PAGESIZE - 1))
 
+//a block is skipped by pool_alloc after failing this many times
+#define FAST_POOL_FAILED_MAX         4
+//default number of free blocks kept by each thread's pool cache
+#define FAST_POOL_CACHE_DEFAULT_MAX  64
+//pool_free keeps objects up to this size on per size class free lists
+#define FAST_POOL_FREE_MAX           256
+#define FAST_POOL_FREE_CLASSES       (FAST_POOL_FREE_MAX / sizeof(void *))
+
 #define fast_align_ptr(p, a)       \
     (uchar_t *) (((uintptr_t)(p) + ((uintptr_t)(a) - 1)) & ~((uintptr_t)(a) - 1))
 
@@ -27,6 +35,7 @@ typedef struct pool_data_s {
     uchar_t        *last;
     uchar_t        *end;
     pool_t          *next;
+    uint32_t        failed;  //times this block could not serve a request
 } pool_data_t;
 
 struct pool_s {
@@ -34,17 +43,63 @@ struct pool_s {
     size_t          max;     //max size pool can alloc
     pool_t         *current; //current pool of pool's list
     pool_large_t   *large;   //large memory of pool
+    void          **free;    //size class free lists, created by pool_free
     log_t          *log;
+    uint32_t        sampled; //objects were recorded by the heap profiler
 };
 
+typedef struct pool_mark_block_s {
+    pool_t         *block;
+    uchar_t        *last;
+} pool_mark_block_t;
+
+/*
+ * a scope of stack like allocations: everything allocated from the pool
+ * after pool_mark is released by pool_rewind, objects allocated before
+ * the mark but pool_free'd inside the scope are kept until pool_reset
+ */
+typedef struct pool_mark_s {
+    pool_t             *current;
+    pool_large_t       *large;
+    void              **free;
+    size_t              nblocks;
+    pool_mark_block_t   blocks[0];
+} pool_mark_t;
+
+
+/*
+ * destroyed pools and their blocks are kept in a bounded per thread cache
+ * and reused by pool_create and pool_alloc of the same block size, the
+ * cache of a thread is flushed when it exits
+ */
+typedef struct pool_cache_stat_s {
+    size_t          hits;     //blocks reused from the cache
+    size_t          misses;   //blocks that had to be malloc'ed
+    size_t          puts;     //blocks returned to the cache
+    size_t          drops;    //blocks freed because the cache was full
+    size_t          count;    //blocks in the cache now
+    size_t          bytes;    //bytes in the cache now
+    size_t          max;      //cache limit in blocks
+    size_t          released; //bytes of cached blocks given back
+} pool_cache_stat_t;
 
 pool_t *pool_create(size_t size, size_t max_size, log_t *log);
 void    pool_destroy(pool_t *pool);
 void   *pool_alloc(pool_t *pool, size_t size);
 void   *pool_calloc(pool_t *pool, size_t size);
 void   *pool_memalign(pool_t *pool, size_t size, size_t alignment);
+void   *pool_realloc(pool_t *pool, void *p, size_t old_size, size_t size);
 void    pool_reset(pool_t *pool);
+void    pool_free(pool_t *pool, void *p, size_t size);
+pool_mark_t *pool_mark(pool_t *pool);
+void    pool_rewind(pool_t *pool, pool_mark_t *mark);
 size_t  fast_align(size_t d, uint32_t a);
 
+void    pool_cache_set_max(size_t max);
+void    pool_cache_flush(void);
+//madvise the pages of this thread's cached blocks away, returns the bytes
+size_t  pool_cache_release(void);
+void    pool_cache_get_stat(pool_cache_stat_t *stat);
+
 #endif
 
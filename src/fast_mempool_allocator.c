@@ -19,6 +19,14 @@ fast_mempool_allocator_calloc(fast_mem_allocator_t *this, size_t size,
 static const char *
 fast_mempool_allocator_strerror(fast_mem_allocator_t *this, void *err_data);
 
+static void *
+fast_mempool_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data);
+
+static void *
+fast_mempool_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data);
+
 static fast_mem_allocator_t fast_mempool_allocator = {
     .private_data       = NULL,
     .type               = FAST_MEM_ALLOCATOR_TYPE_MEMPOOL,
@@ -28,7 +36,12 @@ static fast_mem_allocator_t fast_mempool_allocator = {
     .calloc             = fast_mempool_allocator_calloc,
     .free               = NULL,
     .strerror           = fast_mempool_allocator_strerror,
-    .stat               = NULL
+    .stat               = NULL,
+    .realloc            = fast_mempool_allocator_realloc,
+    .memalign           = fast_mempool_allocator_memalign,
+    .alloc_batch        = NULL,
+    .free_batch         = NULL,
+    .usable_size        = NULL
 };
 
 
@@ -100,6 +113,26 @@ fast_mempool_allocator_strerror(fast_mem_allocator_t *this, void *err_data)
     return "no more error info";
 }
 
+static void *
+fast_mempool_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data)
+{
+    if (!this || !this->private_data || (ptr && !old_size)) {
+        return NULL;
+    }
+    return pool_realloc((pool_t *)this->private_data, ptr, old_size, size);
+}
+
+static void *
+fast_mempool_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data)
+{
+    if (!this || !this->private_data) {
+        return NULL;
+    }
+    return pool_memalign((pool_t *)this->private_data, size, alignment);
+}
+
 const fast_mem_allocator_t *fast_get_mempool_allocator(void)
 {
     return &fast_mempool_allocator;
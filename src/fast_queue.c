@@ -33,28 +33,107 @@ queue_middle(queue_t *queue)
     /* no reached */
 }
 
-/* the stable insertion sort */
+/*
+ * bottom up merge sort: the list is taken apart as next-only chains,
+ * pending[i] holds a sorted run of 2^i elements taken before all those
+ * in pending[i - 1], so merging with the older run first keeps equal
+ * elements in order. the prev links are rebuilt at the end
+ */
+#define QUEUE_SORT_LEVELS  (sizeof(size_t) * 8)
+
+static queue_t *queue_merge_runs(queue_t *a, queue_t *b,
+    int (*cmp)(const queue_t *, const queue_t *));
+static void queue_relink(queue_t *queue, queue_t *run);
+
 void
 queue_sort(queue_t *queue,
     int (*cmp)(const queue_t *, const queue_t *))
 {
-    queue_t  *q, *prev, *next;
+    queue_t  *pending[QUEUE_SORT_LEVELS];
+    queue_t  *q, *next, *run;
+    size_t    i, top = 0;
 
     q = queue_head(queue);
     if (q == queue_tail(queue)) {
         return;
     }
-    for (q = queue_next(q); q != queue_sentinel(queue); q = next) {
-        prev = queue_prev(q);
-        next = queue_next(q);
-        queue_remove(q);
-        do {
-            if (cmp(prev, q) <= 0) {
-                break;
-            }
-            prev = queue_prev(prev);
-        } while (prev != queue_sentinel(queue));
-        queue_insert_head(prev, q);
+    queue_tail(queue)->next = NULL;
+
+    for ( ; q; q = next) {
+        next = q->next;
+        q->next = NULL;
+        run = q;
+        for (i = 0; i < top && pending[i]; i++) {
+            run = queue_merge_runs(pending[i], run, cmp);
+            pending[i] = NULL;
+        }
+        if (i == top) {
+            top++;
+        }
+        pending[i] = run;
+    }
+
+    run = NULL;
+    for (i = 0; i < top; i++) {
+        if (pending[i]) {
+            run = run ? queue_merge_runs(pending[i], run, cmp) : pending[i];
+        }
+    }
+    queue_relink(queue, run);
+}
+
+void
+queue_merge(queue_t *h, queue_t *n,
+    int (*cmp)(const queue_t *, const queue_t *))
+{
+    queue_t  *a, *b;
+
+    if (queue_empty(n)) {
+        return;
+    }
+    if (queue_empty(h)) {
+        queue_splice_head(h, n);
+        return;
+    }
+    queue_tail(h)->next = NULL;
+    queue_tail(n)->next = NULL;
+    a = queue_head(h);
+    b = queue_head(n);
+    queue_init(n);
+    queue_relink(h, queue_merge_runs(a, b, cmp));
+}
+
+//a comes first on ties
+static queue_t *
+queue_merge_runs(queue_t *a, queue_t *b,
+    int (*cmp)(const queue_t *, const queue_t *))
+{
+    queue_t   head, *tail = &head;
+
+    while (a && b) {
+        if (cmp(a, b) <= 0) {
+            tail->next = a;
+            a = a->next;
+        } else {
+            tail->next = b;
+            b = b->next;
+        }
+        tail = tail->next;
     }
+    tail->next = a ? a : b;
+
+    return head.next;
 }
 
+static void
+queue_relink(queue_t *queue, queue_t *run)
+{
+    queue_t  *prev = queue;
+
+    for ( ; run; prev = run, run = run->next) {
+        prev->next = run;
+        run->prev = prev;
+    }
+    prev->next = queue;
+    queue->prev = prev;
+}
@@ -100,14 +100,127 @@ struct queue_s {
         (q)->prev = n;       \
 	} while (0)
 
+/*
+ * the splices move every element of n into h and leave n empty, the
+ * elements keep their order. pos is read once, it may be an end of h
+ */
+#define queue_splice_after(pos, n)                  \
+    do {                                            \
+        queue_t *pos__ = (pos);                     \
+        if (!queue_empty(n)) {                      \
+            (n)->prev->next = pos__->next;          \
+            pos__->next->prev = (n)->prev;          \
+            pos__->next = (n)->next;                \
+            (n)->next->prev = pos__;                \
+            queue_init(n);                          \
+        }                                           \
+    } while (0)
+
+#define queue_splice_head(h, n)    queue_splice_after(h, n)
+#define queue_splice_tail(h, n)    queue_splice_after((h)->prev, n)
+
+//moves first up to last, both included and linked from first, to empty n
+#define queue_cut(first, last, n)                   \
+    do {                                            \
+        queue_t *first__ = (first);                 \
+        queue_t *last__ = (last);                   \
+        first__->prev->next = last__->next;         \
+        last__->next->prev = first__->prev;         \
+        (n)->next = first__;                        \
+        first__->prev = (n);                        \
+        (n)->prev = last__;                         \
+        last__->next = (n);                         \
+    } while (0)
+
 #define queue_for_each_entry(pos, head, member)                     \
         for (pos = queue_data((head)->next, typeof(*pos), member);  \
                          &pos->member != (head);                    \
          pos = queue_data(pos->member.next, typeof(*pos), member))
 
+
+/*
+ * position independent variant of queue_t, the links are byte offsets
+ * from a region base, so that a list survives being mapped at another
+ * address (used by the shared memory code)
+ */
+typedef struct oqueue_s oqueue_t;
+
+struct oqueue_s {
+    size_t    prev;
+    size_t    next;
+};
+
+#define oqueue_ptr(base, off) \
+    ((oqueue_t *) ((uchar_t *) (base) + (off)))
+
+#define oqueue_off(base, q) \
+    ((size_t) ((uchar_t *) (q) - (uchar_t *) (base)))
+
+#define oqueue_init(base, q) do { \
+    (q)->prev = oqueue_off(base, q); \
+    (q)->next = (q)->prev; \
+} while (0)
+
+#define oqueue_empty(base, h) \
+    ((h)->prev == oqueue_off(base, h))
+
+#define oqueue_head(base, h) \
+    oqueue_ptr(base, (h)->next)
+
+#define oqueue_tail(base, h) \
+    oqueue_ptr(base, (h)->prev)
+
+#define oqueue_next(base, q) \
+    oqueue_ptr(base, (q)->next)
+
+#define oqueue_prev(base, q) \
+    oqueue_ptr(base, (q)->prev)
+
+#define oqueue_insert_head(base, h, x) \
+    do {                                                     \
+        (x)->next = (h)->next;                               \
+        oqueue_ptr(base, (x)->next)->prev = oqueue_off(base, x); \
+        (x)->prev = oqueue_off(base, h);                     \
+        (h)->next = oqueue_off(base, x);                     \
+    } while (0)
+
+#define oqueue_insert_tail(base, h, x) \
+    do {                                                     \
+        (x)->prev = (h)->prev;                               \
+        oqueue_ptr(base, (x)->prev)->next = oqueue_off(base, x); \
+        (x)->next = oqueue_off(base, h);                     \
+        (h)->prev = oqueue_off(base, x);                     \
+    } while (0)
+
+#define oqueue_insert_before(base, listelm, elm) \
+    do {                                                     \
+        (elm)->prev = (listelm)->prev;                       \
+        (elm)->next = oqueue_off(base, listelm);             \
+        oqueue_ptr(base, (listelm)->prev)->next = oqueue_off(base, elm); \
+        (listelm)->prev = oqueue_off(base, elm);             \
+    } while (0)
+
+#define oqueue_insert_after(base, listelm, elm) \
+    do {                                                     \
+        (elm)->next = (listelm)->next;                       \
+        (elm)->prev = oqueue_off(base, listelm);             \
+        oqueue_ptr(base, (listelm)->next)->prev = oqueue_off(base, elm); \
+        (listelm)->next = oqueue_off(base, elm);             \
+    } while (0)
+
+#define oqueue_remove(base, x) \
+    do {                                                     \
+        oqueue_ptr(base, (x)->next)->prev = (x)->prev;       \
+        oqueue_ptr(base, (x)->prev)->next = (x)->next;       \
+        (x)->prev = (x)->next = 0;                           \
+    } while (0)
 	
 queue_t *queue_middle(queue_t *queue);
+//stable, O(n log n) compares and no allocation
 void queue_sort(queue_t *queue,
     int (*cmp)(const queue_t *, const queue_t *));
+//merges sorted n into sorted h, stable with h first, n is left empty
+void queue_merge(queue_t *h, queue_t *n,
+    int (*cmp)(const queue_t *, const queue_t *));
 
 #endif /* _FAST_QUEUE_H_INCLUDED_ */
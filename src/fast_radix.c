@@ -0,0 +1,677 @@
+#include "fast_radix.h"
+#include "fast_memory.h"
+
+#define FAST_RADIX_STR_MAX      (INET6_ADDRSTRLEN + sizeof("/128"))
+
+typedef struct fast_radix_entry_s {
+    fast_radix_prefix_t     prefix;
+    size_t                  index;      // in the strings given
+} fast_radix_entry_t;
+
+#define FAST_RADIX_STRIDE_SIZE \
+    ((1 << FAST_RADIX_STRIDE) * sizeof(fast_radix_stride_t))
+
+#define fast_radix_bits(family) ((family) == FAST_RADIX_V4 ? 32 : 128)
+
+//bit i of a key, 0 the highest of the first word
+#define fast_radix_bit(key, i) \
+    ((i) < 64 ? ((key)[0] >> (63 - (i))) & 1 : ((key)[1] >> (127 - (i))) & 1)
+
+static fast_radix_node_t *fast_radix_node_new(fast_radix_t *tree,
+    const uint64_t *key, uint8_t len);
+static void fast_radix_node_free(fast_radix_t *tree, fast_radix_node_t *node);
+static void fast_radix_free_node(fast_radix_t *tree, fast_radix_node_t *node);
+static void fast_radix_stride_create(fast_radix_t *tree);
+static void fast_radix_stride_update(fast_radix_t *tree, int family,
+    const uint64_t *key, uint8_t len);
+static int fast_radix_entry_cmp(const void *e1, const void *e2);
+
+static _xinline uint64_t
+fast_radix_mask(uint8_t len, int word)
+{
+    int bits = word ? len - 64 : len;
+
+    if (bits <= 0) {
+        return 0;
+    }
+    if (bits >= 64) {
+        return ~0ULL;
+    }
+    return ~0ULL << (64 - bits);
+}
+
+//the first len bits of the two keys are the same
+static _xinline int
+fast_radix_covers(const uint64_t *key, const uint64_t *addr, uint8_t len)
+{
+    return !(((key[0] ^ addr[0]) & fast_radix_mask(len, 0))
+        | ((key[1] ^ addr[1]) & fast_radix_mask(len, 1)));
+}
+
+//the first bit the two keys differ at, 128 if none
+static _xinline uint8_t
+fast_radix_diff(const uint64_t *k1, const uint64_t *k2)
+{
+    uint64_t x;
+
+    x = k1[0] ^ k2[0];
+    if (x) {
+        return (uint8_t)__builtin_clzll(x);
+    }
+    x = k1[1] ^ k2[1];
+    if (x) {
+        return (uint8_t)(64 + __builtin_clzll(x));
+    }
+    return 128;
+}
+
+static _xinline void
+fast_radix_key(int family, const uchar_t *addr, uint64_t *key)
+{
+    uint32_t    a4;
+    size_t      i;
+
+    if (family == FAST_RADIX_V4) {
+        memcpy(&a4, addr, sizeof(uint32_t));
+        key[0] = (uint64_t)ntohl(a4) << 32;
+        key[1] = 0;
+        return;
+    }
+    key[0] = key[1] = 0;
+    for (i = 0; i < 8; i++) {
+        key[0] = (key[0] << 8) | addr[i];
+        key[1] = (key[1] << 8) | addr[i + 8];
+    }
+}
+
+fast_radix_t *
+fast_radix_create(fast_mem_allocator_t *allocator)
+{
+    fast_radix_t   *tree;
+    unsigned int    err_no;
+
+    if (allocator) {
+        tree = allocator->calloc(allocator, sizeof(fast_radix_t), &err_no);
+    } else {
+        tree = memory_calloc(sizeof(fast_radix_t));
+    }
+    if (!tree) {
+        return NULL;
+    }
+    tree->allocator = allocator;
+
+    return tree;
+}
+
+void
+fast_radix_free(fast_radix_t *tree)
+{
+    fast_radix_block_t *block;
+    unsigned int        err_no;
+
+    if (!tree) {
+        return;
+    }
+    fast_radix_free_node(tree, tree->root[FAST_RADIX_V4]);
+    fast_radix_free_node(tree, tree->root[FAST_RADIX_V6]);
+
+    if (tree->stride) {
+        if (tree->allocator) {
+            fast_mem_allocator_free(tree->allocator, tree->stride, &err_no);
+        } else {
+            memory_free(tree->stride, FAST_RADIX_STRIDE_SIZE);
+        }
+    }
+    while (tree->blocks) {
+        block = tree->blocks;
+        tree->blocks = block->next;
+        if (tree->allocator) {
+            fast_mem_allocator_free(tree->allocator, block, &err_no);
+        } else {
+            memory_free(block, block->size);
+        }
+    }
+    if (tree->allocator) {
+        fast_mem_allocator_free(tree->allocator, tree, &err_no);
+    } else {
+        memory_free(tree, sizeof(fast_radix_t));
+    }
+}
+
+int
+fast_radix_parse(const uchar_t *str, size_t len, fast_radix_prefix_t *prefix)
+{
+    uchar_t     buf[FAST_RADIX_STR_MAX];
+    uchar_t     addr[16];
+    uchar_t    *slash;
+    size_t      i, bits;
+    int         family;
+
+    if (!str || !len || len >= FAST_RADIX_STR_MAX) {
+        return FAST_RADIX_ERROR;
+    }
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+
+    family = string_strchr(buf, ':') ? FAST_RADIX_V6 : FAST_RADIX_V4;
+    bits = fast_radix_bits(family);
+
+    slash = (uchar_t *)string_strchr(buf, '/');
+    if (slash) {
+        *slash++ = '\0';
+        if (!*slash || string_strlen(slash) > 3) {
+            return FAST_RADIX_ERROR;
+        }
+        for (i = 0; slash[i]; i++) {
+            if (slash[i] < '0' || slash[i] > '9') {
+                return FAST_RADIX_ERROR;
+            }
+        }
+        i = string_xxstrtosize(slash, string_strlen(slash));
+        if (i > bits) {
+            return FAST_RADIX_ERROR;
+        }
+        bits = i;
+    }
+
+    if (inet_pton(family == FAST_RADIX_V4 ? AF_INET : AF_INET6,
+        (const char *)buf, addr) != 1)
+    {
+        return FAST_RADIX_ERROR;
+    }
+
+    fast_radix_key(family, addr, prefix->key);
+    prefix->key[0] &= fast_radix_mask(bits, 0);
+    prefix->key[1] &= fast_radix_mask(bits, 1);
+    prefix->len = (uint8_t)bits;
+    prefix->family = (uint8_t)family;
+
+    return FAST_RADIX_OK;
+}
+
+int
+fast_radix_insert(fast_radix_t *tree, fast_radix_prefix_t *prefix,
+    void *value)
+{
+    fast_radix_node_t  **link, *node, *leaf, *fork;
+    uint8_t              common;
+
+    if (prefix->family > FAST_RADIX_V6
+        || prefix->len > fast_radix_bits(prefix->family))
+    {
+        return FAST_RADIX_ERROR;
+    }
+    if (prefix->family == FAST_RADIX_V4 && !tree->stride) {
+        fast_radix_stride_create(tree);
+    }
+
+    link = &tree->root[prefix->family];
+    for ( ;; ) {
+        node = *link;
+        if (!node) {
+            leaf = fast_radix_node_new(tree, prefix->key, prefix->len);
+            if (!leaf) {
+                return FAST_RADIX_ERROR;
+            }
+            common = prefix->len;
+            break;
+        }
+
+        common = fast_radix_diff(node->key, prefix->key);
+        if (common > node->len) {
+            common = node->len;
+        }
+        if (common > prefix->len) {
+            common = prefix->len;
+        }
+
+        if (common == node->len) {
+            if (node->len == prefix->len) {
+                if (!node->route) {
+                    node->route = 1;
+                    tree->routes++;
+                }
+                node->value = value;
+                fast_radix_stride_update(tree, prefix->family, node->key,
+                    node->len);
+                return FAST_RADIX_OK;
+            }
+            link = &node->child[fast_radix_bit(prefix->key, node->len)];
+            continue;
+        }
+
+        leaf = fast_radix_node_new(tree, prefix->key, prefix->len);
+        if (!leaf) {
+            return FAST_RADIX_ERROR;
+        }
+        if (common == prefix->len) {
+            //the new prefix covers the node, it goes above it
+            leaf->child[fast_radix_bit(node->key, common)] = node;
+            break;
+        }
+
+        //the two part below their common bits, a fork holds them
+        fork = fast_radix_node_new(tree, prefix->key, common);
+        if (!fork) {
+            fast_radix_node_free(tree, leaf);
+            return FAST_RADIX_ERROR;
+        }
+        fork->key[0] &= fast_radix_mask(common, 0);
+        fork->key[1] &= fast_radix_mask(common, 1);
+        fork->child[fast_radix_bit(prefix->key, common)] = leaf;
+        fork->child[fast_radix_bit(node->key, common)] = node;
+        leaf->route = 1;
+        leaf->value = value;
+        *link = fork;
+        tree->routes++;
+        fast_radix_stride_update(tree, prefix->family, fork->key, common);
+        return FAST_RADIX_OK;
+    }
+
+    leaf->route = 1;
+    leaf->value = value;
+    *link = leaf;
+    tree->routes++;
+    fast_radix_stride_update(tree, prefix->family, leaf->key, leaf->len);
+
+    return FAST_RADIX_OK;
+}
+
+int
+fast_radix_delete(fast_radix_t *tree, fast_radix_prefix_t *prefix)
+{
+    fast_radix_node_t  **link, **plink = NULL, *node, *parent, *child;
+    uint64_t             key[2];
+    uint8_t              span;
+
+    if (prefix->family > FAST_RADIX_V6) {
+        return FAST_RADIX_ERROR;
+    }
+
+    link = &tree->root[prefix->family];
+    for ( ;; ) {
+        node = *link;
+        if (!node || node->len > prefix->len
+            || !fast_radix_covers(node->key, prefix->key, node->len))
+        {
+            return FAST_RADIX_NOT_FOUND;
+        }
+        if (node->len == prefix->len) {
+            break;
+        }
+        plink = link;
+        link = &node->child[fast_radix_bit(prefix->key, node->len)];
+    }
+    if (!node->route) {
+        return FAST_RADIX_NOT_FOUND;
+    }
+
+    node->route = 0;
+    node->value = NULL;
+    tree->routes--;
+    key[0] = node->key[0];
+    key[1] = node->key[1];
+    span = node->len;
+
+    //a fork of two stays, a node with one child or none goes
+    if (!node->child[0] || !node->child[1]) {
+        child = node->child[0] ? node->child[0] : node->child[1];
+        *link = child;
+        fast_radix_node_free(tree, node);
+
+        //a fork left with one side and no prefix of its own goes too
+        if (!child && plink) {
+            parent = *plink;
+            if (!parent->route) {
+                *plink = parent->child[0] ? parent->child[0]
+                                          : parent->child[1];
+                key[0] = parent->key[0];
+                key[1] = parent->key[1];
+                span = parent->len;
+                fast_radix_node_free(tree, parent);
+            }
+        }
+    }
+
+    fast_radix_stride_update(tree, prefix->family, key, span);
+
+    return FAST_RADIX_OK;
+}
+
+int
+fast_radix_find(fast_radix_t *tree, fast_radix_prefix_t *prefix,
+    void **value)
+{
+    fast_radix_node_t  *node;
+
+    if (prefix->family > FAST_RADIX_V6) {
+        return FAST_RADIX_ERROR;
+    }
+
+    node = tree->root[prefix->family];
+    while (node && node->len <= prefix->len
+           && fast_radix_covers(node->key, prefix->key, node->len)) {
+        if (node->len == prefix->len) {
+            if (!node->route) {
+                break;
+            }
+            if (value) {
+                *value = node->value;
+            }
+            return FAST_RADIX_OK;
+        }
+        node = node->child[fast_radix_bit(prefix->key, node->len)];
+    }
+
+    return FAST_RADIX_NOT_FOUND;
+}
+
+int
+fast_radix_match(fast_radix_t *tree, int family, const void *addr,
+    void **value)
+{
+    fast_radix_node_t  *node, *best = NULL;
+    uint64_t            key[2];
+    uint8_t             bits;
+
+    if (family != FAST_RADIX_V4 && family != FAST_RADIX_V6) {
+        return FAST_RADIX_ERROR;
+    }
+    fast_radix_key(family, addr, key);
+    bits = fast_radix_bits(family);
+
+    node = tree->root[family];
+    if (family == FAST_RADIX_V4 && tree->stride) {
+        //the first FAST_RADIX_STRIDE bits are walked already
+        best = tree->stride[key[0] >> (64 - FAST_RADIX_STRIDE)].best;
+        node = tree->stride[key[0] >> (64 - FAST_RADIX_STRIDE)].node;
+    }
+    while (node && fast_radix_covers(node->key, key, node->len)) {
+        if (node->route) {
+            best = node;
+        }
+        if (node->len == bits) {
+            break;
+        }
+        node = node->child[fast_radix_bit(key, node->len)];
+    }
+
+    if (!best) {
+        return FAST_RADIX_NOT_FOUND;
+    }
+    if (value) {
+        *value = best->value;
+    }
+    return FAST_RADIX_OK;
+}
+
+int
+fast_radix_match_sockaddr(fast_radix_t *tree, const struct sockaddr *sa,
+    void **value)
+{
+    const struct sockaddr_in6  *sin6;
+    const uchar_t              *a;
+
+    switch (sa->sa_family) {
+    case AF_INET:
+        return fast_radix_match(tree, FAST_RADIX_V4,
+            &((const struct sockaddr_in *)sa)->sin_addr, value);
+
+    case AF_INET6:
+        sin6 = (const struct sockaddr_in6 *)sa;
+        a = sin6->sin6_addr.s6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            return fast_radix_match(tree, FAST_RADIX_V4, a + 12, value);
+        }
+        return fast_radix_match(tree, FAST_RADIX_V6, a, value);
+
+    default:
+        return FAST_RADIX_ERROR;
+    }
+}
+
+int
+fast_radix_load(fast_radix_t *tree, string_t *cidrs, size_t n,
+    void **values, void *value, size_t *failed)
+{
+    fast_radix_entry_t     *entries;
+    fast_radix_block_t     *block;
+    unsigned int            err_no;
+    size_t                  i, size;
+    int                     rc = FAST_RADIX_OK;
+
+    if (!n) {
+        return FAST_RADIX_OK;
+    }
+
+    entries = memory_alloc(n * sizeof(fast_radix_entry_t));
+    if (!entries) {
+        return FAST_RADIX_ERROR;
+    }
+    for (i = 0; i < n; i++) {
+        if (fast_radix_parse(cidrs[i].data, cidrs[i].len, &entries[i].prefix)
+            != FAST_RADIX_OK)
+        {
+            if (failed) {
+                *failed = i;
+            }
+            memory_free(entries, 0);
+            return FAST_RADIX_ERROR;
+        }
+        entries[i].index = i;
+    }
+
+    /*
+     * a prefix sorts before those it covers, the inserts then make the
+     * nodes of a subtree close together in the block
+     */
+    qsort(entries, n, sizeof(fast_radix_entry_t), fast_radix_entry_cmp);
+
+    //every prefix makes at most a node and a fork
+    size = sizeof(fast_radix_block_t) + 2 * n * sizeof(fast_radix_node_t);
+    if (tree->allocator) {
+        block = tree->allocator->alloc(tree->allocator, size, &err_no);
+    } else {
+        block = memory_alloc(size);
+    }
+    if (block) {
+        block->size = size;
+        block->nodes = 2 * n;
+        block->used = 0;
+        block->next = tree->blocks;
+        tree->blocks = block;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (fast_radix_insert(tree, &entries[i].prefix,
+            values ? values[entries[i].index] : value) != FAST_RADIX_OK)
+        {
+            if (failed) {
+                *failed = entries[i].index;
+            }
+            rc = FAST_RADIX_ERROR;
+            break;
+        }
+    }
+
+    memory_free(entries, 0);
+    return rc;
+}
+
+int
+fast_radix_load_list(fast_radix_t *tree, list_t *cidrs, void *value,
+    size_t *failed)
+{
+    list_part_t    *part;
+    string_t       *all;
+    size_t          n = 0;
+    int             rc;
+
+    for (part = &cidrs->part; part; part = part->next) {
+        n += part->nelts;
+    }
+    if (!n) {
+        return FAST_RADIX_OK;
+    }
+    all = memory_alloc(n * sizeof(string_t));
+    if (!all) {
+        return FAST_RADIX_ERROR;
+    }
+    n = 0;
+    for (part = &cidrs->part; part; part = part->next) {
+        memcpy(all + n, part->elts, part->nelts * sizeof(string_t));
+        n += part->nelts;
+    }
+
+    rc = fast_radix_load(tree, all, n, NULL, value, failed);
+    memory_free(all, 0);
+
+    return rc;
+}
+
+static void
+fast_radix_stride_create(fast_radix_t *tree)
+{
+    uint64_t        all[2] = { 0, 0 };
+    unsigned int    err_no;
+
+    //with no table the matches walk down the top bits, nothing more
+    if (tree->allocator) {
+        tree->stride = tree->allocator->calloc(tree->allocator,
+            FAST_RADIX_STRIDE_SIZE, &err_no);
+    } else {
+        tree->stride = memory_calloc(FAST_RADIX_STRIDE_SIZE);
+    }
+    if (tree->stride) {
+        fast_radix_stride_update(tree, FAST_RADIX_V4, all, 0);
+    }
+}
+
+/*
+ * walks again the top of the tree for the entries under key/len. an
+ * entry only keeps a node it lies under, a node that goes or changes
+ * is then found from the entries in its own range
+ */
+static void
+fast_radix_stride_update(fast_radix_t *tree, int family, const uint64_t *key,
+    uint8_t len)
+{
+    fast_radix_stride_t    *entry;
+    fast_radix_node_t      *node, *best;
+    uint64_t                addr[2] = { 0, 0 };
+    size_t                  i, from, n;
+
+    if (family != FAST_RADIX_V4 || !tree->stride) {
+        return;
+    }
+    if (len > FAST_RADIX_STRIDE) {
+        len = FAST_RADIX_STRIDE;
+    }
+    n = (size_t)1 << (FAST_RADIX_STRIDE - len);
+    from = (key[0] >> (64 - FAST_RADIX_STRIDE)) & ~(n - 1);
+
+    for (i = from; i < from + n; i++) {
+        addr[0] = (uint64_t)i << (64 - FAST_RADIX_STRIDE);
+        node = tree->root[FAST_RADIX_V4];
+        best = NULL;
+        while (node && node->len < FAST_RADIX_STRIDE) {
+            if (!fast_radix_covers(node->key, addr, node->len)) {
+                node = NULL;
+                break;
+            }
+            if (node->route) {
+                best = node;
+            }
+            node = node->child[fast_radix_bit(addr, node->len)];
+        }
+        if (node && !fast_radix_covers(node->key, addr, FAST_RADIX_STRIDE)) {
+            node = NULL;
+        }
+        entry = &tree->stride[i];
+        entry->best = best;
+        entry->node = node;
+    }
+}
+
+static fast_radix_node_t *
+fast_radix_node_new(fast_radix_t *tree, const uint64_t *key, uint8_t len)
+{
+    fast_radix_node_t  *node;
+    unsigned int        err_no;
+
+    if (tree->blocks && tree->blocks->used < tree->blocks->nodes) {
+        node = &tree->blocks->node[tree->blocks->used++];
+        node->block = 1;
+    } else {
+        if (tree->allocator) {
+            node = tree->allocator->alloc(tree->allocator,
+                sizeof(fast_radix_node_t), &err_no);
+        } else {
+            node = memory_alloc(sizeof(fast_radix_node_t));
+        }
+        if (!node) {
+            return NULL;
+        }
+        node->block = 0;
+    }
+    node->key[0] = key[0];
+    node->key[1] = key[1];
+    node->child[0] = node->child[1] = NULL;
+    node->value = NULL;
+    node->len = len;
+    node->route = 0;
+    tree->nodes++;
+
+    return node;
+}
+
+static void
+fast_radix_node_free(fast_radix_t *tree, fast_radix_node_t *node)
+{
+    unsigned int    err_no;
+
+    tree->nodes--;
+    if (node->block) {
+        //goes with its block
+        return;
+    }
+    if (tree->allocator) {
+        fast_mem_allocator_free(tree->allocator, node, &err_no);
+    } else {
+        memory_free(node, sizeof(fast_radix_node_t));
+    }
+}
+
+static void
+fast_radix_free_node(fast_radix_t *tree, fast_radix_node_t *node)
+{
+    if (!node) {
+        return;
+    }
+    fast_radix_free_node(tree, node->child[0]);
+    fast_radix_free_node(tree, node->child[1]);
+    fast_radix_node_free(tree, node);
+}
+
+//a duplicate later in the strings sorts after, its value is the one kept
+static int
+fast_radix_entry_cmp(const void *e1, const void *e2)
+{
+    const fast_radix_prefix_t *a = &((const fast_radix_entry_t *)e1)->prefix;
+    const fast_radix_prefix_t *b = &((const fast_radix_entry_t *)e2)->prefix;
+
+    if (a->family != b->family) {
+        return a->family < b->family ? -1 : 1;
+    }
+    if (a->key[0] != b->key[0]) {
+        return a->key[0] < b->key[0] ? -1 : 1;
+    }
+    if (a->key[1] != b->key[1]) {
+        return a->key[1] < b->key[1] ? -1 : 1;
+    }
+    if (a->len != b->len) {
+        return a->len < b->len ? -1 : 1;
+    }
+    return ((const fast_radix_entry_t *)e1)->index
+        < ((const fast_radix_entry_t *)e2)->index ? -1 : 1;
+}
@@ -0,0 +1,115 @@
+#ifndef _FAST_RADIX_H
+#define _FAST_RADIX_H
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "fast_types.h"
+#include "fast_string.h"
+#include "fast_list.h"
+#include "fast_mem_allocator.h"
+
+/*
+ * path compressed binary radix tree of IPv4 and IPv6 prefixes, each
+ * with a value, matched longest prefix first. a node stands where two
+ * prefixes part or where a prefix ends, no node has one child and no
+ * prefix of its own, so a match visits no more nodes than the prefixes
+ * that cover the address, one per level with a fork.
+ *
+ * addresses are kept as two 64 bit words in host order, IPv4 in the top
+ * 32 bits of the first, a node compares its whole prefix in two masked
+ * xors. IPv4 and IPv6 have a root each, an IPv4 mapped IPv6 address is
+ * matched as IPv4. an IPv4 match starts from the table entry of the top
+ * FAST_RADIX_STRIDE bits of the address, which holds the longest prefix
+ * above and the node the walk goes on from: blocklists of /16 and
+ * longer take a miss or two in place of a dozen.
+ *
+ * fast_radix_load sorts the prefixes and takes their nodes from one
+ * block, a prefix and those under it are made close together.
+ */
+
+#define FAST_RADIX_OK               (0)
+#define FAST_RADIX_ERROR            (-1)
+#define FAST_RADIX_NOT_FOUND        (1)
+
+#define FAST_RADIX_V4               0
+#define FAST_RADIX_V6               1
+
+//IPv4 bits a match takes from a table before it walks, 1MB of table
+#define FAST_RADIX_STRIDE           16
+
+typedef struct fast_radix_prefix_s {
+    uint64_t                    key[2];   // host order, bits past len zero
+    uint8_t                     len;
+    uint8_t                     family;   // FAST_RADIX_V4 or V6
+} fast_radix_prefix_t;
+
+typedef struct fast_radix_node_s fast_radix_node_t;
+
+struct fast_radix_node_s {
+    uint64_t                    key[2];
+    fast_radix_node_t          *child[2];
+    void                       *value;
+    uint8_t                     len;
+    uint8_t                     route;    // a prefix ends here
+    uint8_t                     block;    // from a load block, not freed alone
+};
+
+typedef struct fast_radix_block_s fast_radix_block_t;
+
+struct fast_radix_block_s {
+    fast_radix_block_t         *next;
+    size_t                      size;     // bytes, for the free
+    size_t                      nodes;
+    size_t                      used;
+    fast_radix_node_t           node[];
+};
+
+typedef struct fast_radix_stride_s {
+    fast_radix_node_t          *best;     // longest prefix in the stride
+    fast_radix_node_t          *node;     // the walk goes on from here
+} fast_radix_stride_t;
+
+typedef struct fast_radix_s {
+    fast_radix_node_t          *root[2];
+    fast_radix_stride_t        *stride;   // IPv4, 1 << FAST_RADIX_STRIDE
+    fast_radix_block_t         *blocks;
+    fast_mem_allocator_t       *allocator; // NULL for memory_alloc
+    size_t                      routes;
+    size_t                      nodes;
+} fast_radix_t;
+
+fast_radix_t *fast_radix_create(fast_mem_allocator_t *allocator);
+void fast_radix_free(fast_radix_t *tree);
+
+/*
+ * "a.b.c.d/len" or "x:x::x/len", no len is a host. bits past len are
+ * cleared, 10.1.2.3/8 is 10.0.0.0/8
+ */
+int  fast_radix_parse(const uchar_t *str, size_t len,
+    fast_radix_prefix_t *prefix);
+
+//a prefix already there gets the new value
+int  fast_radix_insert(fast_radix_t *tree, fast_radix_prefix_t *prefix,
+    void *value);
+int  fast_radix_delete(fast_radix_t *tree, fast_radix_prefix_t *prefix);
+//the value of the prefix itself, not of one covering it
+int  fast_radix_find(fast_radix_t *tree, fast_radix_prefix_t *prefix,
+    void **value);
+
+//addr is 4 or 16 bytes in network order
+int  fast_radix_match(fast_radix_t *tree, int family, const void *addr,
+    void **value);
+int  fast_radix_match_sockaddr(fast_radix_t *tree, const struct sockaddr *sa,
+    void **value);
+
+/*
+ * n prefixes in text with a value each, values NULL sets them all to
+ * value. nothing is inserted if one does not parse, *failed is its index
+ */
+int  fast_radix_load(fast_radix_t *tree, string_t *cidrs, size_t n,
+    void **values, void *value, size_t *failed);
+//the strings of a list made by conf_parse_list_string
+int  fast_radix_load_list(fast_radix_t *tree, list_t *cidrs, void *value,
+    size_t *failed);
+
+#endif
@@ -18,6 +18,8 @@ static _xinline void rbtree_left_rotate(rbtree_node_t **root,
     rbtree_node_t *sentinel, rbtree_node_t *node);
 static _xinline void rbtree_right_rotate(rbtree_node_t **root,
     rbtree_node_t *sentinel, rbtree_node_t *node);
+static _xinline int rbtree_cmp(rbtree_node_t *node, const void *key,
+    rbtree_cmp_pt cmp);
 
 void
 rbtree_init(_xvolatile rbtree_t *tree,
@@ -28,6 +30,7 @@ rbtree_init(_xvolatile rbtree_t *tree,
         tree->root = s;
         tree->sentinel = s;
         tree->insert = i;
+        tree->leftmost = s;
     }
 }
 
@@ -57,9 +60,14 @@ rbtree_insert(_xvolatile rbtree_t *tree,
         node->right = sentinel;
         rbtree_black(node);
         *root = node;
+        tree->leftmost = node;
         return;
     }
     tree->insert(*root, node, sentinel);
+    //a new leaf is the smallest only as the left child of the old smallest
+    if (node->parent == tree->leftmost && node == node->parent->left) {
+        tree->leftmost = node;
+    }
     /* re-balance tree */
     while (node != *root && rbtree_is_red(node->parent)) {
         if (node->parent == node->parent->parent->left) {
@@ -178,6 +186,10 @@ rbtree_delete(_xvolatile rbtree_t *tree,
 
     root = (rbtree_node_t **) &tree->root;
     sentinel = tree->sentinel;
+    if (node == tree->leftmost) {
+        subst = rbtree_next(tree, node);
+        tree->leftmost = subst ? subst : sentinel;
+    }
     if (node->left == sentinel) {
         temp = node->right;
         subst = node;
@@ -194,6 +206,8 @@ rbtree_delete(_xvolatile rbtree_t *tree,
     }
     if (subst == *root) {
         *root = temp;
+        //next and prev stop at a NULL parent
+        temp->parent = NULL;
         rbtree_black(temp);
         /* DEBUG stuff */
         node->left = NULL;
@@ -369,3 +383,127 @@ rbtree_min(rbtree_node_t *node, rbtree_node_t *sentinel)
     return node;
 }
 
+
+rbtree_node_t *
+rbtree_last(_xvolatile rbtree_t *tree)
+{
+    rbtree_node_t  *node = tree->root;
+
+    if (node == tree->sentinel) {
+        return NULL;
+    }
+    while (node->right != tree->sentinel) {
+        node = node->right;
+    }
+
+    return node;
+}
+
+rbtree_node_t *
+rbtree_next(_xvolatile rbtree_t *tree, rbtree_node_t *node)
+{
+    rbtree_node_t  *parent;
+
+    if (node->right != tree->sentinel) {
+        return rbtree_min(node->right, tree->sentinel);
+    }
+    for (parent = node->parent; parent && node == parent->right;
+         parent = parent->parent)
+    {
+        node = parent;
+    }
+
+    return parent;
+}
+
+rbtree_node_t *
+rbtree_prev(_xvolatile rbtree_t *tree, rbtree_node_t *node)
+{
+    rbtree_node_t  *parent;
+
+    if (node->left != tree->sentinel) {
+        node = node->left;
+        while (node->right != tree->sentinel) {
+            node = node->right;
+        }
+        return node;
+    }
+    for (parent = node->parent; parent && node == parent->left;
+         parent = parent->parent)
+    {
+        node = parent;
+    }
+
+    return parent;
+}
+
+rbtree_node_t *
+rbtree_lower_bound(_xvolatile rbtree_t *tree, const void *key,
+    rbtree_cmp_pt cmp)
+{
+    rbtree_node_t  *node = tree->root, *found = NULL;
+
+    while (node != tree->sentinel) {
+        if (rbtree_cmp(node, key, cmp) >= 0) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+rbtree_node_t *
+rbtree_upper_bound(_xvolatile rbtree_t *tree, const void *key,
+    rbtree_cmp_pt cmp)
+{
+    rbtree_node_t  *node = tree->root, *found = NULL;
+
+    while (node != tree->sentinel) {
+        if (rbtree_cmp(node, key, cmp) > 0) {
+            found = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+size_t
+rbtree_range(_xvolatile rbtree_t *tree, const void *low, const void *high,
+    rbtree_cmp_pt cmp, rbtree_walk_pt walk, void *data)
+{
+    rbtree_node_t  *node, *next;
+    size_t          n = 0;
+
+    node = low ? rbtree_lower_bound(tree, low, cmp) : rbtree_first(tree);
+    for ( ; node; node = next) {
+        if (high && rbtree_cmp(node, high, cmp) >= 0) {
+            break;
+        }
+        next = rbtree_next(tree, node);
+        n++;
+        if (walk && walk(node, data)) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+static _xinline int
+rbtree_cmp(rbtree_node_t *node, const void *key, rbtree_cmp_pt cmp)
+{
+    rbtree_key  k;
+
+    if (cmp) {
+        return cmp(node, key);
+    }
+    k = *(const rbtree_key *)key;
+
+    return node->key < k ? -1 : node->key > k;
+}
@@ -24,11 +24,20 @@ struct rbtree_node_s {
 
 typedef void (*rbtree_insert_pt) (rbtree_node_t *root,
     rbtree_node_t *node, rbtree_node_t *sentinel);
+/*
+ * orders node against key: < 0 if node comes first, 0 if equal. key is
+ * whatever the tree is ordered by, a NULL compare takes it as a
+ * rbtree_key * and compares node->key
+ */
+typedef int  (*rbtree_cmp_pt) (rbtree_node_t *node, const void *key);
+//non zero stops the walk
+typedef int  (*rbtree_walk_pt) (rbtree_node_t *node, void *data);
 
 typedef struct rbtree_s {
     rbtree_node_t    *root;
     rbtree_node_t    *sentinel;
     rbtree_insert_pt  insert;
+    rbtree_node_t    *leftmost;   // the sentinel if empty
 } rbtree_t;
 
 void rbtree_init(_xvolatile rbtree_t *tree, rbtree_node_t *s, rbtree_insert_pt i);
@@ -41,6 +50,29 @@ void rbtree_insert_timer_value(rbtree_node_t *root,
     rbtree_node_t *node, rbtree_node_t *sentinel);
 rbtree_node_t *rbtree_min(rbtree_node_t *node, rbtree_node_t *sentinel);
 
+/*
+ * ordered walk, NULL past either end. the smallest node is kept by
+ * insert and delete, rbtree_first does not walk
+ */
+#define rbtree_first(tree) \
+    ((tree)->leftmost == (tree)->sentinel ? NULL : (tree)->leftmost)
+rbtree_node_t *rbtree_last(_xvolatile rbtree_t *tree);
+rbtree_node_t *rbtree_next(_xvolatile rbtree_t *tree, rbtree_node_t *node);
+rbtree_node_t *rbtree_prev(_xvolatile rbtree_t *tree, rbtree_node_t *node);
+//the first node not before key, or NULL
+rbtree_node_t *rbtree_lower_bound(_xvolatile rbtree_t *tree, const void *key,
+    rbtree_cmp_pt cmp);
+//the first node after key, or NULL
+rbtree_node_t *rbtree_upper_bound(_xvolatile rbtree_t *tree, const void *key,
+    rbtree_cmp_pt cmp);
+/*
+ * calls walk on the nodes from low up to, not including, high in order,
+ * a NULL high goes to the end. the walk must not delete the node it is
+ * given. returns the number of nodes walked
+ */
+size_t rbtree_range(_xvolatile rbtree_t *tree, const void *low,
+    const void *high, rbtree_cmp_pt cmp, rbtree_walk_pt walk, void *data);
+
 #define rbtree_red(node)          ((node)->color = RBTREE_COLOR_RED)
 #define rbtree_black(node)        ((node)->color = RBTREE_COLOR_BLACK)
 #define rbtree_is_red(node)       ((node)->color == RBTREE_COLOR_RED)
@@ -0,0 +1,339 @@
+#include "fast_ring.h"
+#include "fast_memory.h"
+
+/*
+ * the __sync builtins only know full barriers, an index handed to the
+ * other side needs no more than release on store and acquire on load
+ */
+#define fast_ring_load(p)       __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define fast_ring_store(p, v)   __atomic_store_n(p, v, __ATOMIC_RELEASE)
+//an index the claim checks anyway
+#define fast_ring_peek(p)       __atomic_load_n(p, __ATOMIC_RELAXED)
+
+#define fast_ring_slot(ring, pos) \
+    ((ring)->slots + ((pos) & (ring)->mask) * (ring)->slot_size)
+
+//mpmc slots: the sequence, then the element
+typedef struct fast_ring_cell_s {
+    volatile size_t     seq;
+    uchar_t             data[];
+} fast_ring_cell_t;
+
+#define fast_ring_cell(ring, pos) \
+    ((fast_ring_cell_t *)fast_ring_slot(ring, pos))
+
+static size_t fast_ring_capacity_round(size_t capacity);
+static size_t fast_ring_slot_size(int type, size_t elt_size);
+
+size_t
+fast_ring_size(int type, size_t capacity, size_t elt_size)
+{
+    if ((type != FAST_RING_SPSC && type != FAST_RING_MPMC) || !elt_size) {
+        return 0;
+    }
+    capacity = fast_ring_capacity_round(capacity);
+    if (!capacity) {
+        return 0;
+    }
+    return sizeof(fast_ring_t) + capacity * fast_ring_slot_size(type, elt_size);
+}
+
+fast_ring_t *
+fast_ring_init(void *mem, int type, size_t capacity, size_t elt_size)
+{
+    fast_ring_t    *ring = mem;
+    size_t          size, i;
+
+    size = fast_ring_size(type, capacity, elt_size);
+    if (!mem || !size || ((uintptr_t)mem & (DEFAULT_CACHELINE_SIZE - 1))) {
+        return NULL;
+    }
+
+    memory_zero(ring, sizeof(fast_ring_t));
+    ring->mask = fast_ring_capacity_round(capacity) - 1;
+    ring->elt_size = elt_size;
+    ring->slot_size = fast_ring_slot_size(type, elt_size);
+    ring->size = size;
+    ring->type = type;
+
+    if (type == FAST_RING_MPMC) {
+        //slot i waits for the producer of turn i
+        for (i = 0; i <= ring->mask; i++) {
+            fast_ring_cell(ring, i)->seq = i;
+        }
+    }
+    __sync_synchronize();
+
+    return ring;
+}
+
+fast_ring_t *
+fast_ring_create(int type, size_t capacity, size_t elt_size,
+    fast_mem_allocator_t *allocator)
+{
+    fast_ring_t    *ring;
+    void           *mem;
+    unsigned int    err_no;
+    size_t          size;
+
+    size = fast_ring_size(type, capacity, elt_size);
+    if (!size) {
+        return NULL;
+    }
+    if (allocator) {
+        mem = fast_mem_allocator_memalign(allocator, DEFAULT_CACHELINE_SIZE,
+            size, &err_no);
+    } else {
+        mem = memory_memalign(DEFAULT_CACHELINE_SIZE, size);
+    }
+    if (!mem) {
+        return NULL;
+    }
+
+    ring = fast_ring_init(mem, type, capacity, elt_size);
+    ring->allocator = allocator;
+
+    return ring;
+}
+
+void
+fast_ring_free(fast_ring_t *ring)
+{
+    unsigned int    err_no;
+
+    if (!ring) {
+        return;
+    }
+    if (ring->allocator) {
+        fast_mem_allocator_memalign_free(ring->allocator, ring, &err_no);
+    } else {
+        memory_free(ring, 0);
+    }
+}
+
+int
+fast_ring_spsc_push(fast_ring_t *ring, const void *elt)
+{
+    size_t  tail = ring->tail;
+
+    if (tail - ring->head_cache > ring->mask) {
+        ring->head_cache = fast_ring_load(&ring->head);
+        if (tail - ring->head_cache > ring->mask) {
+            return FAST_RING_FULL;
+        }
+    }
+    memcpy(fast_ring_slot(ring, tail), elt, ring->elt_size);
+    fast_ring_store(&ring->tail, tail + 1);
+
+    return FAST_RING_OK;
+}
+
+int
+fast_ring_spsc_pop(fast_ring_t *ring, void *elt)
+{
+    size_t  head = ring->head;
+
+    if (head == ring->tail_cache) {
+        ring->tail_cache = fast_ring_load(&ring->tail);
+        if (head == ring->tail_cache) {
+            return FAST_RING_EMPTY;
+        }
+    }
+    memcpy(elt, fast_ring_slot(ring, head), ring->elt_size);
+    fast_ring_store(&ring->head, head + 1);
+
+    return FAST_RING_OK;
+}
+
+size_t
+fast_ring_spsc_push_n(fast_ring_t *ring, const void *elts, size_t n)
+{
+    const uchar_t  *src = elts;
+    size_t          tail = ring->tail, room, i;
+
+    room = ring->mask + 1 - (tail - ring->head_cache);
+    if (room < n) {
+        ring->head_cache = fast_ring_load(&ring->head);
+        room = ring->mask + 1 - (tail - ring->head_cache);
+    }
+    if (n > room) {
+        n = room;
+    }
+    for (i = 0; i < n; i++) {
+        memcpy(fast_ring_slot(ring, tail + i), src, ring->elt_size);
+        src += ring->elt_size;
+    }
+    if (n) {
+        fast_ring_store(&ring->tail, tail + n);
+    }
+
+    return n;
+}
+
+size_t
+fast_ring_spsc_pop_n(fast_ring_t *ring, void *elts, size_t n)
+{
+    uchar_t    *dst = elts;
+    size_t      head = ring->head, ready, i;
+
+    ready = ring->tail_cache - head;
+    if (ready < n) {
+        ring->tail_cache = fast_ring_load(&ring->tail);
+        ready = ring->tail_cache - head;
+    }
+    if (n > ready) {
+        n = ready;
+    }
+    for (i = 0; i < n; i++) {
+        memcpy(dst, fast_ring_slot(ring, head + i), ring->elt_size);
+        dst += ring->elt_size;
+    }
+    if (n) {
+        fast_ring_store(&ring->head, head + n);
+    }
+
+    return n;
+}
+
+int
+fast_ring_mpmc_push(fast_ring_t *ring, const void *elt)
+{
+    return fast_ring_mpmc_push_n(ring, elt, 1) ? FAST_RING_OK
+                                               : FAST_RING_FULL;
+}
+
+int
+fast_ring_mpmc_pop(fast_ring_t *ring, void *elt)
+{
+    return fast_ring_mpmc_pop_n(ring, elt, 1) ? FAST_RING_OK
+                                              : FAST_RING_EMPTY;
+}
+
+/*
+ * the slots from tail on whose sequence says it is their turn are free
+ * for this round: no other producer gets them without moving tail past
+ * pos first, which fails the claim
+ */
+size_t
+fast_ring_mpmc_push_n(fast_ring_t *ring, const void *elts, size_t n)
+{
+    fast_ring_cell_t   *cell;
+    const uchar_t      *src = elts;
+    size_t              pos, k, i;
+    intptr_t            dif;
+
+    if (!n) {
+        return 0;
+    }
+    if (n > ring->mask + 1) {
+        n = ring->mask + 1;
+    }
+
+    pos = fast_ring_peek(&ring->tail);
+    for ( ;; ) {
+        cell = fast_ring_cell(ring, pos);
+        dif = (intptr_t)fast_ring_load(&cell->seq) - (intptr_t)pos;
+        if (dif < 0) {
+            //a round behind: the consumer has not freed it, full
+            return 0;
+        }
+        if (dif > 0) {
+            //another producer took it, start over from where they got
+            pos = fast_ring_peek(&ring->tail);
+            continue;
+        }
+        for (k = 1; k < n; k++) {
+            cell = fast_ring_cell(ring, pos + k);
+            if (fast_ring_load(&cell->seq) != pos + k) {
+                break;
+            }
+        }
+        if (__sync_bool_compare_and_swap(&ring->tail, pos, pos + k)) {
+            break;
+        }
+        pos = fast_ring_peek(&ring->tail);
+    }
+
+    for (i = 0; i < k; i++) {
+        cell = fast_ring_cell(ring, pos + i);
+        memcpy(cell->data, src, ring->elt_size);
+        src += ring->elt_size;
+        fast_ring_store(&cell->seq, pos + i + 1);
+    }
+
+    return k;
+}
+
+size_t
+fast_ring_mpmc_pop_n(fast_ring_t *ring, void *elts, size_t n)
+{
+    fast_ring_cell_t   *cell;
+    uchar_t            *dst = elts;
+    size_t              pos, k, i;
+    intptr_t            dif;
+
+    if (!n) {
+        return 0;
+    }
+    if (n > ring->mask + 1) {
+        n = ring->mask + 1;
+    }
+
+    pos = fast_ring_peek(&ring->head);
+    for ( ;; ) {
+        cell = fast_ring_cell(ring, pos);
+        dif = (intptr_t)fast_ring_load(&cell->seq) - (intptr_t)(pos + 1);
+        if (dif < 0) {
+            //not filled in this round, empty
+            return 0;
+        }
+        if (dif > 0) {
+            pos = fast_ring_peek(&ring->head);
+            continue;
+        }
+        for (k = 1; k < n; k++) {
+            cell = fast_ring_cell(ring, pos + k);
+            if (fast_ring_load(&cell->seq) != pos + k + 1) {
+                break;
+            }
+        }
+        if (__sync_bool_compare_and_swap(&ring->head, pos, pos + k)) {
+            break;
+        }
+        pos = fast_ring_peek(&ring->head);
+    }
+
+    for (i = 0; i < k; i++) {
+        cell = fast_ring_cell(ring, pos + i);
+        memcpy(dst, cell->data, ring->elt_size);
+        dst += ring->elt_size;
+        //free for the producer of the next round
+        fast_ring_store(&cell->seq, pos + i + ring->mask + 1);
+    }
+
+    return k;
+}
+
+static size_t
+fast_ring_capacity_round(size_t capacity)
+{
+    size_t  n = 2;
+
+    while (n < capacity) {
+        if (n > ((size_t)-1 >> 2)) {
+            return 0;
+        }
+        n <<= 1;
+    }
+    return n;
+}
+
+static size_t
+fast_ring_slot_size(int type, size_t elt_size)
+{
+    elt_size = (elt_size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+    if (type == FAST_RING_MPMC) {
+        return sizeof(fast_ring_cell_t) + elt_size;
+    }
+    return elt_size;
+}
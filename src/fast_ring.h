@@ -0,0 +1,82 @@
+#ifndef _FAST_RING_H
+#define _FAST_RING_H
+
+#include "fast_types.h"
+#include "fast_memory_pool.h"
+#include "fast_mem_allocator.h"
+
+/*
+ * bounded lock free rings of fixed size elements, copied in and out.
+ * the capacity is a power of 2, head and tail live on lines of their own
+ * and the ring holds no pointer: fast_ring_init places it in any cache
+ * line aligned memory, a fast_shmem region shared by forked processes
+ * as well as the heap.
+ *
+ * FAST_RING_SPSC: one producer, one consumer, both wait free. each side
+ * keeps a copy of the other's index and only reads the real one when
+ * the copy says full or empty.
+ *
+ * FAST_RING_MPMC: any number of both, Vyukov's bounded queue. a slot
+ * carries a sequence telling whose turn it is, producers and consumers
+ * claim slots with a compare and swap on tail or head and never wait on
+ * each other's copy, only on a slot the other side has claimed and not
+ * yet finished with.
+ *
+ * the _n calls move up to n elements with one claim and return how many
+ * they moved.
+ */
+
+#define FAST_RING_OK            (0)
+#define FAST_RING_ERROR         (-1)
+#define FAST_RING_FULL          (1)
+#define FAST_RING_EMPTY         (2)
+
+#define FAST_RING_SPSC          1
+#define FAST_RING_MPMC          2
+
+typedef struct fast_ring_s {
+    //the consumer's line
+    volatile size_t         head;
+    size_t                  tail_cache;   // spsc: tail as last read
+    char                    pad0[DEFAULT_CACHELINE_SIZE - 2 * sizeof(size_t)];
+    //the producer's line
+    volatile size_t         tail;
+    size_t                  head_cache;   // spsc: head as last read
+    char                    pad1[DEFAULT_CACHELINE_SIZE - 2 * sizeof(size_t)];
+    //read only once made
+    size_t                  mask;
+    size_t                  elt_size;
+    size_t                  slot_size;
+    size_t                  size;         // bytes, with the slots
+    fast_mem_allocator_t   *allocator;    // set by fast_ring_create
+    int                     type;
+    char                    pad2[DEFAULT_CACHELINE_SIZE - 5 * sizeof(size_t)
+                                 - sizeof(int)];
+    uchar_t                 slots[];
+} fast_ring_t;
+
+//bytes a ring of capacity elements takes, capacity rounded up to 2^n
+size_t fast_ring_size(int type, size_t capacity, size_t elt_size);
+//mem of fast_ring_size bytes on a cache line
+fast_ring_t *fast_ring_init(void *mem, int type, size_t capacity,
+    size_t elt_size);
+//allocator NULL for memory_memalign
+fast_ring_t *fast_ring_create(int type, size_t capacity, size_t elt_size,
+    fast_mem_allocator_t *allocator);
+void fast_ring_free(fast_ring_t *ring);
+
+int    fast_ring_spsc_push(fast_ring_t *ring, const void *elt);
+int    fast_ring_spsc_pop(fast_ring_t *ring, void *elt);
+size_t fast_ring_spsc_push_n(fast_ring_t *ring, const void *elts, size_t n);
+size_t fast_ring_spsc_pop_n(fast_ring_t *ring, void *elts, size_t n);
+
+int    fast_ring_mpmc_push(fast_ring_t *ring, const void *elt);
+int    fast_ring_mpmc_pop(fast_ring_t *ring, void *elt);
+size_t fast_ring_mpmc_push_n(fast_ring_t *ring, const void *elts, size_t n);
+size_t fast_ring_mpmc_pop_n(fast_ring_t *ring, void *elts, size_t n);
+
+//a snapshot, stale as soon as read when the other side runs
+#define fast_ring_count(ring)    ((ring)->tail - (ring)->head)
+#define fast_ring_capacity(ring) ((ring)->mask + 1)
+
+#endif
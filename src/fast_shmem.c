@@ -2,6 +2,25 @@
 #include "fast_shmem.h"
 #include "fast_math.h"
 #include "fast_memory.h"
+#include "fast_mem_governor.h"
+
+#include <sys/syscall.h>
+
+#define fast_shmem_free_nodes(shm) \
+    ((struct free_node *)((uchar_t *)(shm) + (shm)->free_off))
+
+#define fast_shmem_arenas(shm) \
+    ((fast_shmem_arena_t *)((uchar_t *)(shm) + (shm)->arena_off))
+
+typedef struct fast_shmem_layout_s {
+    size_t               total_size;
+    size_t               min_size;
+    size_t               max_size;
+    size_t               factor;
+    size_t               free_len;
+    size_t               system_size;
+    int                  level_type;
+} fast_shmem_layout_t;
 
 static const char* fast_shmem_err_string[] = {
     "fast_shmem: unknown error number",
@@ -14,6 +33,7 @@ static const char* fast_shmem_err_string[] = {
     "fast_shmem_create: total size is not enough",
     "fast_shmem_create: mmap failed",
     "fast_shmem_create: storage size less than maxsize",
+    "fast_shmem_create: open or size backing object failed",
     //for fast_shmem_release 
     "fast_shmem_release: shmem instance is null",
     "fast_shmem_release: munmap failed",
@@ -38,6 +58,25 @@ static const char* fast_shmem_err_string[] = {
     "fast_shmem_free: free a non-alloced address",
     "fast_shmem_free: remove the next storage failed",
     "fast_shmem_free: remove the previous storage failed",
+    //for fast_shmem_attach
+    "fast_shmem_attach: parameter error",
+    "fast_shmem_attach: open backing object failed",
+    "fast_shmem_attach: backing object size error",
+    "fast_shmem_attach: mmap failed",
+    "fast_shmem_attach: bad magic number",
+    "fast_shmem_attach: version mismatch",
+    "fast_shmem_attach: header layout mismatch",
+    //for fast_shmem_unlink
+    "fast_shmem_unlink: unlink backing object failed",
+    //for fast_shmem_arenas_create
+    "fast_shmem_arenas_create: parameter error",
+    "fast_shmem_arenas_create: arenas already created",
+    "fast_shmem_arenas_create: carve arena from region failed",
+    //for fast_shmem_realloc
+    "fast_shmem_realloc: parameter error",
+    "fast_shmem_realloc: realloc a non-alloced address",
+    //for fast_shmem_memalign
+    "fast_shmem_memalign: alignment is not a power of 2",
     NULL
 };
 size_t fast_shmem_get_storage_size(fast_shmem_t *shm)
@@ -109,138 +148,350 @@ static size_t fast_shmem_get_insert_index(fast_shmem_t *shm, size_t size)
     return id;
 }
 
+static int
+fast_shmem_open_backing(fast_shmem_backing_t *backing, int create)
+{
+    int flags = create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR;
+
+    switch (backing->type) {
+    case FAST_SHMEM_BACKING_MEMFD:
+        if (!create) {
+            return backing->fd;
+        }
+#if defined(SYS_memfd_create)
+        return (int)syscall(SYS_memfd_create,
+            backing->name ? backing->name : "fast_shmem", 0);
+#else
+        return -1;
+#endif
+    case FAST_SHMEM_BACKING_SHM:
+        return backing->name ? shm_open(backing->name, flags, 0600) : -1;
+    case FAST_SHMEM_BACKING_FILE:
+        return backing->name ? open(backing->name, flags, 0600) : -1;
+    }
+
+    return -1;
+}
+
 fast_shmem_t*
 fast_shmem_create(size_t size, size_t min_size, size_t max_size,
     int level_type, size_t factor, unsigned int *shmem_errno)
 {
-    fast_shmem_t         *shm;
-    size_t               free_len;
+    return fast_shmem_create_named(size, min_size, max_size,
+        level_type, factor, NULL, shmem_errno);
+}
+
+/*
+ * check the sizes and work out the layout of a heap of total_size bytes,
+ * before any memory is touched
+ */
+static int
+fast_shmem_layout_calc(fast_shmem_layout_t *layout, unsigned int *shmem_errno)
+{
     size_t               power;
-    size_t               total_size = 0;
-    size_t               i = 0;
-    size_t               system_size;
+    size_t               free_len;
     size_t               free_size;
-    struct storage      *st = NULL;
-    
-    *shmem_errno = FAST_SHMEM_ERR_NONE;
-    if (!size) {
-        *shmem_errno = FAST_SHMEM_ERR_CREATE_SIZE;
-        return NULL;
-    }
-    
-    min_size = FAST_MATH_ALIGNMENT(min_size, FAST_MATH_ALIGN_SIZE);
-    max_size = FAST_MATH_ALIGNMENT(max_size, FAST_MATH_ALIGN_SIZE);
-    if (!min_size || min_size >= max_size) {
+    size_t               system_size;
+
+    layout->min_size = FAST_MATH_ALIGNMENT(layout->min_size,
+        FAST_MATH_ALIGN_SIZE);
+    layout->max_size = FAST_MATH_ALIGNMENT(layout->max_size,
+        FAST_MATH_ALIGN_SIZE);
+    if (!layout->min_size || layout->min_size >= layout->max_size) {
         *shmem_errno = FAST_SHMEM_ERR_CREATE_MINSIZE;
-    	return NULL;
+    	return FAST_SHMEM_ERROR;
     }
     
     //init factor and free_len
-    if (level_type == FAST_SHMEM_LEVEL_TYPE_LINEAR) {
-        factor = FAST_MATH_ALIGNMENT(factor, FAST_MATH_ALIGN_SIZE);
-	    free_len = (max_size - min_size) / factor;
-        if ((max_size - min_size) % factor) {
+    if (layout->level_type == FAST_SHMEM_LEVEL_TYPE_LINEAR) {
+        layout->factor = FAST_MATH_ALIGNMENT(layout->factor,
+            FAST_MATH_ALIGN_SIZE);
+	    free_len = (layout->max_size - layout->min_size) / layout->factor;
+        if ((layout->max_size - layout->min_size) % layout->factor) {
             free_len++;
         }
-    } else if (level_type == FAST_SHMEM_LEVEL_TYPE_EXP) {
-        factor = FAST_SHMEM_EXP_FACTOR;
-        power = max_size / min_size;
-        if (max_size % min_size) {
+    } else if (layout->level_type == FAST_SHMEM_LEVEL_TYPE_EXP) {
+        layout->factor = FAST_SHMEM_EXP_FACTOR;
+        power = layout->max_size / layout->min_size;
+        if (layout->max_size % layout->min_size) {
             power++;
         }
 	    free_len = fast_math_fastlog2(power, 1);
     } else {
         *shmem_errno = FAST_SHMEM_ERR_CREATE_LEVELTYPE;
-	    return NULL;
+	    return FAST_SHMEM_ERROR;
     }
     if (!free_len) {
         *shmem_errno = FAST_SHMEM_ERR_CREATE_FREELEN;
-    	return NULL;
+    	return FAST_SHMEM_ERROR;
     }
-    
     free_len++;
-    //creat shmem
-    total_size = FAST_MATH_ROUND_UP(size, FAST_PAGE_SIZE);
-    if (!total_size) {
-        *shmem_errno = FAST_SHMEM_ERR_CREATE_TOTALSIZE;
-        return NULL;
-    }
-    shm = (fast_shmem_t*)mmap(NULL, total_size,
-        PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
 
-    if ((void*)shm == MAP_FAILED) {
-        *shmem_errno = FAST_SHMEM_ERR_CREATE_MMAP;
-        return NULL;
+    free_size = sizeof(struct free_node) * free_len;
+    system_size = sizeof(fast_shmem_t);
+    if (free_size + system_size + sizeof(struct storage)
+        >= layout->total_size) {
+        *shmem_errno = FAST_SHMEM_ERR_CREATE_TOTALSIZE_NOT_ENOUGH;
+        return FAST_SHMEM_ERROR;
     }
-   
+    system_size += free_size;
+    system_size = FAST_MATH_ALIGNMENT(system_size, FAST_MATH_ALIGN_SIZE);
+    if (layout->total_size - system_size - sizeof(struct storage)
+        < layout->max_size) {
+        *shmem_errno = FAST_SHMEM_ERR_CREATE_STORAGESIZE;
+        return FAST_SHMEM_ERROR;
+    }
+
+    layout->free_len = free_len;
+    layout->system_size = system_size;
+
+    return FAST_SHMEM_OK;
+}
+
+//build an empty heap on addr according to a checked layout
+static fast_shmem_t *
+fast_shmem_layout_init(void *addr, fast_shmem_layout_t *layout)
+{
+    fast_shmem_t         *shm = addr;
+    struct free_node     *free;
+    struct storage       *st;
+    size_t                i;
+
+    memory_zero(shm, sizeof(fast_shmem_t));
+
     //init
-    shm->split_threshold = min_size;
-    shm->min_size = min_size;
-    shm->max_size = max_size;
-    shm->factor = factor; 
-    shm->free_len = free_len;
-    shm->level_type = level_type;
+    shm->magic = FAST_SHMEM_MAGIC;
+    shm->version = FAST_SHMEM_VERSION;
+    shm->header_size = sizeof(fast_shmem_t);
+    shm->storage_size = sizeof(struct storage);
+    shm->split_threshold = layout->min_size;
+    shm->min_size = layout->min_size;
+    shm->max_size = layout->max_size;
+    shm->factor = layout->factor; 
+    shm->free_len = layout->free_len;
+    shm->level_type = layout->level_type;
+    fast_atomic_lock_init(&shm->lock);
 
     //init free nodes
-    free_size = sizeof(struct free_node) * shm->free_len;
-    system_size = sizeof(fast_shmem_t);
-    if (free_size + system_size + sizeof(struct storage) >= total_size) {
-        munmap(shm, total_size);
-        *shmem_errno = FAST_SHMEM_ERR_CREATE_TOTALSIZE_NOT_ENOUGH;
-        return NULL;
-    }
-    shm->free = (struct free_node *)((char *)shm + system_size);
+    shm->free_off = sizeof(fast_shmem_t);
+    free = fast_shmem_free_nodes(shm);
     for (i = 0; i < shm->free_len; i++) {
-        shm->free[i].index = i;
-        queue_init(&shm->free[i].free_list_head);
+        free[i].index = i;
+        oqueue_init(shm, &free[i].free_list_head);
     }
 
     //init system size and used size
-    system_size += free_size;
-    system_size = FAST_MATH_ALIGNMENT(system_size, FAST_MATH_ALIGN_SIZE);
-    shm->shmem_stat.total_size = total_size;
-    shm->shmem_stat.reqs_size = 0;
+    shm->shmem_stat.total_size = layout->total_size;
     shm->shmem_stat.st_count = 1;
-    shm->shmem_stat.used_size = 0;
-    shm->shmem_stat.system_size = system_size;
+    shm->shmem_stat.system_size = layout->system_size;
 
     //init the first storage
-    st = (struct storage *)((unsigned char *)shm + system_size);
-    st->size = total_size - system_size - sizeof(struct storage);
+    st = (struct storage *)((unsigned char *)shm + layout->system_size);
+    st->size = layout->total_size - layout->system_size
+        - sizeof(struct storage);
     st->alloc = 0;
-    if (st->size < max_size) {
-        munmap(shm, total_size);
-        *shmem_errno = FAST_SHMEM_ERR_CREATE_STORAGESIZE;
-        return NULL;
-    }
+
     //insert st to order
-    queue_init(&shm->order);
-    queue_insert_head(&shm->order, &st->order_entry);
+    oqueue_init(shm, &shm->order);
+    oqueue_insert_head(shm, &shm->order, &st->order_entry);
     
     //insert st to free node
     i = fast_shmem_get_insert_index(shm, st->size);
     if (i >= shm->free_len) {
     	i = shm->free_len - 1;
     }
-    st->free_list_head = &shm->free[i].free_list_head;
-    queue_insert_head(&shm->free[i].free_list_head, &st->free_entry);
+    st->free_index = i;
+    oqueue_insert_head(shm, &free[i].free_list_head, &st->free_entry);
 
     //insert free node to available
-    queue_init(&shm->available);
-    queue_insert_head(&shm->available, &shm->free[i].available_entry);
+    oqueue_init(shm, &shm->available);
+    oqueue_insert_head(shm, &shm->available, &free[i].available_entry);
     shm->max_available_index = i;
     
     return shm;
 }
 
+fast_shmem_t*
+fast_shmem_create_named(size_t size, size_t min_size, size_t max_size,
+    int level_type, size_t factor, fast_shmem_backing_t *backing,
+    unsigned int *shmem_errno)
+{
+    void                 *addr;
+    fast_shmem_layout_t   layout;
+    int                   fd = -1;
+    
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!size) {
+        *shmem_errno = FAST_SHMEM_ERR_CREATE_SIZE;
+        return NULL;
+    }
+    
+    layout.total_size = FAST_MATH_ROUND_UP(size, FAST_PAGE_SIZE);
+    if (!layout.total_size) {
+        *shmem_errno = FAST_SHMEM_ERR_CREATE_TOTALSIZE;
+        return NULL;
+    }
+    layout.min_size = min_size;
+    layout.max_size = max_size;
+    layout.level_type = level_type;
+    layout.factor = factor;
+
+    //check the layout before the backing object is touched
+    if (fast_shmem_layout_calc(&layout, shmem_errno) == FAST_SHMEM_ERROR) {
+        return NULL;
+    }
+
+    //creat shmem
+    if (backing && backing->type != FAST_SHMEM_BACKING_ANON) {
+        fd = fast_shmem_open_backing(backing, 1);
+        if (fd == -1 || ftruncate(fd, layout.total_size) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            *shmem_errno = FAST_SHMEM_ERR_CREATE_BACKING;
+            return NULL;
+        }
+        addr = mmap(NULL, layout.total_size,
+            PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    } else {
+        addr = mmap(NULL, layout.total_size,
+            PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+    }
+
+    if (addr == MAP_FAILED) {
+        if (fd != -1) {
+            close(fd);
+        }
+        *shmem_errno = FAST_SHMEM_ERR_CREATE_MMAP;
+        return NULL;
+    }
+    //memfd has no name to reopen, its fd is handed to the caller
+    if (fd != -1) {
+        if (backing->type == FAST_SHMEM_BACKING_MEMFD) {
+            backing->fd = fd;
+        } else {
+            close(fd);
+        }
+    }
+   
+    mem_governor_charge(layout.total_size);
+
+    return fast_shmem_layout_init(addr, &layout);
+}
+
+fast_shmem_t*
+fast_shmem_attach(fast_shmem_backing_t *backing, unsigned int *shmem_errno)
+{
+    fast_shmem_t        *shm;
+    struct stat          stat;
+    int                  fd;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!backing || backing->type == FAST_SHMEM_BACKING_ANON) {
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_PARAM;
+        return NULL;
+    }
+
+    fd = fast_shmem_open_backing(backing, 0);
+    if (fd == -1) {
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_OPEN;
+        return NULL;
+    }
+    if (fstat(fd, &stat) == -1
+        || (size_t)stat.st_size < sizeof(fast_shmem_t)) {
+        if (backing->type != FAST_SHMEM_BACKING_MEMFD) {
+            close(fd);
+        }
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_SIZE;
+        return NULL;
+    }
+    shm = (fast_shmem_t*)mmap(NULL, stat.st_size,
+        PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (backing->type != FAST_SHMEM_BACKING_MEMFD) {
+        close(fd);
+    }
+    if ((void*)shm == MAP_FAILED) {
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_MMAP;
+        return NULL;
+    }
+
+    if (shm->magic != FAST_SHMEM_MAGIC) {
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_MAGIC;
+    } else if (shm->version != FAST_SHMEM_VERSION) {
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_VERSION;
+    } else if (shm->header_size != sizeof(fast_shmem_t)
+        || shm->storage_size != sizeof(struct storage)
+        || shm->shmem_stat.total_size != (size_t)stat.st_size) {
+        *shmem_errno = FAST_SHMEM_ERR_ATTACH_LAYOUT;
+    }
+    if (*shmem_errno != FAST_SHMEM_ERR_NONE) {
+        munmap(shm, stat.st_size);
+        return NULL;
+    }
+
+    __sync_fetch_and_add(&shm->generation, 1);
+    mem_governor_charge(stat.st_size);
+
+    return shm;
+}
+
+int fast_shmem_unlink(fast_shmem_backing_t *backing, unsigned int *shmem_errno)
+{
+    int rc = 0;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!backing) {
+        *shmem_errno = FAST_SHMEM_ERR_UNLINK;
+        return FAST_SHMEM_ERROR;
+    }
+
+    switch (backing->type) {
+    case FAST_SHMEM_BACKING_MEMFD:
+        if (backing->fd != -1) {
+            rc = close(backing->fd);
+            backing->fd = -1;
+        }
+        break;
+    case FAST_SHMEM_BACKING_SHM:
+        rc = backing->name ? shm_unlink(backing->name) : -1;
+        break;
+    case FAST_SHMEM_BACKING_FILE:
+        rc = backing->name ? unlink(backing->name) : -1;
+        break;
+    }
+    if (rc == -1) {
+        *shmem_errno = FAST_SHMEM_ERR_UNLINK;
+        return FAST_SHMEM_ERROR;
+    }
+    return FAST_SHMEM_OK;
+}
+
+int fast_shmem_set_root(fast_shmem_t *shm, void *root)
+{
+    if (!shm) {
+        return FAST_SHMEM_ERROR;
+    }
+    shm->root = fast_shmem_offset(shm, root);
+    return FAST_SHMEM_OK;
+}
+
+void *fast_shmem_get_root(fast_shmem_t *shm)
+{
+    return shm ? fast_shmem_addr(shm, shm->root) : NULL;
+}
+
 int fast_shmem_release(fast_shmem_t **shm, unsigned int *shmem_errno)
 {
+    size_t size;
+
     *shmem_errno = FAST_SHMEM_ERR_NONE;
     if (!shm || !*shm) {
         *shmem_errno = FAST_SHMEM_ERR_RELEASE_NULL;     
         return FAST_SHMEM_ERROR;
     }
-    if (!munmap(*shm, (*shm)->shmem_stat.total_size)) {
+    size = (*shm)->shmem_stat.total_size;
+    if (!munmap(*shm, size)) {
+        mem_governor_uncharge(size);
         *shm = NULL;
         return FAST_SHMEM_OK;
     }
@@ -251,21 +502,23 @@ int fast_shmem_release(fast_shmem_t **shm, unsigned int *shmem_errno)
 static int fast_shmem_remove_free(fast_shmem_t *shm, struct storage *st)
 {
     size_t               index = 0;
-    queue_t             *pqueue = NULL;
+    oqueue_t            *pqueue = NULL;
     struct free_node    *free;
+    struct free_node    *node;
 
     index = fast_shmem_get_insert_index(shm, st->size);
     if (index > shm->max_available_index) {
         index = shm->max_available_index;
     }
-    if (st->free_list_head != &shm->free[index].free_list_head) {
+    if (st->free_index != index) {
         return FAST_SHMEM_ERROR;
     }
-    queue_remove(&st->free_entry);
+    oqueue_remove(shm, &st->free_entry);
 
-    if (queue_empty(&shm->free[index].free_list_head)) {
+    node = &fast_shmem_free_nodes(shm)[index];
+    if (oqueue_empty(shm, &node->free_list_head)) {
     	if (index == shm->max_available_index) {
-    	    pqueue = queue_prev(&shm->free[index].available_entry);
+    	    pqueue = oqueue_prev(shm, &node->available_entry);
     	    if (pqueue == &shm->available) {
     	        shm->max_available_index = shm->free_len;	
             } else {
@@ -273,10 +526,10 @@ static int fast_shmem_remove_free(fast_shmem_t *shm, struct storage *st)
                 shm->max_available_index = free->index;
             }
         }
-        queue_remove(&shm->free[index].available_entry);
+        oqueue_remove(shm, &node->available_entry);
     }
 
-    st->free_list_head = NULL;
+    st->free_index = FAST_SHMEM_INVALID_INDEX;
 
     return FAST_SHMEM_OK;
 }
@@ -286,7 +539,7 @@ fast_shmem_insert_free(fast_shmem_t *shm, struct storage *st_free)
 {
     struct free_node *free1;
     struct free_node *free = NULL;
-    queue_t      *q;
+    oqueue_t     *q;
     size_t            index = 0;
     int               flag = 1;
 
@@ -298,31 +551,30 @@ fast_shmem_insert_free(fast_shmem_t *shm, struct storage *st_free)
     if (index > shm->free_len - 1) {
         index = shm->free_len - 1;
     }
-    st_free->free_list_head = &shm->free[index].free_list_head;    
-    free = &shm->free[index];    
+    st_free->free_index = index;
+    free = &fast_shmem_free_nodes(shm)[index];    
     //for free_list
-    if (queue_empty(&shm->free[index].free_list_head)) {
-        //q = queue_next(&free->available_entry);
-        q = queue_head(&shm->available);
+    if (oqueue_empty(shm, &free->free_list_head)) {
+        q = oqueue_head(shm, &shm->available);
         while(1) {
             if (q == &shm->available) {
                 break;
             }
             free1 = queue_data(q, struct free_node, available_entry);
             if (index < free1->index) {
-                queue_insert_before(&free1->available_entry,
+                oqueue_insert_before(shm, &free1->available_entry,
                     &free->available_entry);
                 flag = 0;
                 break;
             }
-            q = queue_next(q);
+            q = oqueue_next(shm, q);
         }
         if (flag) {
-            queue_insert_tail(&shm->available, &free->available_entry);
+            oqueue_insert_tail(shm, &shm->available, &free->available_entry);
             shm->max_available_index = free->index;
         }
     }
-    queue_insert_head(&shm->free[index].free_list_head, &st_free->free_entry);
+    oqueue_insert_head(shm, &free->free_list_head, &st_free->free_entry);
 }
 
 void *fast_shmem_alloc(fast_shmem_t *shm, size_t size, unsigned int *shmem_errno)
@@ -330,8 +582,8 @@ void *fast_shmem_alloc(fast_shmem_t *shm, size_t size, unsigned int *shmem_errno
     struct storage   *st = NULL;
     struct storage   *st_new = NULL;
     struct free_node *free = NULL;
-    queue_t      *q;
-    queue_t      *st_q;
+    oqueue_t     *q;
+    oqueue_t     *st_q;
     int               found_st = 0;
     int               no_free = 1;
     size_t            index = 0;
@@ -351,22 +603,23 @@ void *fast_shmem_alloc(fast_shmem_t *shm, size_t size, unsigned int *shmem_errno
     index = fast_shmem_get_alloc_index(shm, size);
     
     if (index < shm->max_available_index) {
-        free = &shm->free[index];    
-        if (!queue_empty(&free->free_list_head)) {
+        free = &fast_shmem_free_nodes(shm)[index];    
+        if (!oqueue_empty(shm, &free->free_list_head)) {
         	goto DO_COMPARE;
         }
-        q = queue_head(&shm->available);
+        q = oqueue_head(shm, &shm->available);
         while (q != &shm->available) {
             free = queue_data(q, struct free_node, available_entry);
-            if (!queue_empty(&free->free_list_head) && free->index > index) {
+            if (!oqueue_empty(shm, &free->free_list_head)
+                && free->index > index) {
             	no_free = 0;
                 break;
             }
-            q = queue_next(&free->available_entry);
+            q = oqueue_next(shm, &free->available_entry);
         }
     } else {
-        free = &shm->free[shm->max_available_index];
-        if (queue_empty(&free->free_list_head)) {
+        free = &fast_shmem_free_nodes(shm)[shm->max_available_index];
+        if (oqueue_empty(shm, &free->free_list_head)) {
             *shmem_errno = FAST_SHMEM_ERR_ALLOC_MAX_AVAILABLE_EMPTY;
             shm->shmem_stat.failed++;
             return NULL;
@@ -374,7 +627,7 @@ void *fast_shmem_alloc(fast_shmem_t *shm, size_t size, unsigned int *shmem_errno
         goto DO_COMPARE;
     }
     if (no_free) {
-        *shmem_errno = queue_empty(&shm->available) ?
+        *shmem_errno = oqueue_empty(shm, &shm->available) ?
     	    FAST_SHMEM_ERR_ALLOC_NO_AVAILABLE_FREE_LIST :
     	    FAST_SHMEM_ERR_ALLOC_NO_FIXED_FREE_SPACE;
         shm->shmem_stat.failed++;
@@ -382,14 +635,14 @@ void *fast_shmem_alloc(fast_shmem_t *shm, size_t size, unsigned int *shmem_errno
     }
 
 DO_COMPARE:
-    st_q = queue_head(&free->free_list_head);
+    st_q = oqueue_head(shm, &free->free_list_head);
     while (1) {
         st = queue_data(st_q, struct storage, free_entry);
         if (st->size >= size) {
             found_st = 1;
             break;
         }
-        st_q = queue_next(st_q);
+        st_q = oqueue_next(shm, st_q);
         if (&free->free_list_head == st_q) {
             break;
         }
@@ -422,9 +675,7 @@ DO_COMPARE:
     st->alloc = 1;
     st->size = size;
 
-    queue_insert_before(&st_new->order_entry, &st->order_entry);
-    queue_remove(&st_new->order_entry);
-    queue_insert_after(&st->order_entry, &st_new->order_entry);
+    oqueue_insert_after(shm, &st->order_entry, &st_new->order_entry);
 
     fast_shmem_insert_free(shm, st_new);
     st->act_size = size;
@@ -450,8 +701,8 @@ void*
 static struct storage*
 fast_shmem_get_max_st(fast_shmem_t *shm, unsigned int *shmem_errno)
 {
-    queue_t         *q = NULL;
-    queue_t         *st_q;
+    oqueue_t        *q = NULL;
+    oqueue_t        *st_q;
     struct free_node    *free;
     struct storage      *st;
     struct storage      *st_max = NULL;
@@ -464,26 +715,26 @@ fast_shmem_get_max_st(fast_shmem_t *shm, unsigned int *shmem_errno)
     }
 
     if (shm->max_available_index == shm->free_len
-    	|| queue_empty(&shm->available)) {
+    	|| oqueue_empty(shm, &shm->available)) {
     	*shmem_errno = FAST_SHMEM_ERR_GET_MAX_EXHAUSTED;
         return NULL;
     }
 
-    q = queue_tail(&shm->available);
+    q = oqueue_tail(shm, &shm->available);
     free = queue_data(q, struct free_node, available_entry);
-    if (queue_empty(&free->free_list_head)) {
+    if (oqueue_empty(shm, &free->free_list_head)) {
     	*shmem_errno = FAST_SHMEM_ERR_GET_MAX_CRITICAL;
         return NULL;
     }
-    st_q = queue_head(&free->free_list_head);
+    st_q = oqueue_head(shm, &free->free_list_head);
     st_max = queue_data(st_q, struct storage, free_entry); 
-    st_q = queue_next(st_q);
+    st_q = oqueue_next(shm, st_q);
     while(st_q != &free->free_list_head) {
         st = queue_data(st_q, struct storage, free_entry);
         if (st->size > st_max->size) {
             st_max = st;
         }
-        st_q = queue_next(st_q);
+        st_q = oqueue_next(shm, st_q);
     }
     return st_max;
 }
@@ -526,7 +777,7 @@ void *fast_shmem_split_alloc(fast_shmem_t *shm, size_t *act_size,
 void fast_shmem_free(fast_shmem_t *shm, void *addr, unsigned int *shmem_errno)
 {
     struct storage  *st_alloc = NULL,*st = NULL;
-    queue_t     *q;
+    oqueue_t    *q;
     
     *shmem_errno = FAST_SHMEM_ERR_NONE;
     if (!shm || !addr) {
@@ -545,7 +796,7 @@ void fast_shmem_free(fast_shmem_t *shm, void *addr, unsigned int *shmem_errno)
     st_alloc->alloc = 0;
 
     //try merge with next st
-    q = queue_next(&st_alloc->order_entry);
+    q = oqueue_next(shm, &st_alloc->order_entry);
     if (q == &shm->order) {
         goto PROCESS_PREV;
     }
@@ -558,11 +809,11 @@ void fast_shmem_free(fast_shmem_t *shm, void *addr, unsigned int *shmem_errno)
             return;
         }
         st_alloc->size += st->size + sizeof(struct storage);
-        queue_remove(&st->order_entry);
+        oqueue_remove(shm, &st->order_entry);
         shm->shmem_stat.st_count--;
     }
 PROCESS_PREV:
-    q = queue_prev(&st_alloc->order_entry);
+    q = oqueue_prev(shm, &st_alloc->order_entry);
     if (q == &shm->order) {
         goto END;
     }
@@ -575,7 +826,7 @@ PROCESS_PREV:
             return;
         }
         st->size += (st_alloc->size + sizeof(struct storage));
-        queue_remove(&st_alloc->order_entry);
+        oqueue_remove(shm, &st_alloc->order_entry);
         st_alloc = st;
         shm->shmem_stat.st_count--;
     }
@@ -583,6 +834,419 @@ END:
     fast_shmem_insert_free(shm, st_alloc);    
 }
 
+/*
+ * give the bytes of an allocated storage beyond size back to the free
+ * lists, merged with the next storage if that one is free
+ */
+static void fast_shmem_trim(fast_shmem_t *shm, struct storage *st, size_t size)
+{
+    struct storage  *st_new, *st_next;
+    oqueue_t        *q;
+
+    size = fast_align(size, sizeof(size_t));
+    if (st->size < size
+        || st->size - size < sizeof(struct storage) + shm->split_threshold) {
+        return;
+    }
+
+    st_new = (struct storage *)((unsigned char *)st
+        + sizeof(struct storage) + size);
+    st_new->alloc = 0;
+    st_new->act_size = 0;
+    st_new->free_index = FAST_SHMEM_INVALID_INDEX;
+    st_new->size = st->size - size - sizeof(struct storage);
+    st->size = size;
+    oqueue_insert_after(shm, &st->order_entry, &st_new->order_entry);
+    shm->shmem_stat.used_size -= st_new->size + sizeof(struct storage);
+    shm->shmem_stat.st_count++;
+
+    q = oqueue_next(shm, &st_new->order_entry);
+    if (q != &shm->order) {
+        st_next = queue_data(q, struct storage, order_entry);
+        if (!st_next->alloc
+            && st_next == (struct storage *)((unsigned char *)st_new
+            + sizeof(struct storage) + st_new->size)
+            && fast_shmem_remove_free(shm, st_next) == FAST_SHMEM_OK) {
+            st_new->size += st_next->size + sizeof(struct storage);
+            oqueue_remove(shm, &st_next->order_entry);
+            shm->shmem_stat.st_count--;
+        }
+    }
+
+    fast_shmem_insert_free(shm, st_new);
+}
+
+void *fast_shmem_realloc(fast_shmem_t *shm, void *addr, size_t size,
+    unsigned int *shmem_errno)
+{
+    struct storage  *st, *st_next;
+    oqueue_t        *q;
+    void            *p;
+    size_t           grown;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!shm || !size) {
+        *shmem_errno = FAST_SHMEM_ERR_REALLOC_PARAM;
+        return NULL;
+    }
+    if (!addr) {
+        return fast_shmem_alloc(shm, size, shmem_errno);
+    }
+
+    st = (struct storage *)((char *)addr - sizeof(struct storage));
+    if (!st->alloc) {
+        *shmem_errno = FAST_SHMEM_ERR_REALLOC_NONALLOCED;
+        return NULL;
+    }
+
+    if (st->size < size) {
+        q = oqueue_next(shm, &st->order_entry);
+        if (q == &shm->order) {
+            goto MOVE;
+        }
+        st_next = queue_data(q, struct storage, order_entry);
+        grown = st->size + sizeof(struct storage) + st_next->size;
+        if (st_next->alloc || grown < size
+            || st_next != (struct storage *)((unsigned char *)st
+            + sizeof(struct storage) + st->size)) {
+            goto MOVE;
+        }
+        if (fast_shmem_remove_free(shm, st_next) == FAST_SHMEM_ERROR) {
+            goto MOVE;
+        }
+        oqueue_remove(shm, &st_next->order_entry);
+        shm->shmem_stat.st_count--;
+        shm->shmem_stat.used_size += grown - st->size;
+        st->size = grown;
+    }
+
+    shm->shmem_stat.reqs_size += size - st->act_size;
+    st->act_size = size;
+    fast_shmem_trim(shm, st, size);
+
+    return addr;
+
+MOVE:
+    p = fast_shmem_alloc(shm, size, shmem_errno);
+    if (!p) {
+        return NULL;
+    }
+    memcpy(p, addr, st->act_size);
+    fast_shmem_free(shm, addr, shmem_errno);
+
+    return p;
+}
+
+void *fast_shmem_memalign(fast_shmem_t *shm, size_t alignment, size_t size,
+    unsigned int *shmem_errno)
+{
+    struct storage  *st, *st_aligned;
+    unsigned char   *p, *aligned;
+    size_t           lead;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!alignment || (alignment & (alignment - 1))) {
+        *shmem_errno = FAST_SHMEM_ERR_MEMALIGN_PARAM;
+        return NULL;
+    }
+    if (alignment < sizeof(size_t)) {
+        alignment = sizeof(size_t);
+    }
+
+    //room for a leading free storage in front of the aligned address
+    p = fast_shmem_alloc(shm, size + alignment + sizeof(struct storage)
+        + shm->split_threshold, shmem_errno);
+    if (!p) {
+        return NULL;
+    }
+    st = (struct storage *)(p - sizeof(struct storage));
+
+    if (((uintptr_t)p & (alignment - 1)) == 0) {
+        shm->shmem_stat.reqs_size -= st->act_size - size;
+        st->act_size = size;
+        fast_shmem_trim(shm, st, size);
+        return p;
+    }
+
+    aligned = fast_align_ptr(p + sizeof(struct storage)
+        + shm->split_threshold, alignment);
+    st_aligned = (struct storage *)(aligned - sizeof(struct storage));
+    lead = (unsigned char *)st_aligned - p;
+
+    *st_aligned = *st;
+    st_aligned->size = st->size - lead - sizeof(struct storage);
+    st_aligned->act_size = size;
+    oqueue_insert_after(shm, &st->order_entry, &st_aligned->order_entry);
+    shm->shmem_stat.st_count++;
+    shm->shmem_stat.used_size -= sizeof(struct storage);
+
+    //fast_shmem_free takes lead and act_size off the stats
+    st->size = lead;
+    st->act_size = st->act_size - size;
+    fast_shmem_free(shm, p, shmem_errno);
+
+    fast_shmem_trim(shm, st_aligned, size);
+
+    return aligned;
+}
+
+size_t fast_shmem_usable_size(fast_shmem_t *shm, void *addr)
+{
+    struct storage  *st;
+
+    if (!shm || !addr) {
+        return 0;
+    }
+    st = (struct storage *)((char *)addr - sizeof(struct storage));
+
+    return st->alloc ? st->size : 0;
+}
+
+
+static fast_shmem_arena_t *
+fast_shmem_arena_get(fast_shmem_t *shm, int arena)
+{
+    unsigned int cpu;
+
+    if (arena < 0) {
+        arena = syscall(SYS_getcpu, &cpu, NULL, NULL) == -1 ?
+            (int)getpid() : (int)cpu;
+    }
+    return &fast_shmem_arenas(shm)[(size_t)arena % shm->arena_count];
+}
+
+static fast_shmem_arena_t *
+fast_shmem_arena_owner(fast_shmem_t *shm, void *addr)
+{
+    fast_shmem_arena_t  *arenas;
+    size_t               off;
+    size_t               i;
+
+    arenas = fast_shmem_arenas(shm);
+    off = fast_shmem_offset(shm, addr);
+    for (i = 0; i < shm->arena_count; i++) {
+        if (off >= arenas[i].heap && off < arenas[i].heap + arenas[i].size) {
+            return &arenas[i];
+        }
+    }
+    return NULL;
+}
+
+//give the blocks freed by other arenas back to the heap, lock held
+static void
+fast_shmem_arena_drain(fast_shmem_t *shm, fast_shmem_arena_t *arena)
+{
+    fast_shmem_t        *heap;
+    size_t               off;
+    size_t               next;
+    unsigned int         shmem_errno;
+
+    if (!arena->remote_free) {
+        return;
+    }
+    heap = fast_shmem_addr(shm, arena->heap);
+    //the owner takes the whole stack at once, so pushes can not hit ABA
+    off = __sync_lock_test_and_set(&arena->remote_free, 0);
+    while (off) {
+        next = *(size_t *)fast_shmem_addr(shm, off);
+        fast_shmem_free(heap, fast_shmem_addr(shm, off), &shmem_errno);
+        off = next;
+    }
+}
+
+int
+fast_shmem_arenas_create(fast_shmem_t *shm, size_t count, size_t arena_size,
+    unsigned int *shmem_errno)
+{
+    fast_shmem_arena_t  *arenas;
+    fast_shmem_layout_t  layout;
+    unsigned int         err;
+    void                *table;
+    void                *addr;
+    size_t               i;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!shm || !count || count > FAST_SHMEM_MAX_ARENAS) {
+        *shmem_errno = FAST_SHMEM_ERR_ARENA_PARAM;
+        return FAST_SHMEM_ERROR;
+    }
+    if (shm->arena_count) {
+        *shmem_errno = FAST_SHMEM_ERR_ARENA_EXIST;
+        return FAST_SHMEM_ERROR;
+    }
+    //by default the top heap keeps one share for large allocations
+    if (!arena_size) {
+        arena_size = (shm->shmem_stat.total_size
+            - shm->shmem_stat.system_size) / (count + 1);
+    }
+    arena_size = FAST_MATH_ALIGNMENT(arena_size, FAST_MATH_ALIGN_SIZE);
+
+    table = fast_shmem_calloc(shm, sizeof(fast_shmem_arena_t) * count
+        + DEFAULT_CACHELINE_SIZE, shmem_errno);
+    if (!table) {
+        return FAST_SHMEM_ERROR;
+    }
+    arenas = (fast_shmem_arena_t *)fast_align_ptr(table,
+        DEFAULT_CACHELINE_SIZE);
+
+    for (i = 0; i < count; i++) {
+        layout.total_size = arena_size;
+        layout.min_size = shm->min_size;
+        layout.max_size = shm->max_size;
+        layout.factor = shm->factor;
+        layout.level_type = shm->level_type;
+        if (fast_shmem_layout_calc(&layout, shmem_errno)
+            == FAST_SHMEM_ERROR) {
+            goto FAILED;
+        }
+        addr = fast_shmem_alloc(shm, arena_size, shmem_errno);
+        if (!addr) {
+            goto FAILED;
+        }
+        fast_shmem_layout_init(addr, &layout);
+        fast_atomic_lock_init(&arenas[i].lock);
+        arenas[i].remote_free = 0;
+        arenas[i].remote_frees = 0;
+        arenas[i].heap = fast_shmem_offset(shm, addr);
+        arenas[i].size = arena_size;
+    }
+
+    shm->arena_off = fast_shmem_offset(shm, arenas);
+    __sync_synchronize();
+    shm->arena_count = count;
+
+    return FAST_SHMEM_OK;
+
+FAILED:
+    while (i--) {
+        fast_shmem_free(shm, fast_shmem_addr(shm, arenas[i].heap), &err);
+    }
+    fast_shmem_free(shm, table, &err);
+    if (*shmem_errno == FAST_SHMEM_ERR_NONE
+        || *shmem_errno == FAST_SHMEM_ERR_CREATE_STORAGESIZE
+        || *shmem_errno == FAST_SHMEM_ERR_CREATE_TOTALSIZE_NOT_ENOUGH) {
+        *shmem_errno = FAST_SHMEM_ERR_ARENA_ALLOC;
+    }
+    return FAST_SHMEM_ERROR;
+}
+
+void*
+fast_shmem_arena_alloc(fast_shmem_t *shm, int arena, size_t size,
+    unsigned int *shmem_errno)
+{
+    fast_shmem_arena_t  *arenas;
+    fast_shmem_arena_t  *a;
+    fast_lock_errno_t    error;
+    size_t               start;
+    size_t               i;
+    void                *p;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!shm || !size) {
+        *shmem_errno = FAST_SHMEM_ERR_ALLOC_PARAM;
+        return NULL;
+    }
+
+    if (shm->arena_count) {
+        arenas = fast_shmem_arenas(shm);
+        start = fast_shmem_arena_get(shm, arena) - arenas;
+        //wait for our own arena, only try the others
+        for (i = 0; i < shm->arena_count; i++) {
+            a = &arenas[(start + i) % shm->arena_count];
+            if (!i) {
+                fast_atomic_lock_on(&a->lock, &error);
+            } else if (fast_atomic_lock_try_on(&a->lock, &error)
+                != FAST_LOCK_ON) {
+                continue;
+            }
+            fast_shmem_arena_drain(shm, a);
+            p = fast_shmem_alloc(fast_shmem_addr(shm, a->heap), size,
+                shmem_errno);
+            fast_atomic_lock_off(&a->lock, &error);
+            if (p) {
+                return p;
+            }
+        }
+    }
+
+    fast_atomic_lock_on(&shm->lock, &error);
+    p = fast_shmem_alloc(shm, size, shmem_errno);
+    fast_atomic_lock_off(&shm->lock, &error);
+
+    return p;
+}
+
+void*
+fast_shmem_arena_calloc(fast_shmem_t *shm, int arena, size_t size,
+    unsigned int *shmem_errno)
+{
+    void *p = fast_shmem_arena_alloc(shm, arena, size, shmem_errno);
+    
+    if (p) {
+        memset(p, 0, size);
+    }
+    
+    return p;
+}
+
+void
+fast_shmem_arena_free(fast_shmem_t *shm, int arena, void *addr,
+    unsigned int *shmem_errno)
+{
+    fast_shmem_arena_t  *owner = NULL;
+    fast_lock_errno_t    error;
+    struct storage      *st;
+    size_t               head;
+    size_t               off;
+
+    *shmem_errno = FAST_SHMEM_ERR_NONE;
+    if (!shm || !addr) {
+        *shmem_errno = FAST_SHMEM_ERR_FREE_PARAM;
+        return;
+    }
+
+    if (shm->arena_count) {
+        owner = fast_shmem_arena_owner(shm, addr);
+    }
+    if (!owner) {
+        fast_atomic_lock_on(&shm->lock, &error);
+        fast_shmem_free(shm, addr, shmem_errno);
+        fast_atomic_lock_off(&shm->lock, &error);
+        return;
+    }
+
+    if (owner == fast_shmem_arena_get(shm, arena)
+        && fast_atomic_lock_try_on(&owner->lock, &error) == FAST_LOCK_ON) {
+        fast_shmem_free(fast_shmem_addr(shm, owner->heap), addr, shmem_errno);
+        fast_atomic_lock_off(&owner->lock, &error);
+        return;
+    }
+
+    st = (struct storage *)((char *)addr - sizeof(struct storage));
+    if (!st->alloc) {
+        *shmem_errno = FAST_SHMEM_ERR_FREE_NONALLOCED;
+        return;
+    }
+
+    //remote free, push on the owner's stack without locking
+    off = fast_shmem_offset(shm, addr);
+    do {
+        head = owner->remote_free;
+        *(size_t *)addr = head;
+    } while (!__sync_bool_compare_and_swap(&owner->remote_free, head, off));
+    __sync_fetch_and_add(&owner->remote_frees, 1);
+}
+
+int
+fast_shmem_arena_get_stat(fast_shmem_t *shm, size_t arena,
+    fast_shmem_stat_t *stat)
+{
+    if (!shm || arena >= shm->arena_count) {
+        return FAST_SHMEM_ERROR;
+    }
+    return fast_shmem_get_stat(
+        fast_shmem_addr(shm, fast_shmem_arenas(shm)[arena].heap), stat);
+}
 
 void fast_shmem_dump(fast_shmem_t *shm, FILE *debug_out)
 {
@@ -11,6 +11,7 @@
 
 #include "fast_queue.h"
 #include "fast_string.h"
+#include "fast_lock.h"
 
 #define FAST_SHMEM_DEFAULT_MAX_SIZE  ((size_t)10<<20) //10MB
 #define FAST_SHMEM_DEFAULT_MIN_SIZE  ((size_t)1024)
@@ -31,6 +32,20 @@
 #define FAST_SHMEM_ERROR                    (-1)
 #define FAST_SHMEM_OK                       (0)
 
+#define FAST_SHMEM_MAGIC                    (0x4d454853) //"SHEM"
+#define FAST_SHMEM_VERSION                  (2)
+#define FAST_SHMEM_INVALID_INDEX            ((size_t)-1)
+
+#define FAST_SHMEM_MAX_ARENAS               (256)
+#define FAST_SHMEM_ARENA_ANY                (-1) //pick by current cpu
+
+enum {
+    FAST_SHMEM_BACKING_ANON = 0,  //anonymous, lost when the last user exits
+    FAST_SHMEM_BACKING_MEMFD,     //memfd, re-attached through an inherited fd
+    FAST_SHMEM_BACKING_SHM,       //posix shm_open name
+    FAST_SHMEM_BACKING_FILE       //regular file path
+};
+
 
 enum {
     FAST_SHMEM_ERR_NONE = 0,
@@ -45,6 +60,7 @@ enum {
     FAST_SHMEM_ERR_CREATE_TOTALSIZE_NOT_ENOUGH,
     FAST_SHMEM_ERR_CREATE_MMAP,
     FAST_SHMEM_ERR_CREATE_STORAGESIZE,
+    FAST_SHMEM_ERR_CREATE_BACKING,
 
     FAST_SHMEM_ERR_RELEASE_NULL,
     FAST_SHMEM_ERR_RELEASE_MUNMAP,
@@ -70,22 +86,45 @@ enum {
     FAST_SHMEM_ERR_FREE_REMOVE_NEXT,
     FAST_SHMEM_ERR_FREE_REMOVE_PREV,
 
+    FAST_SHMEM_ERR_ATTACH_PARAM,
+    FAST_SHMEM_ERR_ATTACH_OPEN,
+    FAST_SHMEM_ERR_ATTACH_SIZE,
+    FAST_SHMEM_ERR_ATTACH_MMAP,
+    FAST_SHMEM_ERR_ATTACH_MAGIC,
+    FAST_SHMEM_ERR_ATTACH_VERSION,
+    FAST_SHMEM_ERR_ATTACH_LAYOUT,
+
+    FAST_SHMEM_ERR_UNLINK,
+
+    FAST_SHMEM_ERR_ARENA_PARAM,
+    FAST_SHMEM_ERR_ARENA_EXIST,
+    FAST_SHMEM_ERR_ARENA_ALLOC,
+
+    FAST_SHMEM_ERR_REALLOC_PARAM,
+    FAST_SHMEM_ERR_REALLOC_NONALLOCED,
+
+    FAST_SHMEM_ERR_MEMALIGN_PARAM,
+
     FAST_SHMEM_ERR_END
 };
 
 struct storage;
+/*
+ * all links inside the region are offsets from the fast_shmem_t header,
+ * so that another process can map the region at a different address
+ */
 struct storage{
-    queue_t              order_entry;
-    queue_t              free_entry;
+    oqueue_t                 order_entry;
+    oqueue_t                 free_entry;
     unsigned int             alloc;
     size_t                   size;
     size_t                   act_size;
-    queue_t             *free_list_head;
+    size_t                   free_index; //FAST_SHMEM_INVALID_INDEX if not free
 };
 
 struct free_node{
-    queue_t              available_entry;
-    queue_t              free_list_head; 
+    oqueue_t                 available_entry;
+    oqueue_t                 free_list_head;
     unsigned int             index;
 };
 
@@ -101,11 +140,36 @@ typedef struct fast_shmem_stat_s {
     size_t                   split;
 } fast_shmem_stat_t;
 
+typedef struct fast_shmem_backing_s {
+    int                      type;  //FAST_SHMEM_BACKING_XXX
+    const char              *name;  //memfd label, shm name or file path
+    int                      fd;    //memfd only: set by create, used by attach
+} fast_shmem_backing_t;
+
+/*
+ * sub heap carved from the region, allocation and local free take only
+ * the arena lock, frees from other arenas are pushed on remote_free
+ * without locking and handed back by the owner on its next allocation
+ */
+typedef struct fast_shmem_arena_s {
+    fast_atomic_lock_t       lock;
+    volatile size_t          remote_free; //offset stack of remote freed blocks
+    size_t                   heap;        //offset of the nested fast_shmem_t
+    size_t                   size;        //bytes covered by the nested heap
+    size_t                   remote_frees;
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE))) fast_shmem_arena_t;
+
 typedef struct fast_shmem_s {
-    queue_t                  order;  //all block list include free and alloced
-    struct free_node        *free;   //free array from 0 to free_len - 1
+    uint32_t                 magic;   //FAST_SHMEM_MAGIC
+    uint32_t                 version; //FAST_SHMEM_VERSION
+    size_t                   header_size;  //sizeof(fast_shmem_t) of creator
+    size_t                   storage_size; //sizeof(struct storage) of creator
+    size_t                   generation; //increased on every attach
+    size_t                   root;   //offset of the user root object or 0
+    oqueue_t                 order;  //all block list include free and alloced
+    size_t                   free_off; //offset of free array 0..free_len - 1
     size_t                   free_len; //length of free array
-    queue_t                  available; //the list of non-empty free_list
+    oqueue_t                 available; //the list of non-empty free_list
     size_t                   max_available_index; //the id of last element in available
     size_t                   min_size; // the size of free[0]
     size_t                   max_size; // the size of free[free_len - 1]
@@ -113,6 +177,9 @@ typedef struct fast_shmem_s {
     size_t                   split_threshold; //threshold size for split default to min_size
     int                      level_type;//increament type                    
     fast_shmem_stat_t         shmem_stat;// stat for shmem
+    fast_atomic_lock_t        lock;     //guards this heap in arena mode
+    size_t                    arena_off; //offset of arena array or 0
+    size_t                    arena_count;
 } fast_shmem_t;
 
 fast_shmem_t*
@@ -122,6 +189,49 @@ fast_shmem_create(size_t size, size_t min_size, size_t max_size,
 int
 fast_shmem_release(fast_shmem_t **shm, unsigned int *shmem_errno);   
 
+/*
+ * named regions survive the process: create_named backs the region with
+ * memfd, shm_open or a file, attach maps an existing one after checking
+ * its header, release only unmaps it and unlink removes the name
+ */
+fast_shmem_t*
+fast_shmem_create_named(size_t size, size_t min_size, size_t max_size,
+    int level_type, size_t factor, fast_shmem_backing_t *backing,
+    unsigned int *shmem_errno);
+fast_shmem_t*
+fast_shmem_attach(fast_shmem_backing_t *backing, unsigned int *shmem_errno);
+int
+fast_shmem_unlink(fast_shmem_backing_t *backing, unsigned int *shmem_errno);
+
+#define fast_shmem_offset(shm, ptr) \
+    ((ptr) ? (size_t)((uchar_t *)(ptr) - (uchar_t *)(shm)) : 0)
+#define fast_shmem_addr(shm, off) \
+    ((off) ? (void *)((uchar_t *)(shm) + (off)) : NULL)
+
+/*
+ * concurrent allocation for processes sharing one region, the arenas
+ * must be created once before the workers start, arena is the caller's
+ * slot (worker index) or FAST_SHMEM_ARENA_ANY
+ */
+int
+fast_shmem_arenas_create(fast_shmem_t *shm, size_t count, size_t arena_size,
+    unsigned int *shmem_errno);
+void*
+fast_shmem_arena_alloc(fast_shmem_t *shm, int arena, size_t size,
+    unsigned int *shmem_errno);
+void*
+fast_shmem_arena_calloc(fast_shmem_t *shm, int arena, size_t size,
+    unsigned int *shmem_errno);
+void
+fast_shmem_arena_free(fast_shmem_t *shm, int arena, void *addr,
+    unsigned int *shmem_errno);
+int
+fast_shmem_arena_get_stat(fast_shmem_t *shm, size_t arena,
+    fast_shmem_stat_t *stat);
+
+int            fast_shmem_set_root(fast_shmem_t *shm, void *root);
+void          *fast_shmem_get_root(fast_shmem_t *shm);
+
 inline size_t fast_shmem_set_alignment_size(size_t size);
 inline size_t fast_shmem_get_alignment_size();
 
@@ -134,6 +244,15 @@ fast_shmem_free(fast_shmem_t *shm, void *addr, unsigned int *shmem_errno);
 void*
 fast_shmem_split_alloc(fast_shmem_t *shm, size_t *act_size,
     size_t minsize, unsigned int *shmem_errno);
+//grows into a free neighbour when possible, otherwise moves the data
+void*
+fast_shmem_realloc(fast_shmem_t *shm, void *addr, size_t size,
+    unsigned int *shmem_errno);
+void*
+fast_shmem_memalign(fast_shmem_t *shm, size_t alignment, size_t size,
+    unsigned int *shmem_errno);
+size_t
+fast_shmem_usable_size(fast_shmem_t *shm, void *addr);
 
 void           fast_shmem_dump(fast_shmem_t *shm, FILE *out);
 size_t         fast_shmem_get_used_size(fast_shmem_t *shm);
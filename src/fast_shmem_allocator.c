@@ -31,6 +31,18 @@ fast_shmem_allocator_strerror(fast_mem_allocator_t *this, void *err_data);
 static int
 fast_shmem_allocator_stat(fast_mem_allocator_t *this, void *stat_data);
 
+static void *
+fast_shmem_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data);
+
+static void *
+fast_shmem_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data);
+
+static size_t
+fast_shmem_allocator_usable_size(fast_mem_allocator_t *this, void *ptr,
+    void *param_data);
+
 static fast_mem_allocator_t fast_shmem_allocator = {
     .private_data   = NULL,
     .type           = FAST_MEM_ALLOCATOR_TYPE_SHMEM,
@@ -41,7 +53,12 @@ static fast_mem_allocator_t fast_shmem_allocator = {
     .split_alloc    = fast_shmem_allocator_split_alloc,
     .free           = fast_shmem_allocator_free,
     .strerror       = fast_shmem_allocator_strerror,
-    .stat           = fast_shmem_allocator_stat
+    .stat           = fast_shmem_allocator_stat,
+    .realloc        = fast_shmem_allocator_realloc,
+    .memalign       = fast_shmem_allocator_memalign,
+    .alloc_batch    = NULL,
+    .free_batch     = NULL,
+    .usable_size    = fast_shmem_allocator_usable_size
 };
 
 static int
@@ -183,6 +200,52 @@ fast_shmem_allocator_stat(fast_mem_allocator_t *this, void *stat_data)
     return FAST_MEM_ALLOCATOR_OK;
 }
 
+static void *
+fast_shmem_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data)
+{
+    unsigned int  shmem_errno;
+    void         *p;
+
+    if (!this || !this->private_data) {
+        return NULL;
+    }
+    p = fast_shmem_realloc((fast_shmem_t *)this->private_data, ptr, size,
+        &shmem_errno);
+    if (!p && param_data) {
+        *(unsigned int *)param_data = shmem_errno;
+    }
+    return p;
+}
+
+static void *
+fast_shmem_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data)
+{
+    unsigned int  shmem_errno;
+    void         *p;
+
+    if (!this || !this->private_data) {
+        return NULL;
+    }
+    p = fast_shmem_memalign((fast_shmem_t *)this->private_data, alignment,
+        size, &shmem_errno);
+    if (!p && param_data) {
+        *(unsigned int *)param_data = shmem_errno;
+    }
+    return p;
+}
+
+static size_t
+fast_shmem_allocator_usable_size(fast_mem_allocator_t *this, void *ptr,
+    void *param_data)
+{
+    if (!this || !this->private_data) {
+        return 0;
+    }
+    return fast_shmem_usable_size((fast_shmem_t *)this->private_data, ptr);
+}
+
 const fast_mem_allocator_t *fast_get_shmem_allocator(void)
 {
     return &fast_shmem_allocator;
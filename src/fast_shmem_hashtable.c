@@ -0,0 +1,269 @@
+#include "fast_shmem_hashtable.h"
+#include <sched.h>
+#include <time.h>
+
+//reads that could not finish, the stripe kept changing, wait for it
+#define FAST_SHMEM_HASHTABLE_SPINS   64
+
+#define fast_shmem_hashtable_stripe(ht, i) \
+    ((fast_shmem_hashtable_stripe_t *)fast_shmem_hashtable_addr(ht, \
+        (ht)->locks) + ((i) & ((ht)->stripes - 1)))
+
+#define fast_shmem_hashtable_bucket(ht, i) \
+    ((volatile size_t *)fast_shmem_hashtable_addr(ht, (ht)->buckets) + (i))
+
+static fast_shmem_hashtable_link_t *fast_shmem_hashtable_find(
+    fast_shmem_hashtable_t *ht, const void *key, size_t len,
+    fast_shmem_hashtable_read_pt read_func, void *arg);
+static void fast_shmem_hashtable_write_on(fast_shmem_hashtable_stripe_t *s);
+static void fast_shmem_hashtable_write_off(fast_shmem_hashtable_stripe_t *s);
+
+fast_shmem_hashtable_t *
+fast_shmem_hashtable_create(fast_shmem_t *shm, size_t hash_sz, size_t stripes,
+    unsigned int *shmem_errno)
+{
+    fast_shmem_hashtable_t        *ht;
+    fast_shmem_hashtable_stripe_t *s;
+    size_t                        *buckets;
+    fast_shmem_hashtable_stripe_t *locks;
+    size_t                         size = 16, i;
+
+    if (!shm) {
+        return NULL;
+    }
+    if (!stripes) {
+        stripes = FAST_SHMEM_HASHTABLE_STRIPES;
+    }
+    if (stripes & (stripes - 1)) {
+        return NULL;
+    }
+    while (size < hash_sz) {
+        size <<= 1;
+    }
+
+    ht = fast_shmem_calloc(shm, sizeof(fast_shmem_hashtable_t), shmem_errno);
+    buckets = fast_shmem_calloc(shm, size * sizeof(size_t), shmem_errno);
+    //one stripe per cache line, readers spinning on one do not slow another
+    locks = fast_shmem_memalign(shm, DEFAULT_CACHELINE_SIZE,
+        stripes * sizeof(fast_shmem_hashtable_stripe_t), shmem_errno);
+    if (!ht || !buckets || !locks) {
+        if (ht) {
+            fast_shmem_free(shm, ht, shmem_errno);
+        }
+        if (buckets) {
+            fast_shmem_free(shm, buckets, shmem_errno);
+        }
+        if (locks) {
+            fast_shmem_free(shm, locks, shmem_errno);
+        }
+        return NULL;
+    }
+
+    ht->self = fast_shmem_offset(shm, ht);
+    ht->limit = shm->shmem_stat.total_size;
+    ht->seed = fast_hash64(&ht, sizeof(ht), (uint64_t)time(NULL));
+    ht->size = size;
+    ht->stripes = stripes;
+    ht->buckets = fast_shmem_offset(shm, buckets);
+    ht->locks = fast_shmem_offset(shm, locks);
+    ht->count = 0;
+    memset(locks, 0, stripes * sizeof(fast_shmem_hashtable_stripe_t));
+    for (i = 0; i < stripes; i++) {
+        s = &locks[i];
+        fast_atomic_lock_init(&s->lock);
+        s->lock.allocator = NULL;
+    }
+
+    return ht;
+}
+
+void
+fast_shmem_hashtable_free_memory(fast_shmem_t *shm, fast_shmem_hashtable_t *ht)
+{
+    unsigned int err;
+
+    if (!shm || !ht) {
+        return;
+    }
+    fast_shmem_free(shm, fast_shmem_hashtable_addr(ht, ht->locks), &err);
+    fast_shmem_free(shm, fast_shmem_hashtable_addr(ht, ht->buckets), &err);
+    fast_shmem_free(shm, ht, &err);
+}
+
+int
+fast_shmem_hashtable_join(fast_shmem_hashtable_t *ht,
+    fast_shmem_hashtable_link_t *hl)
+{
+    fast_shmem_hashtable_stripe_t *s;
+    volatile size_t               *bucket;
+    size_t                         i;
+
+    if (!ht || !hl || !hl->key || hl->key + hl->len > ht->limit) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    hl->hash = fast_hash64(fast_shmem_hashtable_base(ht) + hl->key, hl->len,
+        ht->seed);
+    i = hl->hash & (ht->size - 1);
+    bucket = fast_shmem_hashtable_bucket(ht, i);
+    s = fast_shmem_hashtable_stripe(ht, i);
+
+    fast_shmem_hashtable_write_on(s);
+    hl->next = *bucket;
+    *bucket = fast_shmem_hashtable_offset(ht, hl);
+    fast_shmem_hashtable_write_off(s);
+    __sync_fetch_and_add(&ht->count, 1);
+
+    return FAST_HASHTABLE_OK;
+}
+
+int
+fast_shmem_hashtable_remove_link(fast_shmem_hashtable_t *ht,
+    fast_shmem_hashtable_link_t *hl)
+{
+    fast_shmem_hashtable_stripe_t *s;
+    fast_shmem_hashtable_link_t   *walker;
+    volatile size_t               *link;
+    size_t                         i, off;
+    int                            rc = FAST_HASHTABLE_ERROR;
+
+    if (!ht || !hl) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    off = fast_shmem_hashtable_offset(ht, hl);
+    i = hl->hash & (ht->size - 1);
+    s = fast_shmem_hashtable_stripe(ht, i);
+
+    fast_shmem_hashtable_write_on(s);
+    for (link = fast_shmem_hashtable_bucket(ht, i); *link;
+         link = &walker->next) {
+        walker = fast_shmem_hashtable_addr(ht, *link);
+        if (*link == off) {
+            //hl->next is left as it is for readers standing on hl
+            *link = hl->next;
+            rc = FAST_HASHTABLE_OK;
+            break;
+        }
+    }
+    fast_shmem_hashtable_write_off(s);
+    if (rc == FAST_HASHTABLE_OK) {
+        __sync_fetch_and_sub(&ht->count, 1);
+    }
+
+    return rc;
+}
+
+fast_shmem_hashtable_link_t *
+fast_shmem_hashtable_lookup(fast_shmem_hashtable_t *ht, const void *key,
+    size_t len)
+{
+    if (!ht || !key) {
+        return NULL;
+    }
+    return fast_shmem_hashtable_find(ht, key, len, NULL, NULL);
+}
+
+int
+fast_shmem_hashtable_read(fast_shmem_hashtable_t *ht, const void *key,
+    size_t len, fast_shmem_hashtable_read_pt read_func, void *arg)
+{
+    if (!ht || !key || !read_func) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    return fast_shmem_hashtable_find(ht, key, len, read_func, arg)
+        ? FAST_HASHTABLE_OK : FAST_HASHTABLE_ERROR;
+}
+
+int
+fast_shmem_hashtable_empty(fast_shmem_hashtable_t *ht)
+{
+    return ht && ht->count ? FAST_HASHTABLE_FALSE : FAST_HASHTABLE_TRUE;
+}
+
+/*
+ * a chain walked while a writer changes it may hold any offset, every
+ * one is checked against the region and a walk longer than the table
+ * counts as torn, the sequence check then sends the reader back
+ */
+static fast_shmem_hashtable_link_t *
+fast_shmem_hashtable_find(fast_shmem_hashtable_t *ht, const void *key,
+    size_t len, fast_shmem_hashtable_read_pt read_func, void *arg)
+{
+    fast_shmem_hashtable_stripe_t *s;
+    fast_shmem_hashtable_link_t   *walker, *found;
+    uint64_t                       hash, seq;
+    size_t                         i, off, koff, steps, spins = 0;
+    int                            torn;
+
+    if (len > ht->limit) {
+        return NULL;
+    }
+    hash = fast_hash64(key, len, ht->seed);
+    i = hash & (ht->size - 1);
+    s = fast_shmem_hashtable_stripe(ht, i);
+
+    for ( ;; ) {
+        seq = s->seq;
+        if (seq & 1) {
+            if (++spins % FAST_SHMEM_HASHTABLE_SPINS == 0) {
+                sched_yield();
+            }
+            continue;
+        }
+        __sync_synchronize();
+
+        found = NULL;
+        torn = 0;
+        steps = 0;
+        for (off = *fast_shmem_hashtable_bucket(ht, i); off;
+             off = walker->next) {
+            if (off > ht->limit - sizeof(fast_shmem_hashtable_link_t)
+                || ++steps > ht->count + ht->stripes) {
+                torn = 1;
+                break;
+            }
+            walker = fast_shmem_hashtable_addr(ht, off);
+            if (walker->hash != hash || walker->len != len) {
+                continue;
+            }
+            //read once, the check and the compare must see the same one
+            koff = *(volatile size_t *)&walker->key;
+            if (!koff || koff > ht->limit - len) {
+                torn = 1;
+                break;
+            }
+            if (memcmp(fast_shmem_hashtable_base(ht) + koff, key, len) == 0) {
+                found = walker;
+                if (read_func) {
+                    read_func(walker, arg);
+                }
+                break;
+            }
+        }
+
+        __sync_synchronize();
+        if (!torn && s->seq == seq) {
+            return found;
+        }
+        __sync_fetch_and_add(&s->retries, 1);
+    }
+}
+
+static void
+fast_shmem_hashtable_write_on(fast_shmem_hashtable_stripe_t *s)
+{
+    fast_lock_errno_t error;
+
+    fast_atomic_lock_on(&s->lock, &error);
+    s->seq++;
+    __sync_synchronize();
+}
+
+static void
+fast_shmem_hashtable_write_off(fast_shmem_hashtable_stripe_t *s)
+{
+    fast_lock_errno_t error;
+
+    __sync_synchronize();
+    s->seq++;
+    fast_atomic_lock_off(&s->lock, &error);
+}
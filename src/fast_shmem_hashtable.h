@@ -0,0 +1,88 @@
+#ifndef _FAST_SHMEM_HASHTABLE_H
+#define _FAST_SHMEM_HASHTABLE_H
+
+#include "fast_hashtable.h"
+#include "fast_shmem.h"
+
+/*
+ * hashtable shared by processes mapping one fast_shmem_t region, maybe at
+ * different addresses: the table, its links and their keys all live in
+ * the region and refer to each other by offsets from its header.
+ *
+ * writers lock the stripe of the bucket, a stripe covers every
+ * stripes-th bucket. readers take no lock: they walk the chain between
+ * two reads of the stripe's sequence and start over if a writer got in
+ * between. a link handed out by lookup is only safe to use if removed
+ * links are not freed while readers may hold them, fast_shmem_hashtable_read
+ * copies the object out inside the validated section instead.
+ *
+ * keys are compared bytewise and hashed with fast_hash64 and the seed of
+ * the table, the bucket number is fixed at create.
+ */
+
+#define FAST_SHMEM_HASHTABLE_STRIPES   64
+
+typedef struct fast_shmem_hashtable_link_s {
+    size_t                   key;       // offset of the key
+    size_t                   len;
+    volatile size_t          next;      // offset of the next link or 0
+    uint64_t                 hash;      // set by join
+} fast_shmem_hashtable_link_t;
+
+typedef struct fast_shmem_hashtable_stripe_s {
+    fast_atomic_lock_t       lock;      // writers only
+    volatile uint64_t        seq;       // odd while a writer is inside
+    size_t                   retries;   // reads started over
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE)))
+fast_shmem_hashtable_stripe_t;
+
+typedef struct fast_shmem_hashtable_s {
+    size_t                   self;      // offset of this header
+    size_t                   limit;     // bytes of the region
+    uint64_t                 seed;
+    size_t                   size;      // bucket number, power of 2
+    size_t                   stripes;   // power of 2
+    size_t                   buckets;   // offset of the bucket array
+    size_t                   locks;     // offset of the stripe array
+    volatile size_t          count;
+} fast_shmem_hashtable_t;
+
+/*
+ * called on a link found by fast_shmem_hashtable_read, maybe more than
+ * once and maybe on a link being changed: it must only copy data out
+ */
+typedef void (*fast_shmem_hashtable_read_pt)(fast_shmem_hashtable_link_t *,
+    void *arg);
+
+#define fast_shmem_hashtable_base(ht) ((uchar_t *)(ht) - (ht)->self)
+#define fast_shmem_hashtable_addr(ht, off) \
+    ((off) ? (void *)(fast_shmem_hashtable_base(ht) + (off)) : NULL)
+#define fast_shmem_hashtable_offset(ht, ptr) \
+    ((ptr) ? (size_t)((uchar_t *)(ptr) - fast_shmem_hashtable_base(ht)) : 0)
+
+/*
+ * allocates the table from shm, done once before other processes use
+ * it. hash_sz is the expected number of links, stripes 0 picks
+ * FAST_SHMEM_HASHTABLE_STRIPES. others find the table through
+ * fast_shmem_set_root or an offset kept by the caller
+ */
+fast_shmem_hashtable_t *
+fast_shmem_hashtable_create(fast_shmem_t *shm, size_t hash_sz, size_t stripes,
+    unsigned int *shmem_errno);
+void  fast_shmem_hashtable_free_memory(fast_shmem_t *shm,
+    fast_shmem_hashtable_t *ht);
+
+//hl and its key must be in the region, hl->key and hl->len set
+int   fast_shmem_hashtable_join(fast_shmem_hashtable_t *ht,
+    fast_shmem_hashtable_link_t *hl);
+int   fast_shmem_hashtable_remove_link(fast_shmem_hashtable_t *ht,
+    fast_shmem_hashtable_link_t *hl);
+fast_shmem_hashtable_link_t *
+fast_shmem_hashtable_lookup(fast_shmem_hashtable_t *ht, const void *key,
+    size_t len);
+//FAST_HASHTABLE_OK if found, read_func ran on the link
+int   fast_shmem_hashtable_read(fast_shmem_hashtable_t *ht, const void *key,
+    size_t len, fast_shmem_hashtable_read_pt read_func, void *arg);
+int   fast_shmem_hashtable_empty(fast_shmem_hashtable_t *ht);
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ * fast_swisstable.c
+ *
+ */
+
+#include "fast_swisstable.h"
+#include "fast_memory.h"
+
+#define FAST_SWISSTABLE_EMPTY     ((uchar_t)0x80)
+#define FAST_SWISSTABLE_DELETED   ((uchar_t)0xfe)
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define FAST_SWISSTABLE_GROUP     16
+
+typedef uint32_t fast_swisstable_mask_t;
+
+static inline fast_swisstable_mask_t
+fast_swisstable_match(const uchar_t *g, uchar_t h2)
+{
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)g), _mm_set1_epi8((char)h2)));
+}
+
+//empty and deleted bytes are the ones with the high bit set
+static inline fast_swisstable_mask_t
+fast_swisstable_match_free(const uchar_t *g)
+{
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+
+#define fast_swisstable_match_empty(g) \
+    fast_swisstable_match((g), FAST_SWISSTABLE_EMPTY)
+#define fast_swisstable_first(m)   ((size_t)__builtin_ctz(m))
+#define fast_swisstable_last(m)    ((size_t)__builtin_clz(m) - 16)
+
+#else
+
+#define FAST_SWISSTABLE_GROUP     8
+#define FAST_SWISSTABLE_LSB       0x0101010101010101ULL
+#define FAST_SWISSTABLE_MSB       0x8080808080808080ULL
+
+typedef uint64_t fast_swisstable_mask_t;
+
+static inline uint64_t
+fast_swisstable_load(const uchar_t *g)
+{
+    uint64_t w;
+
+    memcpy(&w, g, sizeof(w));
+    return w;
+}
+
+//may report a false match next to a real one, the hash check drops it
+static inline fast_swisstable_mask_t
+fast_swisstable_match(const uchar_t *g, uchar_t h2)
+{
+    uint64_t x = fast_swisstable_load(g) ^ (FAST_SWISSTABLE_LSB * h2);
+
+    return (x - FAST_SWISSTABLE_LSB) & ~x & FAST_SWISSTABLE_MSB;
+}
+
+static inline fast_swisstable_mask_t
+fast_swisstable_match_free(const uchar_t *g)
+{
+    return fast_swisstable_load(g) & FAST_SWISSTABLE_MSB;
+}
+
+static inline fast_swisstable_mask_t
+fast_swisstable_match_empty(const uchar_t *g)
+{
+    uint64_t w = fast_swisstable_load(g);
+
+    return w & ~(w << 6) & FAST_SWISSTABLE_MSB;
+}
+
+#define fast_swisstable_first(m)   ((size_t)__builtin_ctzll(m) >> 3)
+#define fast_swisstable_last(m)    ((size_t)__builtin_clzll(m) >> 3)
+
+#endif
+
+static uint64_t fast_swisstable_hash(fast_swisstable_t *st, const void *key,
+    size_t len);
+static void *fast_swisstable_alloc(fast_swisstable_t *st, size_t size);
+static void fast_swisstable_free(fast_swisstable_t *st, void *p);
+static size_t fast_swisstable_bytes(size_t size);
+static int fast_swisstable_resize(fast_swisstable_t *st, size_t size);
+static size_t fast_swisstable_find_free(fast_swisstable_t *st, uint64_t hash);
+static void fast_swisstable_set_ctrl(fast_swisstable_t *st, size_t i,
+    uchar_t c);
+
+fast_swisstable_t *
+fast_swisstable_create(FAST_HASHTABLE_CMP *cmp_func, size_t hash_sz,
+    FAST_HASHTABLE_HASH *hash_func, fast_mem_allocator_t *allocator)
+{
+    fast_swisstable_t  *st;
+    unsigned int        err_no;
+
+    if (allocator) {
+        st = allocator->calloc(allocator, sizeof(fast_swisstable_t), &err_no);
+    } else {
+        st = memory_calloc(sizeof(fast_swisstable_t));
+    }
+
+    if (!st) {
+        return NULL;
+    }
+
+    if (fast_swisstable_init(st, cmp_func, hash_sz, hash_func,
+        allocator) == FAST_HASHTABLE_OK) {
+        return st;
+    }
+
+    if (allocator) {
+        fast_mem_allocator_free(allocator, st, &err_no);
+    } else {
+        memory_free(st, sizeof(fast_swisstable_t));
+    }
+
+    return NULL;
+}
+
+//hash_sz is the number of links expected, 0 starts at the minimum size
+int
+fast_swisstable_init(fast_swisstable_t *st, FAST_HASHTABLE_CMP *cmp_func,
+    size_t hash_sz, FAST_HASHTABLE_HASH *hash_func,
+    fast_mem_allocator_t *allocator)
+{
+    size_t size = FAST_SWISSTABLE_MIN_SIZE;
+
+    if (!st) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    while (size - size / 8 < hash_sz) {
+        size <<= 1;
+    }
+
+    st->ctrl = NULL;
+    st->slots = NULL;
+    st->cmp = cmp_func;
+    st->hash = hash_func;
+    st->allocator = allocator;
+    st->size = 0;
+    st->count = 0;
+    st->deleted = 0;
+
+    return fast_swisstable_resize(st, size);
+}
+
+/*
+ * joins hl under its key, like fast_hashtable_join it does not look for
+ * a link with the same key
+ */
+int
+fast_swisstable_join(fast_swisstable_t *st, fast_hashtable_link_t *hl)
+{
+    fast_swisstable_slot_t  *slot;
+    uint64_t                 hash;
+    size_t                   i;
+
+    if (!st || !hl) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    if (st->count + st->deleted >= st->size - st->size / 8) {
+        //plenty of tombstones are cleared in place
+        if (fast_swisstable_resize(st, st->deleted > st->count / 2
+            ? st->size : st->size << 1) != FAST_HASHTABLE_OK) {
+            return FAST_HASHTABLE_ERROR;
+        }
+    }
+
+    hash = fast_swisstable_hash(st, hl->key, hl->len);
+    hl->hash = hash;
+    i = fast_swisstable_find_free(st, hash);
+    if (st->ctrl[i] == FAST_SWISSTABLE_DELETED) {
+        st->deleted--;
+    }
+    fast_swisstable_set_ctrl(st, i, (uchar_t)(hash & 0x7f));
+
+    slot = &st->slots[i];
+    slot->link = hl;
+    slot->hash = hash;
+    slot->len = (uint32_t)hl->len;
+    if (!st->cmp && hl->len <= FAST_SWISSTABLE_INLINE_KEY) {
+        memcpy(slot->key, hl->key, hl->len);
+    }
+    st->count++;
+
+    return FAST_HASHTABLE_OK;
+}
+
+void *
+fast_swisstable_lookup(fast_swisstable_t *st, const void *key, size_t len)
+{
+    fast_swisstable_slot_t  *slot;
+    fast_swisstable_mask_t   m;
+    uint64_t                 hash;
+    size_t                   mask, pos, step, i;
+    uchar_t                 *g;
+
+    if (!key || !st) {
+        return NULL;
+    }
+    hash = fast_swisstable_hash(st, key, len);
+    mask = st->size - 1;
+    pos = (hash >> 7) & mask;
+    for (step = 0; ; ) {
+        g = st->ctrl + pos;
+        for (m = fast_swisstable_match(g, (uchar_t)(hash & 0x7f)); m;
+             m &= m - 1) {
+            i = (pos + fast_swisstable_first(m)) & mask;
+            slot = &st->slots[i];
+            if (slot->hash != hash || slot->len != len) {
+                continue;
+            }
+            if (st->cmp) {
+                if (st->cmp(key, slot->link->key, len) == 0) {
+                    return slot->link;
+                }
+            } else if (memcmp(key, len <= FAST_SWISSTABLE_INLINE_KEY
+                ? slot->key : (uchar_t *)slot->link->key, len) == 0) {
+                return slot->link;
+            }
+        }
+        if (fast_swisstable_match_empty(g)) {
+            return NULL;
+        }
+        step += FAST_SWISSTABLE_GROUP;
+        pos = (pos + step) & mask;
+    }
+}
+
+int
+fast_swisstable_remove_link(fast_swisstable_t *st, fast_hashtable_link_t *hl)
+{
+    fast_swisstable_mask_t   m, before, after;
+    uint64_t                 hash;
+    size_t                   mask, pos, step, i;
+    uchar_t                 *g;
+
+    if (!st || !hl) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    //set by join
+    hash = hl->hash;
+    mask = st->size - 1;
+    pos = (hash >> 7) & mask;
+    for (step = 0; ; ) {
+        g = st->ctrl + pos;
+        for (m = fast_swisstable_match(g, (uchar_t)(hash & 0x7f)); m;
+             m &= m - 1) {
+            i = (pos + fast_swisstable_first(m)) & mask;
+            if (st->slots[i].link != hl) {
+                continue;
+            }
+            /*
+             * the slot may become empty again only if no probe ever went
+             * past it: a window of one group around it holds an empty slot
+             */
+            before = fast_swisstable_match_empty(
+                st->ctrl + ((i - FAST_SWISSTABLE_GROUP) & mask));
+            after = fast_swisstable_match_empty(st->ctrl + i);
+            if (before && after && fast_swisstable_first(after)
+                + fast_swisstable_last(before) < FAST_SWISSTABLE_GROUP) {
+                fast_swisstable_set_ctrl(st, i, FAST_SWISSTABLE_EMPTY);
+
+            } else {
+                fast_swisstable_set_ctrl(st, i, FAST_SWISSTABLE_DELETED);
+                st->deleted++;
+            }
+            st->slots[i].link = NULL;
+            st->count--;
+            return FAST_HASHTABLE_OK;
+        }
+        if (fast_swisstable_match_empty(g)) {
+            return FAST_HASHTABLE_ERROR;
+        }
+        step += FAST_SWISSTABLE_GROUP;
+        pos = (pos + step) & mask;
+    }
+}
+
+void
+fast_swisstable_free_memory(fast_swisstable_t *st)
+{
+    unsigned int err_no;
+
+    if (!st) {
+        return;
+    }
+    if (st->ctrl) {
+        fast_swisstable_free(st, st->ctrl);
+    }
+    if (st->allocator) {
+        fast_mem_allocator_free(st->allocator, st, &err_no);
+    } else {
+        memory_free(st, sizeof(fast_swisstable_t));
+    }
+}
+
+void
+fast_swisstable_free_items(fast_swisstable_t *st,
+    void (*free_object_func)(void *), void *param)
+{
+    size_t i;
+
+    if (!st || !free_object_func) {
+        return;
+    }
+    for (i = 0; i < st->size; i++) {
+        if (!(st->ctrl[i] & 0x80)) {
+            free_object_func(st->slots[i].link);
+        }
+    }
+    memset(st->ctrl, FAST_SWISSTABLE_EMPTY, st->size + FAST_SWISSTABLE_GROUP);
+    st->count = 0;
+    st->deleted = 0;
+}
+
+int
+fast_swisstable_empty(fast_swisstable_t *st)
+{
+    return st && st->count ? FAST_HASHTABLE_FALSE : FAST_HASHTABLE_TRUE;
+}
+
+static uint64_t
+fast_swisstable_hash(fast_swisstable_t *st, const void *key, size_t len)
+{
+    uint64_t h;
+
+    if (!st->hash) {
+        return fast_hash64(key, len, 0);
+    }
+    //the callers' hashes are rarely good in the low bits
+    h = st->hash(key, len, (size_t)-1);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static void *
+fast_swisstable_alloc(fast_swisstable_t *st, size_t size)
+{
+    unsigned int err_no;
+
+    if (st->allocator) {
+        return st->allocator->alloc(st->allocator, size, &err_no);
+    }
+    return memory_alloc(size);
+}
+
+static void
+fast_swisstable_free(fast_swisstable_t *st, void *p)
+{
+    unsigned int err_no;
+
+    if (st->allocator) {
+        fast_mem_allocator_free(st->allocator, p, &err_no);
+    } else {
+        memory_free(p, fast_swisstable_bytes(st->size));
+    }
+}
+
+//control bytes and slots live in one block
+static size_t
+fast_swisstable_bytes(size_t size)
+{
+    return fast_align(size + FAST_SWISSTABLE_GROUP, sizeof(void *))
+        + size * sizeof(fast_swisstable_slot_t);
+}
+
+//moves every link to fresh arrays of size slots, the stored hashes are kept
+static int
+fast_swisstable_resize(fast_swisstable_t *st, size_t size)
+{
+    fast_swisstable_t  old = *st;
+    uchar_t           *block;
+    size_t             i, j;
+
+    block = fast_swisstable_alloc(st, fast_swisstable_bytes(size));
+    if (!block) {
+        return FAST_HASHTABLE_ERROR;
+    }
+    st->ctrl = block;
+    st->slots = (fast_swisstable_slot_t *)(block
+        + fast_align(size + FAST_SWISSTABLE_GROUP, sizeof(void *)));
+    st->size = size;
+    st->deleted = 0;
+    memset(st->ctrl, FAST_SWISSTABLE_EMPTY, size + FAST_SWISSTABLE_GROUP);
+
+    for (i = 0; i < old.size; i++) {
+        if (old.ctrl[i] & 0x80) {
+            continue;
+        }
+        j = fast_swisstable_find_free(st, old.slots[i].hash);
+        fast_swisstable_set_ctrl(st, j, old.ctrl[i]);
+        st->slots[j] = old.slots[i];
+    }
+    if (old.ctrl) {
+        fast_swisstable_free(&old, old.ctrl);
+    }
+
+    return FAST_HASHTABLE_OK;
+}
+
+static size_t
+fast_swisstable_find_free(fast_swisstable_t *st, uint64_t hash)
+{
+    fast_swisstable_mask_t   m;
+    size_t                   mask = st->size - 1;
+    size_t                   pos = (hash >> 7) & mask;
+    size_t                   step = 0;
+
+    for ( ;; ) {
+        m = fast_swisstable_match_free(st->ctrl + pos);
+        if (m) {
+            return (pos + fast_swisstable_first(m)) & mask;
+        }
+        step += FAST_SWISSTABLE_GROUP;
+        pos = (pos + step) & mask;
+    }
+}
+
+//the first group is mirrored behind the last slot for unaligned loads
+static void
+fast_swisstable_set_ctrl(fast_swisstable_t *st, size_t i, uchar_t c)
+{
+    st->ctrl[i] = c;
+    if (i < FAST_SWISSTABLE_GROUP) {
+        st->ctrl[st->size + i] = c;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef _FAST_SWISSTABLE_H
+#define _FAST_SWISSTABLE_H
+
+#include "fast_hashtable.h"
+
+/*
+ * open addressing alternative to fast_hashtable_t with the same intrusive
+ * fast_hashtable_link_t. a slot keeps the link, the full hash and, when
+ * cmp is NULL and the key is short, a copy of the key, so a lookup
+ * compares without touching the link. each slot has a control byte with
+ * 7 bits of the hash, a probe tests a group of them at once (16 with
+ * SSE2, 8 in a 64 bit word otherwise).
+ *
+ * hash_func, if given, is called with (size_t)-1 as the table size and
+ * its result is mixed again, NULL picks fast_hash64. with a NULL cmp the
+ * keys are compared bytewise. the table grows by doubling at 7/8 load,
+ * links must not change their key while joined.
+ */
+
+#define FAST_SWISSTABLE_INLINE_KEY   12
+#define FAST_SWISSTABLE_MIN_SIZE     16
+
+typedef struct fast_swisstable_slot_s {
+    fast_hashtable_link_t   *link;
+    uint64_t                 hash;
+    uint32_t                 len;
+    uchar_t                  key[FAST_SWISSTABLE_INLINE_KEY];
+} fast_swisstable_slot_t;
+
+typedef struct fast_swisstable_s {
+    uchar_t                  *ctrl;       // size + group control bytes
+    fast_swisstable_slot_t   *slots;
+    FAST_HASHTABLE_CMP       *cmp;        // NULL compares bytewise
+    FAST_HASHTABLE_HASH      *hash;       // NULL uses fast_hash64
+    fast_mem_allocator_t     *allocator;  // create on shmem
+    size_t                    size;       // slot number, power of 2
+    size_t                    count;      // links joined
+    size_t                    deleted;    // slots left as tombstones
+} fast_swisstable_t;
+
+fast_swisstable_t *
+fast_swisstable_create(FAST_HASHTABLE_CMP *cmp_func, size_t hash_sz,
+    FAST_HASHTABLE_HASH *hash_func, fast_mem_allocator_t *allocator);
+
+int fast_swisstable_init(fast_swisstable_t *st, FAST_HASHTABLE_CMP *cmp_func,
+    size_t hash_sz, FAST_HASHTABLE_HASH *hash_func, fast_mem_allocator_t *);
+int   fast_swisstable_empty(fast_swisstable_t *st);
+int   fast_swisstable_join(fast_swisstable_t *, fast_hashtable_link_t *);
+int   fast_swisstable_remove_link(fast_swisstable_t *, fast_hashtable_link_t *);
+void *fast_swisstable_lookup(fast_swisstable_t *, const void *, size_t len);
+void  fast_swisstable_free_memory(fast_swisstable_t *);
+void  fast_swisstable_free_items(fast_swisstable_t *st,
+    void (*free_object_func)(void*), void*);
+
+#endif
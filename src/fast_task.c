@@ -0,0 +1,602 @@
+#include "fast_task.h"
+#include "fast_memory.h"
+#include "fast_sys.h"
+
+#define FAST_TASK_DEQUE_MASK    (FAST_TASK_DEQUE_SIZE - 1)
+
+//pieces of a parallel for, shared by the caller and the helpers
+typedef struct fast_task_for_s {
+    fast_task_for_pt        body;
+    void                   *data;
+    size_t                  end;
+    size_t                  grain;
+    volatile size_t         next;       // start of the next piece
+    volatile size_t         left;       // pieces not through yet
+    volatile size_t         refs;       // caller and helpers
+    size_t                  size;
+    fast_task_t            *finish;     // _post: goes to loop at the end
+    fast_task_loop_t       *loop;
+    fast_task_t             helpers[];
+} fast_task_for_t;
+
+static __thread fast_task_worker_t *fast_task_self;
+
+static void *fast_task_worker_cycle(void *arg);
+static fast_task_t *fast_task_find(fast_task_worker_t *w);
+static int  fast_task_has_work(fast_task_sched_t *sched);
+static void fast_task_wake(fast_task_sched_t *sched);
+static void fast_task_finish(fast_task_loop_t *loop, fast_task_t *task);
+static void fast_task_loop_handler(void *data);
+static fast_task_for_t *fast_task_for_create(fast_task_sched_t *sched,
+    size_t begin, size_t end, size_t grain, fast_task_for_pt body,
+    void *data, size_t *helpers);
+static void fast_task_for_work(fast_task_for_t *f);
+static void fast_task_for_helper(fast_task_t *task);
+static void fast_task_for_release(fast_task_for_t *f);
+
+static int
+fast_task_deque_push(fast_task_deque_t *d, fast_task_t *task)
+{
+    int64_t b, t;
+
+    b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= FAST_TASK_DEQUE_SIZE) {
+        return FAST_TASK_BUSY;
+    }
+    __atomic_store_n(&d->tasks[b & FAST_TASK_DEQUE_MASK], task,
+        __ATOMIC_RELAXED);
+    //the task is there before a thief sees the new bottom
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+
+    return FAST_TASK_OK;
+}
+
+static fast_task_t *
+fast_task_deque_pop(fast_task_deque_t *d)
+{
+    fast_task_t    *task;
+    int64_t         b, t;
+
+    b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    //the bottom taken back is seen before top is read, or a thief and
+    //the owner both get the last task
+    __sync_synchronize();
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    task = __atomic_load_n(&d->tasks[b & FAST_TASK_DEQUE_MASK],
+        __ATOMIC_RELAXED);
+    if (t == b) {
+        //the last one, the thieves may want it too
+        if (!__sync_bool_compare_and_swap(&d->top, t, t + 1)) {
+            task = NULL;
+        }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static fast_task_t *
+fast_task_deque_steal(fast_task_deque_t *d)
+{
+    fast_task_t    *task;
+    int64_t         b, t;
+
+    t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __sync_synchronize();
+    b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    task = __atomic_load_n(&d->tasks[t & FAST_TASK_DEQUE_MASK],
+        __ATOMIC_RELAXED);
+    if (!__sync_bool_compare_and_swap(&d->top, t, t + 1)) {
+        //lost to the owner or another thief
+        return NULL;
+    }
+    return task;
+}
+
+fast_task_sched_t *
+fast_task_sched_create(size_t workers)
+{
+    fast_task_sched_t  *sched;
+    fast_task_worker_t *w;
+    sys_info_t          info;
+    size_t              i;
+
+    if (!workers) {
+        memory_zero(&info, sizeof(sys_info_t));
+        sys_get_info(&info);
+        workers = info.cpu_num > 0 ? (size_t)info.cpu_num : 1;
+    }
+
+    sched = memory_calloc(sizeof(fast_task_sched_t));
+    if (!sched) {
+        return NULL;
+    }
+    sched->workers = memory_memalign(DEFAULT_CACHELINE_SIZE,
+        workers * sizeof(fast_task_worker_t));
+    if (!sched->workers) {
+        goto failed;
+    }
+    memory_zero(sched->workers, workers * sizeof(fast_task_worker_t));
+
+    sched->ring = fast_ring_create(FAST_RING_MPMC, FAST_TASK_RING_SIZE,
+        sizeof(fast_task_t *), NULL);
+    if (!sched->ring) {
+        goto failed;
+    }
+    if (pthread_mutex_init(&sched->lock, NULL)) {
+        goto failed;
+    }
+    if (pthread_cond_init(&sched->cond, NULL)) {
+        pthread_mutex_destroy(&sched->lock);
+        goto failed;
+    }
+
+    //all set before the first worker looks for a victim
+    sched->nworkers = workers;
+    for (i = 0; i < workers; i++) {
+        w = &sched->workers[i];
+        w->sched = sched;
+        w->id = i;
+        w->seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+    }
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&sched->workers[i].tid, NULL,
+            fast_task_worker_cycle, &sched->workers[i]))
+        {
+            break;
+        }
+    }
+    if (i < workers) {
+        pthread_mutex_lock(&sched->lock);
+        sched->stop = 1;
+        pthread_cond_broadcast(&sched->cond);
+        pthread_mutex_unlock(&sched->lock);
+        while (i--) {
+            pthread_join(sched->workers[i].tid, NULL);
+        }
+        pthread_cond_destroy(&sched->cond);
+        pthread_mutex_destroy(&sched->lock);
+        goto failed;
+    }
+
+    return sched;
+
+failed:
+    fast_ring_free(sched->ring);
+    if (sched->workers) {
+        memory_free(sched->workers, 0);
+    }
+    memory_free(sched, sizeof(fast_task_sched_t));
+    return NULL;
+}
+
+void
+fast_task_sched_destroy(fast_task_sched_t *sched)
+{
+    size_t  i;
+
+    if (!sched) {
+        return;
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    sched->stop = 1;
+    pthread_cond_broadcast(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+
+    for (i = 0; i < sched->nworkers; i++) {
+        pthread_join(sched->workers[i].tid, NULL);
+    }
+
+    pthread_cond_destroy(&sched->cond);
+    pthread_mutex_destroy(&sched->lock);
+    fast_ring_free(sched->ring);
+    memory_free(sched->workers, 0);
+    memory_free(sched, sizeof(fast_task_sched_t));
+}
+
+int
+fast_task_sched_get_stat(fast_task_sched_t *sched, fast_task_stat_t *stat)
+{
+    size_t  i;
+
+    if (!sched || !stat) {
+        return FAST_TASK_ERROR;
+    }
+    memory_zero(stat, sizeof(fast_task_stat_t));
+    stat->workers = sched->nworkers;
+    stat->posted = sched->posted;
+    stat->busy = sched->busy;
+    for (i = 0; i < sched->nworkers; i++) {
+        stat->executed += sched->workers[i].executed;
+        stat->steals += sched->workers[i].steals;
+    }
+
+    return FAST_TASK_OK;
+}
+
+int
+fast_task_loop_init(fast_task_loop_t *loop, fast_task_sched_t *sched,
+    event_base_t *base)
+{
+    if (!loop || !sched || !base) {
+        return FAST_TASK_ERROR;
+    }
+    loop->sched = sched;
+    loop->finished = NULL;
+    loop->woken = 0;
+
+    if (notice_init(base, &loop->notice, fast_task_loop_handler, loop)
+        != FAST_OK)
+    {
+        return FAST_TASK_ERROR;
+    }
+    return FAST_TASK_OK;
+}
+
+int
+fast_task_post(fast_task_sched_t *sched, fast_task_t *task,
+    fast_task_loop_t *loop)
+{
+    fast_task_worker_t *self = fast_task_self;
+
+    if (!sched || !task || !task->run) {
+        return FAST_TASK_ERROR;
+    }
+    task->loop = loop;
+    task->next = NULL;
+
+    if (self && self->sched == sched
+        && fast_task_deque_push(&self->deque, task) == FAST_TASK_OK)
+    {
+        __sync_fetch_and_add(&sched->posted, 1);
+        //the push is seen before sleepers is read, the sleeper checks
+        //for work after it counts itself
+        __sync_synchronize();
+        fast_task_wake(sched);
+        return FAST_TASK_OK;
+    }
+
+    if (fast_ring_mpmc_push(sched->ring, &task) != FAST_RING_OK) {
+        if (self && self->sched == sched) {
+            //a worker with a full deque and a full ring does it itself
+            task->run(task);
+            self->executed++;
+            if (loop) {
+                fast_task_finish(loop, task);
+            }
+            return FAST_TASK_OK;
+        }
+        __sync_fetch_and_add(&sched->busy, 1);
+        return FAST_TASK_BUSY;
+    }
+    __sync_fetch_and_add(&sched->posted, 1);
+    fast_task_wake(sched);
+
+    return FAST_TASK_OK;
+}
+
+int
+fast_task_parallel_for(fast_task_sched_t *sched, size_t begin, size_t end,
+    size_t grain, fast_task_for_pt body, void *data)
+{
+    fast_task_for_t    *f;
+    size_t              i, helpers;
+
+    if (!sched || !body || begin > end) {
+        return FAST_TASK_ERROR;
+    }
+    if (begin == end) {
+        return FAST_TASK_OK;
+    }
+
+    f = fast_task_for_create(sched, begin, end, grain, body, data, &helpers);
+    if (!f) {
+        return FAST_TASK_ERROR;
+    }
+    //the caller takes a share, one helper less
+    if (helpers) {
+        helpers--;
+    }
+    f->refs = helpers + 1;
+    for (i = 0; i < helpers; i++) {
+        if (fast_task_post(sched, &f->helpers[i], NULL) != FAST_TASK_OK) {
+            __sync_fetch_and_sub(&f->refs, 1);
+        }
+    }
+
+    fast_task_for_work(f);
+    //what is left is in the hands of helpers already running it
+    while (f->left) {
+        sched_yield();
+    }
+    fast_task_for_release(f);
+
+    return FAST_TASK_OK;
+}
+
+int
+fast_task_parallel_for_post(fast_task_sched_t *sched, fast_task_loop_t *loop,
+    fast_task_t *task, size_t begin, size_t end, size_t grain,
+    fast_task_for_pt body)
+{
+    fast_task_for_t    *f;
+    size_t              i, helpers, posted = 0;
+
+    if (!sched || !loop || !task || !body || begin >= end) {
+        return FAST_TASK_ERROR;
+    }
+
+    f = fast_task_for_create(sched, begin, end, grain, body, task->data,
+        &helpers);
+    if (!f) {
+        return FAST_TASK_ERROR;
+    }
+    task->loop = loop;
+    task->next = NULL;
+    f->finish = task;
+    f->loop = loop;
+
+    //one reference held until all helpers are out, so none frees early
+    f->refs = helpers + 1;
+    for (i = 0; i < helpers; i++) {
+        if (fast_task_post(sched, &f->helpers[i], NULL) == FAST_TASK_OK) {
+            posted++;
+        } else {
+            __sync_fetch_and_sub(&f->refs, 1);
+        }
+    }
+    if (!posted) {
+        memory_free(f, f->size);
+        return FAST_TASK_BUSY;
+    }
+    fast_task_for_release(f);
+
+    return FAST_TASK_OK;
+}
+
+static void *
+fast_task_worker_cycle(void *arg)
+{
+    fast_task_worker_t *w = arg;
+    fast_task_sched_t  *sched = w->sched;
+    fast_task_loop_t   *loop;
+    fast_task_t        *task;
+    size_t              idle = 0;
+
+    fast_task_self = w;
+
+    for ( ;; ) {
+        task = fast_task_find(w);
+        if (task) {
+            //a task with no loop may be gone once it has run
+            loop = task->loop;
+            task->run(task);
+            w->executed++;
+            if (loop) {
+                fast_task_finish(loop, task);
+            }
+            idle = 0;
+            continue;
+        }
+
+        if (sched->stop) {
+            break;
+        }
+        if (++idle < FAST_TASK_SPIN) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&sched->lock);
+        __sync_fetch_and_add(&sched->sleepers, 1);
+        if (!sched->stop && !fast_task_has_work(sched)) {
+            pthread_cond_wait(&sched->cond, &sched->lock);
+        }
+        __sync_fetch_and_sub(&sched->sleepers, 1);
+        pthread_mutex_unlock(&sched->lock);
+        idle = 0;
+    }
+
+    fast_task_self = NULL;
+    return NULL;
+}
+
+//its own deque, the shared ring, then the others' deques
+static fast_task_t *
+fast_task_find(fast_task_worker_t *w)
+{
+    fast_task_sched_t  *sched = w->sched;
+    fast_task_t        *task;
+    size_t              i, victim;
+
+    task = fast_task_deque_pop(&w->deque);
+    if (task) {
+        return task;
+    }
+    if (fast_ring_mpmc_pop(sched->ring, &task) == FAST_RING_OK) {
+        return task;
+    }
+    if (sched->nworkers < 2) {
+        return NULL;
+    }
+
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    victim = w->seed % sched->nworkers;
+    for (i = 0; i < sched->nworkers; i++, victim++) {
+        if (victim == sched->nworkers) {
+            victim = 0;
+        }
+        if (victim == w->id) {
+            continue;
+        }
+        task = fast_task_deque_steal(&sched->workers[victim].deque);
+        if (task) {
+            w->steals++;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static int
+fast_task_has_work(fast_task_sched_t *sched)
+{
+    fast_task_deque_t  *d;
+    size_t              i;
+
+    if (fast_ring_count(sched->ring)) {
+        return 1;
+    }
+    for (i = 0; i < sched->nworkers; i++) {
+        d = &sched->workers[i].deque;
+        if (d->bottom > d->top) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+fast_task_wake(fast_task_sched_t *sched)
+{
+    if (!sched->sleepers) {
+        return;
+    }
+    pthread_mutex_lock(&sched->lock);
+    pthread_cond_signal(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * the finished list only grows here and is only taken whole by the loop,
+ * a push never sees a node come back: no ABA
+ */
+static void
+fast_task_finish(fast_task_loop_t *loop, fast_task_t *task)
+{
+    fast_task_t    *head;
+
+    do {
+        head = __atomic_load_n(&loop->finished, __ATOMIC_RELAXED);
+        task->next = head;
+    } while (!__sync_bool_compare_and_swap(&loop->finished, head, task));
+
+    if (!__sync_lock_test_and_set(&loop->woken, 1)) {
+        notice_wake_up(&loop->notice);
+    }
+}
+
+static void
+fast_task_loop_handler(void *data)
+{
+    fast_task_loop_t   *loop = data;
+    fast_task_t        *list, *task, *prev = NULL;
+
+    //cleared first: a task finished from now on writes the pipe again
+    __sync_lock_release(&loop->woken);
+    __sync_synchronize();
+    list = __sync_lock_test_and_set(&loop->finished, NULL);
+
+    //newest first as pushed, done handlers run in finishing order
+    while (list) {
+        task = list;
+        list = task->next;
+        task->next = prev;
+        prev = task;
+    }
+    while (prev) {
+        task = prev;
+        prev = task->next;
+        task->next = NULL;
+        if (task->done) {
+            task->done(task);
+        }
+    }
+}
+
+static fast_task_for_t *
+fast_task_for_create(fast_task_sched_t *sched, size_t begin, size_t end,
+    size_t grain, fast_task_for_pt body, void *data, size_t *helpers)
+{
+    fast_task_for_t    *f;
+    size_t              pieces, n, i, size;
+
+    if (!grain) {
+        //four pieces a worker evens out the slow ones
+        grain = (end - begin) / (sched->nworkers * 4);
+        if (!grain) {
+            grain = 1;
+        }
+    }
+    pieces = (end - begin - 1) / grain + 1;
+    n = pieces < sched->nworkers ? pieces : sched->nworkers;
+
+    size = sizeof(fast_task_for_t) + n * sizeof(fast_task_t);
+    f = memory_calloc(size);
+    if (!f) {
+        return NULL;
+    }
+    f->body = body;
+    f->data = data;
+    f->next = begin;
+    f->end = end;
+    f->grain = grain;
+    f->left = pieces;
+    f->size = size;
+    for (i = 0; i < n; i++) {
+        f->helpers[i].run = fast_task_for_helper;
+        f->helpers[i].data = f;
+    }
+    *helpers = n;
+
+    return f;
+}
+
+static void
+fast_task_for_work(fast_task_for_t *f)
+{
+    size_t  b, e;
+
+    for ( ;; ) {
+        //past end by a grain a taker at most, end is far from overflow
+        b = __sync_fetch_and_add(&f->next, f->grain);
+        if (b >= f->end) {
+            return;
+        }
+        e = f->end - b > f->grain ? b + f->grain : f->end;
+        f->body(b, e, f->data);
+
+        if (__sync_sub_and_fetch(&f->left, 1) == 0 && f->finish) {
+            fast_task_finish(f->loop, f->finish);
+        }
+    }
+}
+
+static void
+fast_task_for_helper(fast_task_t *task)
+{
+    fast_task_for_t *f = task->data;
+
+    fast_task_for_work(f);
+    fast_task_for_release(f);
+}
+
+static void
+fast_task_for_release(fast_task_for_t *f)
+{
+    if (__sync_sub_and_fetch(&f->refs, 1) == 0) {
+        memory_free(f, f->size);
+    }
+}
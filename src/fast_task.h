@@ -0,0 +1,129 @@
+#ifndef _FAST_TASK_H
+#define _FAST_TASK_H
+
+#include <pthread.h>
+#include "fast_types.h"
+#include "fast_memory_pool.h"
+#include "fast_notice.h"
+#include "fast_ring.h"
+
+/*
+ * work stealing thread pool for cpu bound jobs that must not hold up an
+ * event loop. each worker owns a Chase-Lev deque: it pushes and pops its
+ * own end, idle workers steal from the other. tasks posted from outside
+ * the pool go through a shared MPMC ring the workers drain.
+ *
+ * a task posted with a fast_task_loop_t comes back to that loop: the
+ * worker pushes it on the loop's finished list and wakes the loop's
+ * notice_t, the loop thread runs the done handlers. a burst of finished
+ * tasks costs one pipe write.
+ *
+ * tasks are the caller's memory, like event_t: kept until done has run,
+ * or until run returns for a task posted with no loop.
+ */
+
+#define FAST_TASK_OK            (0)
+#define FAST_TASK_ERROR         (-1)
+#define FAST_TASK_BUSY          (1)     // the shared ring is full
+
+#define FAST_TASK_DEQUE_SIZE    4096
+#define FAST_TASK_RING_SIZE     4096
+//rounds of looking for work before a worker sleeps
+#define FAST_TASK_SPIN          64
+
+typedef struct fast_task_s       fast_task_t;
+typedef struct fast_task_loop_s  fast_task_loop_t;
+typedef struct fast_task_sched_s fast_task_sched_t;
+
+typedef void (*fast_task_pt)(fast_task_t *task);
+//body of a parallel for over [begin, end)
+typedef void (*fast_task_for_pt)(size_t begin, size_t end, void *data);
+
+struct fast_task_s {
+    fast_task_pt            run;        // on a worker
+    fast_task_pt            done;       // on the loop thread, may be NULL
+    void                   *data;
+    fast_task_loop_t       *loop;       // set by fast_task_post
+    fast_task_t            *next;       // on the finished list
+};
+
+/*
+ * Chase-Lev deque: the owner works at bottom without a lock, thieves
+ * take from top with a compare and swap
+ */
+typedef struct fast_task_deque_s {
+    volatile int64_t        top;
+    char                    pad0[DEFAULT_CACHELINE_SIZE - sizeof(int64_t)];
+    volatile int64_t        bottom;
+    char                    pad1[DEFAULT_CACHELINE_SIZE - sizeof(int64_t)];
+    fast_task_t            *tasks[FAST_TASK_DEQUE_SIZE];
+} fast_task_deque_t;
+
+typedef struct fast_task_worker_s {
+    fast_task_deque_t       deque;
+    fast_task_sched_t      *sched;
+    pthread_t               tid;
+    size_t                  id;
+    uint64_t                seed;       // picks victims
+    size_t                  executed;
+    size_t                  steals;
+} __attribute__((aligned(DEFAULT_CACHELINE_SIZE))) fast_task_worker_t;
+
+typedef struct fast_task_stat_s {
+    size_t                  workers;
+    size_t                  posted;
+    size_t                  executed;
+    size_t                  steals;
+    size_t                  busy;       // posts refused, the ring was full
+} fast_task_stat_t;
+
+struct fast_task_sched_s {
+    fast_task_worker_t     *workers;
+    size_t                  nworkers;
+    fast_ring_t            *ring;       // posts from outside the pool
+    pthread_mutex_t         lock;       // sleeping workers
+    pthread_cond_t          cond;
+    volatile size_t         sleepers;
+    volatile int            stop;
+    volatile size_t         posted;
+    volatile size_t         busy;
+};
+
+struct fast_task_loop_s {
+    notice_t                notice;
+    fast_task_sched_t      *sched;
+    fast_task_t * volatile  finished;   // pushed by workers, newest first
+    volatile int            woken;      // a wake up is on its way
+};
+
+//workers 0 takes one per online cpu
+fast_task_sched_t *fast_task_sched_create(size_t workers);
+//runs what was posted, then joins the workers
+void fast_task_sched_destroy(fast_task_sched_t *sched);
+int  fast_task_sched_get_stat(fast_task_sched_t *sched,
+    fast_task_stat_t *stat);
+
+//the loop's end of the pool, on the loop thread
+int  fast_task_loop_init(fast_task_loop_t *loop, fast_task_sched_t *sched,
+    event_base_t *base);
+
+/*
+ * loop NULL for no done handler. from a worker the task goes on its own
+ * deque, from anywhere else on the shared ring
+ */
+int  fast_task_post(fast_task_sched_t *sched, fast_task_t *task,
+    fast_task_loop_t *loop);
+
+/*
+ * body over [begin, end) in pieces of grain, the workers take pieces as
+ * they come free. the caller takes pieces too and returns when all are
+ * done, from a loop thread use fast_task_parallel_for_post
+ */
+int  fast_task_parallel_for(fast_task_sched_t *sched, size_t begin,
+    size_t end, size_t grain, fast_task_for_pt body, void *data);
+//done(task) runs on the loop when the last piece is through
+int  fast_task_parallel_for_post(fast_task_sched_t *sched,
+    fast_task_loop_t *loop, fast_task_t *task, size_t begin, size_t end,
+    size_t grain, fast_task_for_pt body);
+
+#endif
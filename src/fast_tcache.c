@@ -0,0 +1,682 @@
+#include "fast_tcache.h"
+#include "fast_queue.h"
+#include "fast_lock.h"
+#include "fast_mem_governor.h"
+
+#define FAST_TCACHE_CLASS_LARGE     FAST_TCACHE_CLASSES
+#define FAST_TCACHE_PAGE_SIZE       4096
+#define FAST_TCACHE_SIZE_MAX        ((size_t)1 << 46)
+
+#define fast_tcache_span_of(p) \
+    ((fast_tcache_span_t *)((uintptr_t)(p) & ~(FAST_TCACHE_SPAN_SIZE - 1)))
+
+#define fast_tcache_class_of(size) \
+    ((size) <= 1024 ? fast_tcache_small_index[((size) + 15) >> 4] \
+                    : fast_tcache_big_index[((size) + 127) >> 7])
+
+#define fast_tcache_lock_on(l) do { \
+    fast_lock_errno_t error; \
+    fast_atomic_lock_on((l), &error); \
+} while (0)
+
+#define fast_tcache_lock_off(l) do { \
+    fast_lock_errno_t error; \
+    fast_atomic_lock_off((l), &error); \
+} while (0)
+
+typedef struct fast_tcache_span_s {
+    queue_t          q;          //central list or page heap free list
+    void            *free;       //objects given back to this span
+    uchar_t         *fresh;      //start of the never used tail
+    uint32_t         cls;
+    uint32_t         used;       //objects handed out to thread caches
+    uint32_t         in_list;    //on the central list of its class
+    uint32_t         released;   //pages behind the header madvise'd
+    size_t           size;       //object size, mapped length if large
+    int64_t          idle_since;
+} fast_tcache_span_t;
+
+typedef struct fast_tcache_central_s {
+    fast_atomic_lock_t   lock;
+    queue_t              spans;  //spans with free or fresh objects
+} fast_tcache_central_t;
+
+typedef struct fast_tcache_heap_s {
+    fast_atomic_lock_t   lock;
+    queue_t              free;   //most recently freed at head
+    queue_t              large;  //cached large mappings, newest at head
+    uchar_t             *cur;    //uncarved part of the last chunk
+    uchar_t             *end;
+    int64_t              last_scavenge;
+    fast_tcache_stat_t   stat;
+} fast_tcache_heap_t;
+
+typedef struct fast_tcache_bin_s {
+    void            *head;
+    uint32_t         count;
+    uint32_t         max;
+} fast_tcache_bin_t;
+
+typedef struct fast_tcache_thread_s {
+    fast_tcache_bin_t    bins[FAST_TCACHE_CLASSES];
+} fast_tcache_thread_t;
+
+static size_t                 fast_tcache_sizes[FAST_TCACHE_CLASSES];
+static uint8_t                fast_tcache_small_index[1024 / 16 + 1];
+static uint8_t                fast_tcache_big_index[FAST_TCACHE_MAX_SMALL / 128 + 1];
+static fast_tcache_central_t  fast_tcache_central[FAST_TCACHE_CLASSES];
+static fast_tcache_heap_t     fast_tcache_heap;
+static pthread_once_t         fast_tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t          fast_tcache_key;
+static int                    fast_tcache_inited;
+static __thread fast_tcache_thread_t *fast_tcache_tls;
+
+static void fast_tcache_init_once(void);
+static void fast_tcache_thread_exit(void *data);
+static fast_tcache_thread_t *fast_tcache_thread_get(void);
+static int64_t fast_tcache_now_msec(void);
+static void *fast_tcache_map(size_t len);
+static fast_tcache_span_t *fast_tcache_span_acquire(uint32_t cls);
+static void fast_tcache_span_release(fast_tcache_span_t *span);
+static size_t fast_tcache_scavenge(int64_t now, int64_t idle_msec);
+static void fast_tcache_fetch(uint32_t cls, fast_tcache_bin_t *bin);
+static void fast_tcache_put(uint32_t cls, void *head);
+static void *fast_tcache_large_alloc(size_t size, size_t alignment);
+static void fast_tcache_large_free(fast_tcache_span_t *span);
+
+int
+fast_tcache_init(void)
+{
+    if (pthread_once(&fast_tcache_once, fast_tcache_init_once) != 0
+        || !fast_tcache_inited) {
+        return FAST_TCACHE_ERROR;
+    }
+    return FAST_TCACHE_OK;
+}
+
+void *
+fast_tcache_alloc(size_t size)
+{
+    fast_tcache_thread_t *tc;
+    fast_tcache_bin_t    *bin;
+    uint32_t              cls;
+    void                 *p;
+
+    if (size > FAST_TCACHE_MAX_SMALL) {
+        return fast_tcache_large_alloc(size, FAST_TCACHE_SPAN_HEADER);
+    }
+    tc = fast_tcache_thread_get();
+    if (!tc) {
+        return NULL;
+    }
+    cls = fast_tcache_class_of(size);
+    bin = &tc->bins[cls];
+    if (!bin->head) {
+        fast_tcache_fetch(cls, bin);
+        if (!bin->head) {
+            return NULL;
+        }
+    }
+    p = bin->head;
+    bin->head = *(void **)p;
+    bin->count--;
+
+    return p;
+}
+
+void *
+fast_tcache_calloc(size_t size)
+{
+    void *p = fast_tcache_alloc(size);
+
+    if (p) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+void
+fast_tcache_free(void *p, size_t size_hint)
+{
+    fast_tcache_thread_t *tc;
+    fast_tcache_span_t   *span;
+    fast_tcache_bin_t    *bin;
+    uint32_t              cls, n;
+    void                 *head, *tail;
+
+    if (!p) {
+        return;
+    }
+    //the class is the span's, not the hint's: callers free with sizes
+    //other than the one they asked for, a block in another class's bin
+    //would have its span changed under the wrong central lock
+    span = fast_tcache_span_of(p);
+    if (span->cls == FAST_TCACHE_CLASS_LARGE) {
+        fast_tcache_large_free(span);
+        return;
+    }
+    cls = span->cls;
+
+    tc = fast_tcache_thread_get();
+    if (!tc) {
+        *(void **)p = NULL;
+        fast_tcache_put(cls, p);
+        return;
+    }
+    bin = &tc->bins[cls];
+    *(void **)p = bin->head;
+    bin->head = p;
+    if (++bin->count <= bin->max) {
+        return;
+    }
+
+    //keep half of the cache, the rest goes back in one batch
+    head = bin->head;
+    for (tail = head, n = 1; n < bin->max / 2; n++) {
+        tail = *(void **)tail;
+    }
+    bin->head = *(void **)tail;
+    bin->count -= n;
+    *(void **)tail = NULL;
+    fast_tcache_put(cls, head);
+}
+
+void *
+fast_tcache_realloc(void *p, size_t size)
+{
+    size_t  usable;
+    void   *np;
+
+    if (!p) {
+        return fast_tcache_alloc(size);
+    }
+    if (!size) {
+        fast_tcache_free(p, 0);
+        return NULL;
+    }
+    usable = fast_tcache_usable_size(p);
+    //shrinking to less than half moves to a smaller class
+    if (size <= usable && size > usable / 2) {
+        return p;
+    }
+    np = fast_tcache_alloc(size);
+    if (!np) {
+        return NULL;
+    }
+    memcpy(np, p, size < usable ? size : usable);
+    fast_tcache_free(p, 0);
+
+    return np;
+}
+
+void *
+fast_tcache_memalign(size_t alignment, size_t size)
+{
+    if (!alignment || (alignment & (alignment - 1))
+        || alignment >= FAST_TCACHE_SPAN_SIZE) {
+        return NULL;
+    }
+    //every class is a multiple of 16 and spans start 64 bytes aligned
+    if (alignment <= 16) {
+        return fast_tcache_alloc(size);
+    }
+    return fast_tcache_large_alloc(size, alignment > FAST_TCACHE_SPAN_HEADER
+        ? alignment : FAST_TCACHE_SPAN_HEADER);
+}
+
+size_t
+fast_tcache_usable_size(void *p)
+{
+    fast_tcache_span_t *span;
+
+    if (!p) {
+        return 0;
+    }
+    span = fast_tcache_span_of(p);
+    if (span->cls == FAST_TCACHE_CLASS_LARGE) {
+        return span->size - ((uchar_t *)p - (uchar_t *)span);
+    }
+    return fast_tcache_sizes[span->cls];
+}
+
+void
+fast_tcache_thread_flush(void)
+{
+    fast_tcache_thread_t *tc = fast_tcache_tls;
+    fast_tcache_bin_t    *bin;
+    uint32_t              cls;
+
+    if (!tc) {
+        return;
+    }
+    for (cls = 0; cls < FAST_TCACHE_CLASSES; cls++) {
+        bin = &tc->bins[cls];
+        if (bin->head) {
+            fast_tcache_put(cls, bin->head);
+            bin->head = NULL;
+            bin->count = 0;
+        }
+    }
+}
+
+size_t
+fast_tcache_release_idle(int64_t idle_msec)
+{
+    size_t bytes;
+
+    if (!fast_tcache_inited) {
+        return 0;
+    }
+    fast_tcache_lock_on(&fast_tcache_heap.lock);
+    bytes = fast_tcache_scavenge(fast_tcache_now_msec(), idle_msec);
+    fast_tcache_lock_off(&fast_tcache_heap.lock);
+
+    return bytes;
+}
+
+void
+fast_tcache_get_stat(fast_tcache_stat_t *stat)
+{
+    if (!stat) {
+        return;
+    }
+    if (!fast_tcache_inited) {
+        memset(stat, 0, sizeof(fast_tcache_stat_t));
+        return;
+    }
+    fast_tcache_lock_on(&fast_tcache_heap.lock);
+    *stat = fast_tcache_heap.stat;
+    fast_tcache_lock_off(&fast_tcache_heap.lock);
+}
+
+static void
+fast_tcache_init_once(void)
+{
+    size_t    base, step, s;
+    uint32_t  n = 0, i;
+
+    for (s = 16; s <= 128; s += 16) {
+        fast_tcache_sizes[n++] = s;
+    }
+    for (base = 128; base < FAST_TCACHE_MAX_SMALL; base *= 2) {
+        step = base / 4;
+        for (s = base + step; s <= base * 2; s += step) {
+            fast_tcache_sizes[n++] = s;
+        }
+    }
+    assert(n == FAST_TCACHE_CLASSES);
+
+    for (i = 0, n = 0; i <= 1024 / 16; i++) {
+        while (fast_tcache_sizes[n] < i * 16) {
+            n++;
+        }
+        fast_tcache_small_index[i] = n;
+    }
+    for (i = 0, n = 0; i <= FAST_TCACHE_MAX_SMALL / 128; i++) {
+        while (fast_tcache_sizes[n] < i * 128) {
+            n++;
+        }
+        fast_tcache_big_index[i] = n;
+    }
+
+    for (i = 0; i < FAST_TCACHE_CLASSES; i++) {
+        fast_atomic_lock_init(&fast_tcache_central[i].lock);
+        queue_init(&fast_tcache_central[i].spans);
+    }
+    fast_atomic_lock_init(&fast_tcache_heap.lock);
+    queue_init(&fast_tcache_heap.free);
+    queue_init(&fast_tcache_heap.large);
+    fast_tcache_heap.last_scavenge = fast_tcache_now_msec();
+
+    if (pthread_key_create(&fast_tcache_key, fast_tcache_thread_exit) != 0) {
+        return;
+    }
+    fast_tcache_inited = 1;
+}
+
+static void
+fast_tcache_thread_exit(void *data)
+{
+    fast_tcache_thread_t *tc = data;
+
+    if (!tc) {
+        return;
+    }
+    fast_tcache_tls = tc;
+    fast_tcache_thread_flush();
+    fast_tcache_tls = NULL;
+    free(tc);
+}
+
+static fast_tcache_thread_t *
+fast_tcache_thread_get(void)
+{
+    fast_tcache_thread_t *tc = fast_tcache_tls;
+    uint32_t              cls, max;
+
+    if (tc) {
+        return tc;
+    }
+    if (fast_tcache_init() != FAST_TCACHE_OK) {
+        return NULL;
+    }
+    tc = calloc(1, sizeof(fast_tcache_thread_t));
+    if (!tc) {
+        return NULL;
+    }
+    for (cls = 0; cls < FAST_TCACHE_CLASSES; cls++) {
+        max = FAST_TCACHE_CACHE_BYTES / fast_tcache_sizes[cls];
+        tc->bins[cls].max = max < 4 ? 4 : (max > 256 ? 256 : max);
+    }
+    pthread_setspecific(fast_tcache_key, tc);
+    fast_tcache_tls = tc;
+
+    return tc;
+}
+
+static int64_t
+fast_tcache_now_msec(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//len bytes starting at a FAST_TCACHE_SPAN_SIZE boundary
+static void *
+fast_tcache_map(size_t len)
+{
+    uchar_t *addr, *aligned;
+    size_t   lead, trail;
+
+    addr = mmap(NULL, len + FAST_TCACHE_SPAN_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = fast_align_ptr(addr, FAST_TCACHE_SPAN_SIZE);
+    lead = aligned - addr;
+    trail = FAST_TCACHE_SPAN_SIZE - lead;
+    if (lead) {
+        munmap(addr, lead);
+    }
+    if (trail) {
+        munmap(aligned + len, trail);
+    }
+    return aligned;
+}
+
+static fast_tcache_span_t *
+fast_tcache_span_acquire(uint32_t cls)
+{
+    fast_tcache_heap_t   *heap = &fast_tcache_heap;
+    fast_tcache_span_t   *span = NULL;
+    queue_t              *q;
+    size_t                len;
+
+    fast_tcache_lock_on(&heap->lock);
+    if (!queue_empty(&heap->free)) {
+        q = queue_head(&heap->free);
+        queue_remove(q);
+        span = queue_data(q, fast_tcache_span_t, q);
+        if (span->released) {
+            heap->stat.released -= FAST_TCACHE_SPAN_SIZE - FAST_TCACHE_PAGE_SIZE;
+            mem_governor_charge(FAST_TCACHE_SPAN_SIZE - FAST_TCACHE_PAGE_SIZE);
+        }
+        heap->stat.spans_free--;
+
+    } else {
+        if (heap->cur == heap->end) {
+            len = FAST_TCACHE_SPAN_SIZE * FAST_TCACHE_CHUNK_SPANS;
+            heap->cur = fast_tcache_map(len);
+            if (!heap->cur) {
+                heap->end = NULL;
+                fast_tcache_lock_off(&heap->lock);
+                return NULL;
+            }
+            heap->end = heap->cur + len;
+            heap->stat.mapped += len;
+            mem_governor_charge(len);
+        }
+        span = (fast_tcache_span_t *)heap->cur;
+        heap->cur += FAST_TCACHE_SPAN_SIZE;
+    }
+    heap->stat.spans_used++;
+    fast_tcache_lock_off(&heap->lock);
+
+    span->free = NULL;
+    span->fresh = (uchar_t *)span + FAST_TCACHE_SPAN_HEADER;
+    span->cls = cls;
+    span->used = 0;
+    span->in_list = 0;
+    span->released = 0;
+    span->size = fast_tcache_sizes[cls];
+
+    return span;
+}
+
+static void
+fast_tcache_span_release(fast_tcache_span_t *span)
+{
+    fast_tcache_heap_t   *heap = &fast_tcache_heap;
+    int64_t               now = fast_tcache_now_msec();
+
+    fast_tcache_lock_on(&heap->lock);
+    span->idle_since = now;
+    queue_insert_head(&heap->free, &span->q);
+    heap->stat.spans_used--;
+    heap->stat.spans_free++;
+    if (now - heap->last_scavenge >= FAST_TCACHE_SCAVENGE_MSEC) {
+        fast_tcache_scavenge(now, FAST_TCACHE_IDLE_MSEC);
+    }
+    fast_tcache_lock_off(&heap->lock);
+}
+
+//called with the heap lock held, the oldest free spans are at the tail
+static size_t
+fast_tcache_scavenge(int64_t now, int64_t idle_msec)
+{
+    fast_tcache_heap_t   *heap = &fast_tcache_heap;
+    fast_tcache_span_t   *span;
+    queue_t              *q;
+    size_t                bytes = 0;
+
+    heap->last_scavenge = now;
+    for (q = queue_tail(&heap->free); q != queue_sentinel(&heap->free);
+         q = queue_prev(q)) {
+        span = queue_data(q, fast_tcache_span_t, q);
+        if (now - span->idle_since < idle_msec) {
+            break;
+        }
+        if (span->released) {
+            continue;
+        }
+        //the first page keeps the header and the list links
+        if (madvise((uchar_t *)span + FAST_TCACHE_PAGE_SIZE,
+            FAST_TCACHE_SPAN_SIZE - FAST_TCACHE_PAGE_SIZE, MADV_DONTNEED) == 0) {
+            span->released = 1;
+            bytes += FAST_TCACHE_SPAN_SIZE - FAST_TCACHE_PAGE_SIZE;
+        }
+    }
+    heap->stat.released += bytes;
+    mem_governor_uncharge(bytes);
+
+    while (!queue_empty(&heap->large)) {
+        q = queue_tail(&heap->large);
+        span = queue_data(q, fast_tcache_span_t, q);
+        if (now - span->idle_since < idle_msec) {
+            break;
+        }
+        queue_remove(q);
+        heap->stat.large_cached -= span->size;
+        bytes += span->size;
+        mem_governor_uncharge(span->size);
+        munmap(span, span->size);
+    }
+
+    return bytes;
+}
+
+static void
+fast_tcache_fetch(uint32_t cls, fast_tcache_bin_t *bin)
+{
+    fast_tcache_central_t *central = &fast_tcache_central[cls];
+    fast_tcache_span_t    *span;
+    uchar_t               *end;
+    uint32_t               want, got = 0;
+    void                  *p;
+
+    want = bin->max / 2;
+    if (want < 1) {
+        want = 1;
+    }
+
+    fast_tcache_lock_on(&central->lock);
+    while (got < want) {
+        if (queue_empty(&central->spans)) {
+            fast_tcache_lock_off(&central->lock);
+            span = fast_tcache_span_acquire(cls);
+            fast_tcache_lock_on(&central->lock);
+            if (!span) {
+                break;
+            }
+            queue_insert_head(&central->spans, &span->q);
+            span->in_list = 1;
+        }
+        span = queue_data(queue_head(&central->spans), fast_tcache_span_t, q);
+        end = (uchar_t *)span + FAST_TCACHE_SPAN_SIZE;
+
+        while (got < want) {
+            if (span->free) {
+                p = span->free;
+                span->free = *(void **)p;
+            } else if (span->fresh + span->size <= end) {
+                p = span->fresh;
+                span->fresh += span->size;
+            } else {
+                break;
+            }
+            *(void **)p = bin->head;
+            bin->head = p;
+            span->used++;
+            got++;
+        }
+        if (!span->free && span->fresh + span->size > end) {
+            queue_remove(&span->q);
+            span->in_list = 0;
+        }
+    }
+    fast_tcache_lock_off(&central->lock);
+
+    bin->count += got;
+}
+
+//head is a NULL terminated chain of objects of class cls
+static void
+fast_tcache_put(uint32_t cls, void *head)
+{
+    fast_tcache_central_t *central = &fast_tcache_central[cls];
+    fast_tcache_span_t    *span;
+    void                  *p, *next;
+
+    fast_tcache_lock_on(&central->lock);
+    for (p = head; p; p = next) {
+        next = *(void **)p;
+        span = fast_tcache_span_of(p);
+        *(void **)p = span->free;
+        span->free = p;
+        if (--span->used == 0) {
+            if (span->in_list) {
+                queue_remove(&span->q);
+                span->in_list = 0;
+            }
+            fast_tcache_span_release(span);
+            continue;
+        }
+        if (!span->in_list) {
+            queue_insert_tail(&central->spans, &span->q);
+            span->in_list = 1;
+        }
+    }
+    fast_tcache_lock_off(&central->lock);
+}
+
+static void *
+fast_tcache_large_alloc(size_t size, size_t alignment)
+{
+    fast_tcache_heap_t *heap = &fast_tcache_heap;
+    fast_tcache_span_t *span = NULL, *s;
+    queue_t            *q;
+    size_t              len;
+
+    if (size > FAST_TCACHE_SIZE_MAX) {
+        return NULL;
+    }
+    len = (alignment + size + FAST_TCACHE_PAGE_SIZE - 1)
+        & ~(size_t)(FAST_TCACHE_PAGE_SIZE - 1);
+
+    //a cached mapping of up to twice the length is good enough
+    if (len <= FAST_TCACHE_LARGE_CACHE_MAX && fast_tcache_inited) {
+        fast_tcache_lock_on(&heap->lock);
+        for (q = queue_head(&heap->large); q != queue_sentinel(&heap->large);
+             q = queue_next(q)) {
+            s = queue_data(q, fast_tcache_span_t, q);
+            if (s->size >= len && s->size <= 2 * len) {
+                queue_remove(q);
+                heap->stat.large_cached -= s->size;
+                span = s;
+                break;
+            }
+        }
+        fast_tcache_lock_off(&heap->lock);
+    }
+
+    if (!span) {
+        span = fast_tcache_map(len);
+        if (!span) {
+            return NULL;
+        }
+        span->size = len;
+        mem_governor_charge(len);
+    }
+    span->cls = FAST_TCACHE_CLASS_LARGE;
+    span->used = 1;
+    __sync_fetch_and_add(&heap->stat.large, span->size);
+    __sync_fetch_and_add(&heap->stat.large_count, 1);
+
+    return (uchar_t *)span + alignment;
+}
+
+static void
+fast_tcache_large_free(fast_tcache_span_t *span)
+{
+    fast_tcache_heap_t *heap = &fast_tcache_heap;
+    size_t              len = span->size;
+    int64_t             now;
+
+    __sync_fetch_and_sub(&heap->stat.large, len);
+    __sync_fetch_and_sub(&heap->stat.large_count, 1);
+
+    if (len <= FAST_TCACHE_LARGE_CACHE_MAX && fast_tcache_inited) {
+        now = fast_tcache_now_msec();
+        fast_tcache_lock_on(&heap->lock);
+        if (heap->stat.large_cached + len <= FAST_TCACHE_LARGE_CACHE) {
+            span->used = 0;
+            span->idle_since = now;
+            queue_insert_head(&heap->large, &span->q);
+            heap->stat.large_cached += len;
+            if (now - heap->last_scavenge >= FAST_TCACHE_SCAVENGE_MSEC) {
+                fast_tcache_scavenge(now, FAST_TCACHE_IDLE_MSEC);
+            }
+            fast_tcache_lock_off(&heap->lock);
+            return;
+        }
+        fast_tcache_lock_off(&heap->lock);
+    }
+    mem_governor_uncharge(len);
+    munmap(span, len);
+}
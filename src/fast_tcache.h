@@ -0,0 +1,63 @@
+#ifndef _FAST_TCACHE_H
+#define _FAST_TCACHE_H
+
+#include "fast_types.h"
+
+/*
+ * thread caching allocator: objects up to FAST_TCACHE_MAX_SMALL bytes are
+ * served from per size class caches of the calling thread, refilled in
+ * batches from central per class lists of spans. a span is an aligned
+ * FAST_TCACHE_SPAN_SIZE block with its header at the start, so the class
+ * of any object is found from its address with one mask. larger objects
+ * are mmap'ed one by one.
+ *
+ * spans whose objects are all free go back to a page heap, spans idle
+ * there for FAST_TCACHE_IDLE_MSEC are returned to the OS with madvise.
+ * freed large mappings up to FAST_TCACHE_LARGE_CACHE_MAX are kept for
+ * reuse the same way and unmapped once idle.
+ */
+
+#define FAST_TCACHE_OK              (0)
+#define FAST_TCACHE_ERROR           (-1)
+
+#define FAST_TCACHE_SPAN_SHIFT      17
+#define FAST_TCACHE_SPAN_SIZE       ((size_t)1 << FAST_TCACHE_SPAN_SHIFT)
+#define FAST_TCACHE_SPAN_HEADER     64
+#define FAST_TCACHE_CHUNK_SPANS     32      //spans mapped at once
+#define FAST_TCACHE_MAX_SMALL       16384
+#define FAST_TCACHE_CLASSES         36
+#define FAST_TCACHE_CACHE_BYTES     (64 * 1024)  //per class and thread
+#define FAST_TCACHE_LARGE_CACHE_MAX (1024 * 1024)     //largest mapping kept
+#define FAST_TCACHE_LARGE_CACHE     (32 * 1024 * 1024) //bytes kept at most
+#define FAST_TCACHE_IDLE_MSEC       5000
+#define FAST_TCACHE_SCAVENGE_MSEC   1000
+
+typedef struct fast_tcache_stat_s {
+    size_t          mapped;      //bytes mapped for spans
+    size_t          released;    //span bytes given back with madvise
+    size_t          spans_used;
+    size_t          spans_free;
+    size_t          large;       //bytes of live large objects
+    size_t          large_count;
+    size_t          large_cached; //bytes of freed large mappings kept
+} fast_tcache_stat_t;
+
+int     fast_tcache_init(void);
+
+void   *fast_tcache_alloc(size_t size);
+void   *fast_tcache_calloc(size_t size);
+//size_hint is not trusted, the class comes from the span header
+void    fast_tcache_free(void *p, size_t size_hint);
+void   *fast_tcache_realloc(void *p, size_t size);
+//alignment above 16 goes through the large path
+void   *fast_tcache_memalign(size_t alignment, size_t size);
+size_t  fast_tcache_usable_size(void *p);
+
+//give the objects cached by this thread back, e.g. before idling
+void    fast_tcache_thread_flush(void);
+//give back free spans and large mappings idle for idle_msec, returns
+//the bytes released
+size_t  fast_tcache_release_idle(int64_t idle_msec);
+void    fast_tcache_get_stat(fast_tcache_stat_t *stat);
+
+#endif
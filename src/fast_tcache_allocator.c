@@ -0,0 +1,143 @@
+#include "fast_mem_allocator.h"
+#include "fast_tcache.h"
+
+/*
+ * the thread caching allocator is process wide, every instance shares it
+ * and needs neither init parameters nor private data
+ */
+
+static int
+fast_tcache_allocator_init(fast_mem_allocator_t *this, void *param_data);
+
+static int
+fast_tcache_allocator_release(fast_mem_allocator_t *this, void *param_data);
+
+static void *
+fast_tcache_allocator_alloc(fast_mem_allocator_t *this, size_t size,
+    void *param_data);
+
+static void *
+fast_tcache_allocator_calloc(fast_mem_allocator_t *this, size_t size,
+    void *param_data);
+
+static int
+fast_tcache_allocator_free(fast_mem_allocator_t *this, void *ptr,
+    void *param_data);
+
+static const char *
+fast_tcache_allocator_strerror(fast_mem_allocator_t *this, void *err_data);
+
+static int
+fast_tcache_allocator_stat(fast_mem_allocator_t *this, void *stat_data);
+
+static void *
+fast_tcache_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data);
+
+static void *
+fast_tcache_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data);
+
+static size_t
+fast_tcache_allocator_usable_size(fast_mem_allocator_t *this, void *ptr,
+    void *param_data);
+
+static fast_mem_allocator_t fast_tcache_allocator = {
+    .private_data   = NULL,
+    .type           = FAST_MEM_ALLOCATOR_TYPE_TCACHE,
+    .init           = fast_tcache_allocator_init,
+    .release        = fast_tcache_allocator_release,
+    .alloc          = fast_tcache_allocator_alloc,
+    .calloc         = fast_tcache_allocator_calloc,
+    .split_alloc    = NULL,
+    .free           = fast_tcache_allocator_free,
+    .strerror       = fast_tcache_allocator_strerror,
+    .stat           = fast_tcache_allocator_stat,
+    .realloc        = fast_tcache_allocator_realloc,
+    .memalign       = fast_tcache_allocator_memalign,
+    .alloc_batch    = NULL,
+    .free_batch     = NULL,
+    .usable_size    = fast_tcache_allocator_usable_size
+};
+
+static int
+fast_tcache_allocator_init(fast_mem_allocator_t *this, void *param_data)
+{
+    if (fast_tcache_init() != FAST_TCACHE_OK) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    return FAST_MEM_ALLOCATOR_OK;
+}
+
+static int
+fast_tcache_allocator_release(fast_mem_allocator_t *this, void *param_data)
+{
+    return FAST_MEM_ALLOCATOR_OK;
+}
+
+static void *
+fast_tcache_allocator_alloc(fast_mem_allocator_t *this, size_t size,
+    void *param_data)
+{
+    return fast_tcache_alloc(size);
+}
+
+static void *
+fast_tcache_allocator_calloc(fast_mem_allocator_t *this, size_t size,
+    void *param_data)
+{
+    return fast_tcache_calloc(size);
+}
+
+static int
+fast_tcache_allocator_free(fast_mem_allocator_t *this, void *ptr,
+    void *param_data)
+{
+    if (!ptr) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    fast_tcache_free(ptr, 0);
+    return FAST_MEM_ALLOCATOR_OK;
+}
+
+static const char *
+fast_tcache_allocator_strerror(fast_mem_allocator_t *this, void *err_data)
+{
+    return "no more error info";
+}
+
+static int
+fast_tcache_allocator_stat(fast_mem_allocator_t *this, void *stat_data)
+{
+    if (!stat_data) {
+        return FAST_MEM_ALLOCATOR_ERROR;
+    }
+    fast_tcache_get_stat((fast_tcache_stat_t *)stat_data);
+    return FAST_MEM_ALLOCATOR_OK;
+}
+
+static void *
+fast_tcache_allocator_realloc(fast_mem_allocator_t *this, void *ptr,
+    size_t old_size, size_t size, void *param_data)
+{
+    return fast_tcache_realloc(ptr, size);
+}
+
+static void *
+fast_tcache_allocator_memalign(fast_mem_allocator_t *this, size_t alignment,
+    size_t size, void *param_data)
+{
+    return fast_tcache_memalign(alignment, size);
+}
+
+static size_t
+fast_tcache_allocator_usable_size(fast_mem_allocator_t *this, void *ptr,
+    void *param_data)
+{
+    return fast_tcache_usable_size(ptr);
+}
+
+const fast_mem_allocator_t *fast_get_tcache_allocator(void)
+{
+    return &fast_tcache_allocator;
+}